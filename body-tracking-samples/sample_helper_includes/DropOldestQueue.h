@@ -0,0 +1,136 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+// Bounded queue between two pipeline stages, for entries that own resources such as k4a
+// captures or body frames.
+//
+// Overflow drops the oldest entry: Push() never blocks, and when the queue is full the oldest
+// entry is handed to the release function instead of being consumed, so a slow consumer never
+// stalls the producer and always gets the newest entries. Pop() waits for an entry.
+//
+// Unlike LatestValueRing, entries do not have to be trivially copyable, at the cost of a lock.
+template<typename T, size_t Capacity>
+class DropOldestQueue
+{
+    static_assert(Capacity > 0, "DropOldestQueue needs at least one slot");
+
+public:
+    using ReleaseFunction = std::function<void(T&)>;
+
+    // release is called for every entry that is dropped or left in the queue when it is cleared
+    explicit DropOldestQueue(ReleaseFunction release)
+        : m_release(std::move(release))
+    {
+    }
+
+    ~DropOldestQueue()
+    {
+        Clear();
+    }
+
+    DropOldestQueue(const DropOldestQueue&) = delete;
+    DropOldestQueue& operator=(const DropOldestQueue&) = delete;
+
+    // Never blocks. Returns false if the oldest entry had to be dropped.
+    bool Push(T value)
+    {
+        bool dropped = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_size == Capacity)
+            {
+                m_release(m_slots[m_first]);
+                m_slots[m_first] = T();
+                m_first = (m_first + 1) % Capacity;
+                --m_size;
+                ++m_dropped;
+                dropped = true;
+            }
+
+            m_slots[(m_first + m_size) % Capacity] = std::move(value);
+            ++m_size;
+            ++m_pushed;
+        }
+        m_available.notify_one();
+        return !dropped;
+    }
+
+    // Pops the oldest entry, waiting up to timeout for one. Returns false if there was none, or
+    // if the queue was closed.
+    template<typename Rep, typename Period>
+    bool Pop(T& value, std::chrono::duration<Rep, Period> timeout)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_available.wait_for(lock, timeout, [this] { return m_size > 0 || m_closed; }) || m_size == 0)
+        {
+            return false;
+        }
+
+        value = std::move(m_slots[m_first]);
+        m_slots[m_first] = T();
+        m_first = (m_first + 1) % Capacity;
+        --m_size;
+        return true;
+    }
+
+    // Wakes up and fails all current and future Pop() calls, e.g. when the pipeline stops
+    void Close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_available.notify_all();
+    }
+
+    // Releases all entries that were not consumed
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (; m_size > 0; --m_size)
+        {
+            m_release(m_slots[m_first]);
+            m_slots[m_first] = T();
+            m_first = (m_first + 1) % Capacity;
+        }
+    }
+
+    // Total number of entries pushed / dropped without being consumed
+    uint64_t Pushed() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pushed;
+    }
+
+    uint64_t Dropped() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_dropped;
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    const ReleaseFunction m_release;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_available;
+    std::array<T, Capacity> m_slots = {};
+    size_t m_first = 0;
+    size_t m_size = 0;
+    bool m_closed = false;
+
+    uint64_t m_pushed = 0;
+    uint64_t m_dropped = 0;
+};
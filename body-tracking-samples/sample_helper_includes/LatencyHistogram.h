@@ -0,0 +1,108 @@
+/**
+ * LatencyHistogram.h
+ *
+ * Fixed-size histogram of durations with logarithmic buckets.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * Histogram of durations in nanoseconds, cheap enough to record every call of
+ * a hot path: record() is a handful of integer operations and never
+ * allocates.
+ *
+ * Every power of two is split into SUB_BUCKETS buckets, so percentiles are
+ * accurate to about 12%, from nanoseconds up to minutes. Count, sum, min and
+ * max are exact.
+ */
+class LatencyHistogram {
+
+public:
+	static const int SUB_BUCKET_BITS = 3;
+	static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static const int MAX_EXPONENT = 42;  // durations of 2^43 ns (2.4 hours) and more share the last bucket
+	static const int NUM_BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+	void record(const uint64_t nanoseconds)
+	{
+		++_buckets[bucketIndex(nanoseconds)];
+		++_count;
+		_sum += nanoseconds;
+		_min = std::min(_min, nanoseconds);
+		_max = std::max(_max, nanoseconds);
+	}
+
+	void record(const std::chrono::steady_clock::duration duration)
+	{
+		record(static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count())));
+	}
+
+	// Add all durations of another histogram
+	void merge(const LatencyHistogram& other)
+	{
+		for (int i = 0; i < NUM_BUCKETS; ++i) _buckets[i] += other._buckets[i];
+		_count += other._count;
+		_sum += other._sum;
+		_min = std::min(_min, other._min);
+		_max = std::max(_max, other._max);
+	}
+
+	void reset() { *this = LatencyHistogram(); }
+
+	uint64_t count() const { return _count; }
+	uint64_t min() const { return _count > 0 ? _min : 0; }
+	uint64_t max() const { return _max; }
+	double mean() const { return _count > 0 ? static_cast<double>(_sum) / _count : 0; }
+
+	/**
+	 * Duration below which the given fraction of the recorded durations lie,
+	 * e.g. 0.99 for the 99th percentile, in nanoseconds. Returns the middle
+	 * of the bucket, clamped to the exact min and max; 0 if empty.
+	 */
+	uint64_t percentile(const double fraction) const
+	{
+		if (_count == 0) return 0;
+		const uint64_t rank = static_cast<uint64_t>(std::max(0.0, std::min(1.0, fraction)) * (_count - 1)) + 1;
+		uint64_t seen = 0;
+		int i = 0;
+		for (; i < NUM_BUCKETS - 1; ++i) {
+			seen += _buckets[i];
+			if (seen >= rank) break;
+		}
+		const uint64_t middle = bucketLowerBound(i) + (bucketLowerBound(i + 1) - bucketLowerBound(i)) / 2;
+		return std::max(_min, std::min(_max, middle));
+	}
+
+private:
+	static int bucketIndex(const uint64_t value)
+	{
+		if (value < SUB_BUCKETS) return static_cast<int>(value);
+		int exponent = SUB_BUCKET_BITS;
+		while (exponent < MAX_EXPONENT && (value >> (exponent + 1)) != 0) ++exponent;
+		if ((value >> (exponent + 1)) != 0) return NUM_BUCKETS - 1;
+		const int sub_bucket = static_cast<int>(value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+		return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+	}
+
+	static uint64_t bucketLowerBound(const int index)
+	{
+		if (index < SUB_BUCKETS) return static_cast<uint64_t>(index);
+		const int exponent = index / SUB_BUCKETS - 1 + SUB_BUCKET_BITS;
+		const uint64_t sub_bucket = static_cast<uint64_t>(index % SUB_BUCKETS);
+		return (uint64_t(1) << exponent) + (sub_bucket << (exponent - SUB_BUCKET_BITS));
+	}
+
+	std::array<uint64_t, NUM_BUCKETS> _buckets{};
+	uint64_t _count = 0;
+	uint64_t _sum = 0;
+	uint64_t _min = UINT64_MAX;
+	uint64_t _max = 0;
+};
+
+#endif  // LATENCY_HISTOGRAM_H
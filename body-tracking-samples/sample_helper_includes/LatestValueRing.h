@@ -0,0 +1,179 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Bounded lock-free ring for exactly one producer thread and one consumer thread.
+//
+// Overflow is latest-value-wins: when the ring is full, Push() discards the oldest
+// entry instead of blocking, so a slow consumer can never stall the producer.
+//
+// One slot more than the capacity is allocated so that the producer never writes the
+// slot the consumer is copying from unless that entry has already been discarded. A
+// consumer whose entry was discarded mid-copy notices through the failed
+// compare-exchange on the read index and retries with the next entry.
+//
+// Each slot is a seqlock, like the slots of SharedMemoryClient: the producer makes its
+// sequence number odd, stores the entry and makes it even again. Entries are stored and
+// loaded as relaxed atomic 64-bit words, so a copy that overlaps a write is never a data
+// race; the consumer discards it when the sequence number was odd or changed.
+template<typename T, size_t Capacity>
+class LatestValueRing
+{
+    static_assert(Capacity > 0, "LatestValueRing needs at least one slot");
+    static_assert(std::is_trivially_copyable<T>::value, "LatestValueRing entries are copied without locking");
+
+public:
+    // Producer side. Never blocks. Returns false if the oldest entry had to be discarded.
+    bool Push(const T& value)
+    {
+        bool discarded = false;
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        uint64_t tail = m_tail.load(std::memory_order_acquire);
+        if (head - tail >= Capacity)
+        {
+            // Full. If the exchange fails the consumer just freed a slot itself.
+            if (m_tail.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                discarded = true;
+            }
+        }
+
+        Store(m_slots[head % SlotCount], value);
+        m_head.store(head + 1, std::memory_order_release);
+        m_pushed.fetch_add(1, std::memory_order_relaxed);
+        return !discarded;
+    }
+
+    // Consumer side. Pops the oldest entry; returns false if the ring is empty.
+    bool Pop(T& value)
+    {
+        uint64_t tail = m_tail.load(std::memory_order_acquire);
+        while (true)
+        {
+            uint64_t head = m_head.load(std::memory_order_acquire);
+            if (tail == head)
+            {
+                return false;
+            }
+
+            // A torn copy means the producer discarded the entry, so the read index moved on
+            if (!Load(m_slots[tail % SlotCount], value))
+            {
+                tail = m_tail.load(std::memory_order_acquire);
+                continue;
+            }
+            if (m_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                return true;
+            }
+        }
+    }
+
+    // Consumer side. Pops only the newest entry and discards everything older, which
+    // counts towards Dropped(). Returns false if the ring is empty.
+    bool PopLatest(T& value)
+    {
+        uint64_t tail = m_tail.load(std::memory_order_acquire);
+        while (true)
+        {
+            uint64_t head = m_head.load(std::memory_order_acquire);
+            if (tail == head)
+            {
+                return false;
+            }
+
+            if (!Load(m_slots[(head - 1) % SlotCount], value))
+            {
+                tail = m_tail.load(std::memory_order_acquire);
+                continue;
+            }
+            if (m_tail.compare_exchange_weak(tail, head, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                m_dropped.fetch_add(head - 1 - tail, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+
+    // Number of entries waiting to be consumed. Approximate while both sides are active.
+    size_t Depth() const
+    {
+        uint64_t tail = m_tail.load(std::memory_order_acquire);
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        return static_cast<size_t>(head - tail);
+    }
+
+    // Total number of entries pushed / discarded without being consumed
+    uint64_t Pushed() const { return m_pushed.load(std::memory_order_relaxed); }
+    uint64_t Dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    static constexpr size_t SlotCount = Capacity + 1;
+    static constexpr size_t WordCount = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    struct Slot
+    {
+        std::atomic<uint64_t> seq{ 0 };  // odd while the producer stores the entry
+        std::array<std::atomic<uint64_t>, WordCount> words;
+    };
+
+    static void Store(Slot& slot, const T& value)
+    {
+        const uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+        for (size_t i = 0; i < WordCount; ++i)
+        {
+            uint64_t word = 0;
+            std::memcpy(&word, bytes + i * sizeof(word), std::min(sizeof(word), sizeof(T) - i * sizeof(word)));
+            slot.words[i].store(word, std::memory_order_relaxed);
+        }
+        slot.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // Returns false, leaving value unchanged, if the producer stored the slot meanwhile
+    static bool Load(const Slot& slot, T& value)
+    {
+        const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq & 1)
+        {
+            return false;
+        }
+
+        alignas(T) unsigned char bytes[sizeof(T)];
+        for (size_t i = 0; i < WordCount; ++i)
+        {
+            const uint64_t word = slot.words[i].load(std::memory_order_relaxed);
+            std::memcpy(bytes + i * sizeof(word), &word, std::min(sizeof(word), sizeof(T) - i * sizeof(word)));
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq)
+        {
+            return false;
+        }
+        std::memcpy(&value, bytes, sizeof(T));
+        return true;
+    }
+
+    std::array<Slot, SlotCount> m_slots;
+
+    // Producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<uint64_t> m_head{ 0 };
+    alignas(64) std::atomic<uint64_t> m_tail{ 0 };
+    alignas(64) std::atomic<uint64_t> m_pushed{ 0 };
+    std::atomic<uint64_t> m_dropped{ 0 };
+};
@@ -0,0 +1,125 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <k4abttypes.h>
+
+#include <RedisClient.h>
+
+// Compact binary value holding one tracked body of one frame, published as a single Redis key.
+//
+// Layout (little-endian, 960 bytes):
+//   [0..3]     magic "K4SK"
+//   [4..5]     format version
+//   [6..7]     joint count (K4ABT_JOINT_COUNT)
+//   [8..15]    frame id
+//   [16..23]   device timestamp [usec]
+//   [24..27]   body id
+//   [28..31]   reserved (0)
+//   [32..927]  per joint: position x, y, z [mm] and orientation w, x, y, z as float32
+//   [928..959] per joint: confidence level as uint8
+namespace PackedSkeleton
+{
+    const char Magic[4] = { 'K', '4', 'S', 'K' };
+    const uint16_t Version = 1;
+    const size_t HeaderSize = 32;
+    const size_t JointSize = 7 * sizeof(float);
+    const size_t ConfidenceOffset = HeaderSize + K4ABT_JOINT_COUNT * JointSize;
+    const size_t Size = ConfidenceOffset + K4ABT_JOINT_COUNT;
+
+    struct FrameInfo
+    {
+        uint64_t frameId = 0;
+        uint64_t deviceTimestampUsec = 0;
+        uint32_t bodyId = 0;
+    };
+
+    // Writes exactly Size bytes to out
+    inline void Encode(const FrameInfo& info, const k4abt_skeleton_t& skeleton, char* out)
+    {
+        using RedisEigenBinary::storeLittleEndian;
+
+        std::memcpy(out, Magic, sizeof(Magic));
+        storeLittleEndian<uint16_t>(out + 4, Version);
+        storeLittleEndian<uint16_t>(out + 6, static_cast<uint16_t>(K4ABT_JOINT_COUNT));
+        storeLittleEndian<uint64_t>(out + 8, info.frameId);
+        storeLittleEndian<uint64_t>(out + 16, info.deviceTimestampUsec);
+        storeLittleEndian<uint32_t>(out + 24, info.bodyId);
+        storeLittleEndian<uint32_t>(out + 28, 0);
+
+        char* joint = out + HeaderSize;
+        for (int i = 0; i < static_cast<int>(K4ABT_JOINT_COUNT); i++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                storeLittleEndian<float>(joint + k * sizeof(float), skeleton.joints[i].position.v[k]);
+            }
+            for (int k = 0; k < 4; k++)
+            {
+                storeLittleEndian<float>(joint + (3 + k) * sizeof(float), skeleton.joints[i].orientation.v[k]);
+            }
+            joint += JointSize;
+
+            out[ConfidenceOffset + i] = static_cast<char>(skeleton.joints[i].confidence_level);
+        }
+    }
+
+    inline std::string Encode(const FrameInfo& info, const k4abt_skeleton_t& skeleton)
+    {
+        std::string value(Size, '\0');
+        Encode(info, skeleton, &value[0]);
+        return value;
+    }
+
+    // Returns false if the value is not a packed skeleton of this format version
+    inline bool Decode(const char* data, size_t size, FrameInfo& info, k4abt_skeleton_t& skeleton)
+    {
+        using RedisEigenBinary::loadLittleEndian;
+
+        if (size != Size || std::memcmp(data, Magic, sizeof(Magic)) != 0 ||
+            loadLittleEndian<uint16_t>(data + 4) != Version ||
+            loadLittleEndian<uint16_t>(data + 6) != K4ABT_JOINT_COUNT)
+        {
+            return false;
+        }
+
+        info.frameId = loadLittleEndian<uint64_t>(data + 8);
+        info.deviceTimestampUsec = loadLittleEndian<uint64_t>(data + 16);
+        info.bodyId = loadLittleEndian<uint32_t>(data + 24);
+
+        const char* joint = data + HeaderSize;
+        for (int i = 0; i < static_cast<int>(K4ABT_JOINT_COUNT); i++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                skeleton.joints[i].position.v[k] = loadLittleEndian<float>(joint + k * sizeof(float));
+            }
+            for (int k = 0; k < 4; k++)
+            {
+                skeleton.joints[i].orientation.v[k] = loadLittleEndian<float>(joint + (3 + k) * sizeof(float));
+            }
+            joint += JointSize;
+
+            skeleton.joints[i].confidence_level = static_cast<k4abt_joint_confidence_level_t>(data[ConfidenceOffset + i]);
+        }
+        return true;
+    }
+
+    inline bool Decode(const std::string& value, FrameInfo& info, k4abt_skeleton_t& skeleton)
+    {
+        return Decode(value.data(), value.size(), info, skeleton);
+    }
+
+    // Reads and decodes a packed skeleton key. Throws if the key is missing or malformed.
+    inline void Read(RedisClient& redisClient, const std::string& key, FrameInfo& info, k4abt_skeleton_t& skeleton)
+    {
+        if (!Decode(redisClient.get(key), info, skeleton))
+        {
+            throw std::runtime_error("PackedSkeleton: '" + key + "' does not hold a packed skeleton.");
+        }
+    }
+}
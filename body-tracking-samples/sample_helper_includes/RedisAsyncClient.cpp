@@ -0,0 +1,443 @@
+/**
+ * RedisAsyncClient.cpp
+ */
+
+#include "RedisAsyncClient.h"
+#include <algorithm>
+#include <charconv>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#define REDIS_ASYNC_POLL WSAPoll
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#define REDIS_ASYNC_POLL poll
+#endif
+
+namespace {
+
+// Replies outstanding on the connection before batches stay in the backlog
+const size_t MAX_PENDING_REPLIES = 4096;
+
+// Time allowed for a connection attempt
+const std::chrono::milliseconds CONNECT_TIMEOUT(1500);
+
+// Longest time the I/O thread sleeps without checking for work
+const std::chrono::milliseconds IDLE_TIMEOUT(100);
+
+// Returns the length of the RESP command "*<n>\r\n($<len>\r\n<data>\r\n)*n" at
+// p, or 0 if it is malformed or incomplete
+size_t commandLength(const char *p, const char *end)
+{
+	const char *begin = p;
+	auto readHeader = [&](char type, size_t& value) {
+		if(p == end || *p != type) return false;
+		const auto result = std::from_chars(p + 1, end, value);
+		if(result.ec != std::errc() || end - result.ptr < 2) return false;
+		p = result.ptr + 2;
+		return true;
+	};
+
+	size_t num_args = 0;
+	if(!readHeader('*', num_args)) return 0;
+	for(size_t i = 0; i < num_args; i++)
+	{
+		size_t len = 0;
+		if(!readHeader('$', len) || static_cast<size_t>(end - p) < len + 2) return 0;
+		p += len + 2;
+	}
+	return p - begin;
+}
+
+}  // namespace
+
+RedisAsyncClient::~RedisAsyncClient()
+{
+	disconnect();
+}
+
+void RedisAsyncClient::connect(const std::string& hostname, const int port, const size_t backlog_capacity,
+                               const std::chrono::milliseconds min_backoff, const std::chrono::milliseconds max_backoff)
+{
+	disconnect(std::chrono::milliseconds(0));
+
+	_hostname = hostname;
+	_port = port;
+	_backlog_capacity = std::max<size_t>(backlog_capacity, 1);
+	_min_backoff = min_backoff;
+	_max_backoff = std::max(min_backoff, max_backoff);
+	_backoff = _min_backoff;
+	_next_attempt = std::chrono::steady_clock::now();
+	_ever_connected = false;
+
+#ifndef _WIN32
+	if(pipe(_wakeup_fds) == 0)
+	{
+		fcntl(_wakeup_fds[0], F_SETFL, O_NONBLOCK);
+		fcntl(_wakeup_fds[1], F_SETFL, O_NONBLOCK);
+	}
+	else
+	{
+		_wakeup_fds[0] = _wakeup_fds[1] = -1;
+	}
+#endif
+
+	_running = true;
+	_thread = std::thread(&RedisAsyncClient::run, this);
+}
+
+void RedisAsyncClient::disconnect(const std::chrono::milliseconds flush_timeout)
+{
+	if(!_thread.joinable()) return;
+
+	_flush_deadline = std::chrono::steady_clock::now() + flush_timeout;
+	_running = false;
+	wakeUp();
+	_thread.join();
+
+#ifndef _WIN32
+	for(int& fd : _wakeup_fds)
+	{
+		if(fd >= 0) close(fd);
+		fd = -1;
+	}
+#endif
+
+	std::lock_guard<std::mutex> lock(_backlog_mutex);
+	_dropped += _backlog.size();
+	_backlog.clear();
+}
+
+bool RedisAsyncClient::send(const std::string& commands)
+{
+	bool discarded = false;
+	{
+		std::lock_guard<std::mutex> lock(_backlog_mutex);
+		if(_backlog.size() >= _backlog_capacity)
+		{
+			_free_batches.push_back(std::move(_backlog.front()));
+			_backlog.pop_front();
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			discarded = true;
+		}
+
+		// Recycle the buffers of sent batches, so queueing does not allocate after warm-up
+		if(_free_batches.empty())
+		{
+			_backlog.emplace_back(commands);
+		}
+		else
+		{
+			_backlog.push_back(std::move(_free_batches.back()));
+			_free_batches.pop_back();
+			_backlog.back().assign(commands);
+		}
+	}
+	wakeUp();
+	return !discarded;
+}
+
+bool RedisAsyncClient::set(const std::string& key, const std::string& value)
+{
+	const char *argv[] = {"SET", key.data(), value.data()};
+	const size_t argvlen[] = {3, key.size(), value.size()};
+	std::string command;
+	appendCommandArgv(command, 3, argv, argvlen);
+	return send(command);
+}
+
+bool RedisAsyncClient::publish(const std::string& channel, const std::string& message)
+{
+	const char *argv[] = {"PUBLISH", channel.data(), message.data()};
+	const size_t argvlen[] = {7, channel.size(), message.size()};
+	std::string command;
+	appendCommandArgv(command, 3, argv, argvlen);
+	return send(command);
+}
+
+void RedisAsyncClient::appendCommandArgv(std::string& out, const int argc, const char **argv, const size_t *argvlen)
+{
+	char buf[24];
+	out.append("*");
+	out.append(buf, std::to_chars(buf, buf + sizeof(buf), argc).ptr);
+	out.append("\r\n");
+	for(int i = 0; i < argc; i++)
+	{
+		out.append("$");
+		out.append(buf, std::to_chars(buf, buf + sizeof(buf), argvlen[i]).ptr);
+		out.append("\r\n");
+		out.append(argv[i], argvlen[i]);
+		out.append("\r\n");
+	}
+}
+
+size_t RedisAsyncClient::backlogSize() const
+{
+	std::lock_guard<std::mutex> lock(_backlog_mutex);
+	return _backlog.size();
+}
+
+void RedisAsyncClient::wakeUp()
+{
+#ifndef _WIN32
+	if(_wakeup_fds[1] >= 0)
+	{
+		const char byte = 0;
+		(void) !write(_wakeup_fds[1], &byte, 1);
+	}
+#endif
+}
+
+/**
+ * I/O thread
+ */
+void RedisAsyncClient::run()
+{
+	while(true)
+	{
+		const auto now = std::chrono::steady_clock::now();
+
+		// When stopping, keep flushing a live connection until the deadline
+		if(!_running)
+		{
+			const bool idle = _pending_replies == 0 && backlogSize() == 0;
+			if(_context == nullptr || _state != CONNECTED || idle || now >= _flush_deadline) break;
+		}
+
+		if(_context == nullptr && _running && now >= _next_attempt)
+		{
+			startConnect();
+		}
+		if(_context != nullptr && _state == CONNECTING && now >= _connect_deadline)
+		{
+			closeContext();
+			scheduleReconnect();
+		}
+		if(_context != nullptr && _state == CONNECTED)
+		{
+			submitBacklog();
+		}
+
+		// Wait for socket events, a queued batch, or the next reconnect attempt
+		auto timeout = IDLE_TIMEOUT;
+		if(_context == nullptr)
+		{
+			timeout = std::min(timeout, std::chrono::duration_cast<std::chrono::milliseconds>(_next_attempt - now));
+		}
+#ifdef _WIN32
+		// No wakeup pipe: poll the backlog frequently instead
+		timeout = std::min(timeout, std::chrono::milliseconds(2));
+#endif
+		timeout = std::max(timeout, std::chrono::milliseconds(0));
+
+		pollfd fds[2];
+		int num_fds = 0;
+		int context_fd = -1;
+		if(_context != nullptr)
+		{
+			context_fd = num_fds;
+			fds[num_fds].fd = _context->c.fd;
+			fds[num_fds].events = (_want_read ? POLLIN : 0) | (_want_write ? POLLOUT : 0);
+			fds[num_fds].revents = 0;
+			num_fds++;
+		}
+#ifndef _WIN32
+		int wakeup_fd = -1;
+		if(_wakeup_fds[0] >= 0)
+		{
+			wakeup_fd = num_fds;
+			fds[num_fds].fd = _wakeup_fds[0];
+			fds[num_fds].events = POLLIN;
+			fds[num_fds].revents = 0;
+			num_fds++;
+		}
+#endif
+
+		if(num_fds == 0)
+		{
+			std::this_thread::sleep_for(timeout);
+			continue;
+		}
+		if(REDIS_ASYNC_POLL(fds, num_fds, static_cast<int>(timeout.count())) <= 0)
+		{
+			continue;
+		}
+
+#ifndef _WIN32
+		if(wakeup_fd >= 0 && (fds[wakeup_fd].revents & POLLIN))
+		{
+			char drain[64];
+			while(read(_wakeup_fds[0], drain, sizeof(drain)) > 0) {}
+		}
+#endif
+		if(context_fd >= 0)
+		{
+			// Either call may free the context through onDisconnect
+			const short revents = fds[context_fd].revents;
+			if(_context != nullptr && (revents & (POLLIN | POLLERR | POLLHUP)))
+			{
+				redisAsyncHandleRead(_context);
+			}
+			if(_context != nullptr && (revents & (POLLOUT | POLLERR)))
+			{
+				redisAsyncHandleWrite(_context);
+			}
+		}
+	}
+
+	closeContext();
+}
+
+void RedisAsyncClient::startConnect()
+{
+	_context = redisAsyncConnect(_hostname.c_str(), _port);
+	if(_context == nullptr)
+	{
+		scheduleReconnect();
+		return;
+	}
+	if(_context->err)
+	{
+		redisAsyncFree(_context);
+		_context = nullptr;
+		scheduleReconnect();
+		return;
+	}
+
+	// Attach the event loop before the connect callback, which registers for the first write event
+	_context->data = this;
+	_context->ev.data = this;
+	_context->ev.addRead = addRead;
+	_context->ev.delRead = delRead;
+	_context->ev.addWrite = addWrite;
+	_context->ev.delWrite = delWrite;
+	_context->ev.cleanup = cleanup;
+	_want_read = false;
+	_want_write = true;
+
+	_state = CONNECTING;
+	_connect_deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+	redisAsyncSetConnectCallback(_context, onConnect);
+	redisAsyncSetDisconnectCallback(_context, onDisconnect);
+}
+
+void RedisAsyncClient::closeContext()
+{
+	if(_context == nullptr) return;
+
+	// Invokes onReply for every pending command, and onDisconnect if connected
+	redisAsyncContext *context = _context;
+	_context = nullptr;
+	redisAsyncFree(context);
+	_pending_replies = 0;
+	_state = DISCONNECTED;
+}
+
+void RedisAsyncClient::scheduleReconnect()
+{
+	_state = DISCONNECTED;
+	_next_attempt = std::chrono::steady_clock::now() + _backoff;
+	_backoff = std::min(_backoff * 2, _max_backoff);
+}
+
+bool RedisAsyncClient::submitBacklog()
+{
+	bool submitted = false;
+	while(_context != nullptr && _pending_replies < MAX_PENDING_REPLIES)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_backlog_mutex);
+			if(_backlog.empty()) break;
+			_batch.swap(_backlog.front());
+			_free_batches.push_back(std::move(_backlog.front()));
+			_backlog.pop_front();
+		}
+
+		// hiredis matches one reply callback per command
+		const char *p = _batch.data();
+		const char *end = _batch.data() + _batch.size();
+		while(p < end && _context != nullptr)
+		{
+			const size_t len = commandLength(p, end);
+			if(len == 0)
+			{
+				_failed.fetch_add(1, std::memory_order_relaxed);
+				break;
+			}
+			if(redisAsyncFormattedCommand(_context, onReply, this, p, len) == REDIS_OK)
+			{
+				_pending_replies++;
+				_sent.fetch_add(1, std::memory_order_relaxed);
+				submitted = true;
+			}
+			else
+			{
+				_lost.fetch_add(1, std::memory_order_relaxed);
+			}
+			p += len;
+		}
+	}
+	return submitted;
+}
+
+/**
+ * hiredis callbacks
+ */
+void RedisAsyncClient::onConnect(const redisAsyncContext *ac, int status)
+{
+	RedisAsyncClient *client = static_cast<RedisAsyncClient *>(ac->data);
+	if(status != REDIS_OK)
+	{
+		// hiredis frees the context after a failed connection
+		client->_context = nullptr;
+		client->scheduleReconnect();
+		return;
+	}
+
+	client->_state = CONNECTED;
+	client->_backoff = client->_min_backoff;
+	if(client->_ever_connected)
+	{
+		client->_reconnects.fetch_add(1, std::memory_order_relaxed);
+	}
+	client->_ever_connected = true;
+}
+
+void RedisAsyncClient::onDisconnect(const redisAsyncContext *ac, int /*status*/)
+{
+	// hiredis frees the context after this callback
+	RedisAsyncClient *client = static_cast<RedisAsyncClient *>(ac->data);
+	client->_context = nullptr;
+	client->_pending_replies = 0;
+	client->scheduleReconnect();
+}
+
+void RedisAsyncClient::onReply(redisAsyncContext * /*ac*/, void *reply, void *privdata)
+{
+	RedisAsyncClient *client = static_cast<RedisAsyncClient *>(privdata);
+	if(client->_pending_replies > 0) client->_pending_replies--;
+
+	redisReply *r = static_cast<redisReply *>(reply);
+	if(r == nullptr)
+	{
+		client->_lost.fetch_add(1, std::memory_order_relaxed);
+	}
+	else if(r->type == REDIS_REPLY_ERROR)
+	{
+		client->_failed.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void RedisAsyncClient::addRead(void *privdata)  { static_cast<RedisAsyncClient *>(privdata)->_want_read = true; }
+void RedisAsyncClient::delRead(void *privdata)  { static_cast<RedisAsyncClient *>(privdata)->_want_read = false; }
+void RedisAsyncClient::addWrite(void *privdata) { static_cast<RedisAsyncClient *>(privdata)->_want_write = true; }
+void RedisAsyncClient::delWrite(void *privdata) { static_cast<RedisAsyncClient *>(privdata)->_want_write = false; }
+
+void RedisAsyncClient::cleanup(void *privdata)
+{
+	RedisAsyncClient *client = static_cast<RedisAsyncClient *>(privdata);
+	client->_want_read = false;
+	client->_want_write = false;
+}
@@ -0,0 +1,164 @@
+/**
+ * RedisAsyncClient.h
+ *
+ * Non-blocking Redis connection on the hiredis async API, for producers
+ * that must never stall on Redis.
+ */
+
+#ifndef REDIS_ASYNC_CLIENT_H
+#define REDIS_ASYNC_CLIENT_H
+
+#include <hiredis/async.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Write-only Redis connection served by its own I/O thread.
+ *
+ * Commands are queued with send() and written by the I/O thread, so callers
+ * never wait on the network and never see connection errors. While the
+ * server is unreachable, the I/O thread reconnects with exponential backoff
+ * and queued batches wait in a bounded backlog that discards the oldest batch
+ * when full. Connection state and drop counters can be polled at any time.
+ *
+ * Replies are only counted: error replies increase failedCount(), and
+ * commands whose reply was lost in a disconnect increase lostCount().
+ */
+class RedisAsyncClient {
+
+public:
+	enum ConnectionState
+	{
+		DISCONNECTED,
+		CONNECTING,
+		CONNECTED,
+	};
+
+	RedisAsyncClient() {}
+	~RedisAsyncClient();
+
+	RedisAsyncClient(const RedisAsyncClient&) = delete;
+	RedisAsyncClient& operator=(const RedisAsyncClient&) = delete;
+
+	/**
+	 * Start the I/O thread and connect to a Redis server. Returns immediately.
+	 *
+	 * @param hostname          Redis server IP address (default 127.0.0.1).
+	 * @param port              Redis server port number (default 6379).
+	 * @param backlog_capacity  Batches kept while disconnected or while the
+	 *                          server falls behind (default 64).
+	 * @param min_backoff       First reconnect delay, doubled after every
+	 *                          failed attempt (default 100ms).
+	 * @param max_backoff       Longest reconnect delay (default 5s).
+	 */
+	void connect(const std::string& hostname="127.0.0.1", const int port=6379,
+	             const size_t backlog_capacity=64,
+	             const std::chrono::milliseconds min_backoff=std::chrono::milliseconds(100),
+	             const std::chrono::milliseconds max_backoff=std::chrono::milliseconds(5000));
+
+	/**
+	 * Send what is still queued for up to flush_timeout, then stop the I/O
+	 * thread and close the connection.
+	 */
+	void disconnect(const std::chrono::milliseconds flush_timeout=std::chrono::milliseconds(500));
+
+	/**
+	 * Queue a batch of RESP commands, e.g. from RedisClient::formatWriteCallbacks().
+	 *
+	 * Never blocks on the network. The batch is copied, so the buffer can be
+	 * reused right away.
+	 *
+	 * @param commands  One or more complete RESP commands.
+	 * @return          False if the oldest queued batch had to be discarded.
+	 */
+	bool send(const std::string& commands);
+
+	/**
+	 * Queue SET key value / PUBLISH channel message. Binary safe.
+	 */
+	bool set(const std::string& key, const std::string& value);
+	bool publish(const std::string& channel, const std::string& message);
+
+	/**
+	 * Append a binary-safe RESP command, like hiredis redisFormatCommandArgv().
+	 */
+	static void appendCommandArgv(std::string& out, const int argc, const char **argv, const size_t *argvlen);
+
+	ConnectionState state() const { return _state.load(std::memory_order_relaxed); }
+
+	// Batches waiting in the backlog
+	size_t backlogSize() const;
+
+	// Commands handed to the connection / batches discarded from the backlog /
+	// commands answered with an error / without a reply because the connection dropped
+	uint64_t sentCount() const { return _sent.load(std::memory_order_relaxed); }
+	uint64_t droppedCount() const { return _dropped.load(std::memory_order_relaxed); }
+	uint64_t failedCount() const { return _failed.load(std::memory_order_relaxed); }
+	uint64_t lostCount() const { return _lost.load(std::memory_order_relaxed); }
+
+	// Successful connections after the first one
+	uint64_t reconnectCount() const { return _reconnects.load(std::memory_order_relaxed); }
+
+private:
+	void run();
+	void startConnect();
+	void closeContext();
+	void scheduleReconnect();
+	bool submitBacklog();
+	void wakeUp();
+
+	// hiredis callbacks, privdata / ac->data is this client
+	static void onConnect(const redisAsyncContext *ac, int status);
+	static void onDisconnect(const redisAsyncContext *ac, int status);
+	static void onReply(redisAsyncContext *ac, void *reply, void *privdata);
+
+	// Event loop hooks for hiredis
+	static void addRead(void *privdata);
+	static void delRead(void *privdata);
+	static void addWrite(void *privdata);
+	static void delWrite(void *privdata);
+	static void cleanup(void *privdata);
+
+	std::string _hostname;
+	int _port = 6379;
+	size_t _backlog_capacity = 64;
+	std::chrono::milliseconds _min_backoff{100};
+	std::chrono::milliseconds _max_backoff{5000};
+
+	// Shared with producer threads
+	mutable std::mutex _backlog_mutex;
+	std::deque<std::string> _backlog;
+	std::vector<std::string> _free_batches;  // recycled batch buffers
+	std::atomic<bool> _running{false};
+	std::chrono::steady_clock::time_point _flush_deadline;  // written before _running is cleared
+	std::atomic<ConnectionState> _state{DISCONNECTED};
+	std::atomic<uint64_t> _sent{0};
+	std::atomic<uint64_t> _dropped{0};
+	std::atomic<uint64_t> _failed{0};
+	std::atomic<uint64_t> _lost{0};
+	std::atomic<uint64_t> _reconnects{0};
+
+	// I/O thread only
+	std::thread _thread;
+	redisAsyncContext *_context = nullptr;
+	bool _want_read = false;
+	bool _want_write = false;
+	bool _ever_connected = false;
+	size_t _pending_replies = 0;
+	std::chrono::milliseconds _backoff{0};
+	std::chrono::steady_clock::time_point _next_attempt;
+	std::chrono::steady_clock::time_point _connect_deadline;
+	std::string _batch;
+
+	// Wakes the I/O thread up when a batch is queued
+	int _wakeup_fds[2] = {-1, -1};
+};
+
+#endif  // REDIS_ASYNC_CLIENT_H
@@ -7,15 +7,45 @@
  */
 
 #include "RedisClient.h"
+#include <cctype>
+#include <charconv>
+#include <cstdio>
 #include <iostream>
 #include <sstream>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <cerrno>
+#include <fcntl.h>
+#endif
 
 using namespace std;
 
+// Reads the bulk string "$<len>\r\n<data>\r\n" at p. Returns false if malformed.
+static bool parseBulkString(const char *&p, const char *end, const char *&data, size_t& len)
+{
+	if(p == end || *p != '$') return false;
+	const auto result = std::from_chars(p + 1, end, len);
+	if(result.ec != std::errc() || end - result.ptr < 2) return false;
+	data = result.ptr + 2;
+	if(static_cast<size_t>(end - data) < len + 2) return false;
+	p = data + len + 2;
+	return true;
+}
+
 void RedisClient::connect(const std::string& hostname, const int port,
 	                      const struct timeval& timeout) {
 	// Connect to new server
 	context_.reset(nullptr);
+	disableKeyspaceNotifications();
+	_pending_replies = 0;
+	_raw_reply_buffer.clear();
+	_raw_reply_begin = 0;
+	_subscribed = false;
 	redisContext *c= redisConnectWithTimeout(hostname.c_str(), port, timeout);
 	std::unique_ptr<redisContext, redisContextDeleter> context(c);
 
@@ -27,9 +57,13 @@ void RedisClient::connect(const std::string& hostname, const int port,
 
 	// Save context
 	context_ = std::move(context);
+	_hostname = hostname;
+	_port = port;
+	_timeout = timeout;
 }
 
 std::unique_ptr<redisReply, redisReplyDeleter> RedisClient::command(const char *format, ...) {
+	useHiredis();
 	va_list ap;
 	va_start(ap, format);
 	redisReply *reply = (redisReply *)redisvCommand(context_.get(), format, ap);
@@ -37,6 +71,24 @@ std::unique_ptr<redisReply, redisReplyDeleter> RedisClient::command(const char *
 	return std::unique_ptr<redisReply, redisReplyDeleter>(reply);
 }
 
+std::unique_ptr<redisReply, redisReplyDeleter> RedisClient::commandArgv(std::initializer_list<std::string_view> args) {
+	const size_t max_args = 16;
+	if (args.size() > max_args)
+		throw std::runtime_error("RedisClient: commandArgv() supports at most 16 arguments.");
+
+	useHiredis();
+	const char *argv[max_args];
+	size_t argvlen[max_args];
+	int argc = 0;
+	for (const auto& arg : args) {
+		argv[argc] = arg.data();
+		argvlen[argc] = arg.size();
+		++argc;
+	}
+	redisReply *reply = (redisReply *)redisCommandArgv(context_.get(), argc, argv, argvlen);
+	return std::unique_ptr<redisReply, redisReplyDeleter>(reply);
+}
+
 void RedisClient::ping() {
 	auto reply = command("PING");
 	std::cout << std::endl << "RedisClient: PING " << context_->tcp.host << ":" << context_->tcp.port << std::endl;
@@ -46,7 +98,7 @@ void RedisClient::ping() {
 
 std::string RedisClient::get(const std::string& key) {
 	// Call GET command
-	auto reply = command("GET %s", key.c_str());
+	auto reply = commandArgv({"GET", key});
 
 	// Check for errors
 	if (!reply || reply->type == REDIS_REPLY_ERROR || reply->type == REDIS_REPLY_NIL)
@@ -55,12 +107,12 @@ std::string RedisClient::get(const std::string& key) {
 		throw std::runtime_error("RedisClient: GET '" + key + "' returned non-string value.");
 
 	// Return value
-	return reply->str;
+	return std::string(reply->str, reply->len);
 }
 
 void RedisClient::set(const std::string& key, const std::string& value) {
 	// Call SET command
-	auto reply = command("SET %s %s", key.c_str(), value.c_str());
+	auto reply = commandArgv({"SET", key, value});
 
 	// Check for errors
 	if (!reply || reply->type == REDIS_REPLY_ERROR)
@@ -69,7 +121,7 @@ void RedisClient::set(const std::string& key, const std::string& value) {
 
 void RedisClient::del(const std::string& key) {
 	// Call DEL command
-	auto reply = command("DEL %s", key.c_str());
+	auto reply = commandArgv({"DEL", key});
 
 	// Check for errors
 	if (!reply || reply->type == REDIS_REPLY_ERROR)
@@ -78,7 +130,7 @@ void RedisClient::del(const std::string& key) {
 
 bool RedisClient::exists(const std::string& key) {
 	// Call GET command
-	auto reply = command("EXISTS %s", key.c_str());
+	auto reply = commandArgv({"EXISTS", key});
 
 	// Check for errors
 	if (!reply || reply->type == REDIS_REPLY_ERROR || reply->type == REDIS_REPLY_NIL)
@@ -96,54 +148,193 @@ bool RedisClient::exists(const std::string& key) {
 	return return_value;
 }
 
+// Size of a command on the wire, for the traffic statistics of hiredis pipelines
+static size_t commandWireSize(const int argc, const size_t *argvlen)
+{
+	char buf[24];
+	size_t size = 1 + (std::to_chars(buf, buf + sizeof(buf), argc).ptr - buf) + 2;
+	for (int i = 0; i < argc; i++)
+		size += 1 + (std::to_chars(buf, buf + sizeof(buf), argvlen[i]).ptr - buf) + 2 + argvlen[i] + 2;
+	return size;
+}
+
+// Size of a reply on the wire, for the traffic statistics of hiredis pipelines
+static size_t replyWireSize(const redisReply *reply)
+{
+	char buf[24];
+	switch (reply->type) {
+		case REDIS_REPLY_STRING:
+			return 1 + (std::to_chars(buf, buf + sizeof(buf), reply->len).ptr - buf) + 2 + reply->len + 2;
+		case REDIS_REPLY_INTEGER:
+			return 1 + (std::to_chars(buf, buf + sizeof(buf), reply->integer).ptr - buf) + 2;
+		case REDIS_REPLY_NIL:
+			return 5;
+		case REDIS_REPLY_ARRAY: {
+			size_t size = 1 + (std::to_chars(buf, buf + sizeof(buf), reply->elements).ptr - buf) + 2;
+			for (size_t i = 0; i < reply->elements; i++)
+				size += replyWireSize(reply->element[i]);
+			return size;
+		}
+		default:  // Status and error lines
+			return 1 + reply->len + 2;
+	}
+}
+
 std::vector<std::string> RedisClient::pipeget(const std::vector<std::string>& keys) {
+	if (keys.empty()) return {};
+	useHiredis();
+
 	// Prepare key list
+	const auto start = std::chrono::steady_clock::now();
+	uint64_t bytes_sent = 0;
 	for (const auto& key : keys) {
-		redisAppendCommand(context_.get(), "GET %s", key.c_str());
+		const char *argv[2] = {"GET", key.data()};
+		const size_t argvlen[2] = {3, key.size()};
+		redisAppendCommandArgv(context_.get(), 2, argv, argvlen);
+		bytes_sent += commandWireSize(2, argvlen);
 	}
+	const auto sent = std::chrono::steady_clock::now();
 
-	// Collect values
+	// Collect values. All replies are consumed before reporting an error to keep the connection in sync.
 	std::vector<std::string> values;
+	values.reserve(keys.size());
+	uint64_t bytes_received = 0;
+	size_t first_error = keys.size();
 	for (size_t i = 0; i < keys.size(); i++) {
 		redisReply *r;
 		if (redisGetReply(context_.get(), (void **)&r) == REDIS_ERR)
 			throw std::runtime_error("RedisClient: Pipeline GET command failed for key:" + keys[i] + ".");
-		
-		std::unique_ptr<redisReply, redisReplyDeleter> reply(r);
-		if (reply->type != REDIS_REPLY_STRING)
-			throw std::runtime_error("RedisClient: Pipeline GET command returned non-string value for key: " + keys[i] + ".");
 
-		values.push_back(reply->str);
+		std::unique_ptr<redisReply, redisReplyDeleter> reply(r);
+		bytes_received += replyWireSize(r);
+		if (reply->type != REDIS_REPLY_STRING) {
+			if (first_error == keys.size()) first_error = i;
+			values.emplace_back();
+			continue;
+		}
+		values.emplace_back(reply->str, reply->len);
 	}
+
+	_pipeget_timing.calls++;
+	_pipeget_timing.bytes_sent += bytes_sent;
+	_pipeget_timing.bytes_received += bytes_received;
+	_pipeget_timing.encode.record(sent - start);
+	_pipeget_timing.round_trip.record(std::chrono::steady_clock::now() - sent);
+
+	if (first_error < keys.size())
+		throw std::runtime_error("RedisClient: Pipeline GET command returned non-string value for key: " + keys[first_error] + ".");
 	return values;
 }
 
 void RedisClient::pipeset(const std::vector<std::pair<std::string, std::string>>& keyvals) {
+	if (keyvals.empty()) return;
+
+	// Deferred replies are tracked by the raw socket reader, so hiredis must not receive them
+	if (_deferred_replies) {
+		const auto start = std::chrono::steady_clock::now();
+		_batch_buffer.clear();
+		for (const auto& keyval : keyvals) {
+			_batch_buffer.append("*3\r\n$3\r\nSET\r\n");
+			appendBulkString(_batch_buffer, keyval.first.data(), keyval.first.size());
+			appendBulkString(_batch_buffer, keyval.second.data(), keyval.second.size());
+		}
+		sendPipelineSets(keyvals.size(), start);
+		return;
+	}
+	useHiredis();
+
 	// Prepare key list
+	const auto start = std::chrono::steady_clock::now();
+	uint64_t bytes_sent = 0;
 	for (const auto& keyval : keyvals) {
-		redisAppendCommand(context_.get(), "SET %s %s", keyval.first.c_str(), keyval.second.c_str());
+		const char *argv[3] = {"SET", keyval.first.data(), keyval.second.data()};
+		const size_t argvlen[3] = {3, keyval.first.size(), keyval.second.size()};
+		redisAppendCommandArgv(context_.get(), 3, argv, argvlen);
+		bytes_sent += commandWireSize(3, argvlen);
 	}
+	const auto sent = std::chrono::steady_clock::now();
 
+	// All replies are consumed before reporting an error to keep the connection in sync
+	uint64_t bytes_received = 0;
+	size_t first_error = keyvals.size();
+	std::string error;
 	for (size_t i = 0; i < keyvals.size(); i++) {
 		redisReply *r;
 		if (redisGetReply(context_.get(), (void **)&r) == REDIS_ERR)
 			throw std::runtime_error("RedisClient: Pipeline SET command failed for key: " + keyvals[i].first + ".");
 
 		std::unique_ptr<redisReply, redisReplyDeleter> reply(r);
-		if (reply->type == REDIS_REPLY_ERROR)
-			throw std::runtime_error("RedisClient: Pipeline SET command failed for key: " + keyvals[i].first + ".");
+		bytes_received += replyWireSize(r);
+		if (reply->type == REDIS_REPLY_ERROR && first_error == keyvals.size()) {
+			first_error = i;
+			error.assign(reply->str, reply->len);
+		}
+	}
+
+	_pipeset_timing.calls++;
+	_pipeset_timing.bytes_sent += bytes_sent;
+	_pipeset_timing.bytes_received += bytes_received;
+	_pipeset_timing.encode.record(sent - start);
+	_pipeset_timing.round_trip.record(std::chrono::steady_clock::now() - sent);
+
+	if (first_error < keyvals.size())
+		throw std::runtime_error("RedisClient: Pipeline SET command failed for key: " + keyvals[first_error].first + ": " + error);
+}
+
+void RedisClient::pipesetBinary(const std::pair<std::string_view, std::string_view> *keyvals, const size_t count) {
+	if (count == 0) return;
+
+	// Serialize all SET commands into the reused batch buffer
+	const auto start = std::chrono::steady_clock::now();
+	_batch_buffer.clear();
+	for (size_t i = 0; i < count; i++) {
+		_batch_buffer.append("*3\r\n$3\r\nSET\r\n");
+		appendBulkString(_batch_buffer, keyvals[i].first.data(), keyvals[i].first.size());
+		appendBulkString(_batch_buffer, keyvals[i].second.data(), keyvals[i].second.size());
+	}
+
+	const size_t first_error = sendPipelineSets(count, start);
+	if (first_error < count)
+		throw std::runtime_error("RedisClient: Pipeline SET command failed for key: " + std::string(keyvals[first_error].first) + ": " + _raw_reply_error);
+}
+
+size_t RedisClient::sendPipelineSets(const size_t count, const std::chrono::steady_clock::time_point& encode_start) {
+	const auto sent = std::chrono::steady_clock::now();
+	if(_deferred_replies)
+	{
+		// Errors are reported when the replies are read, there is no round trip to time
+		writeDeferred(_batch_buffer.data(), _batch_buffer.size(), count);
+		_pipeset_timing.calls++;
+		_pipeset_timing.bytes_sent += _batch_buffer.size();
+		_pipeset_timing.encode.record(sent - encode_start);
+		return count;
 	}
+	const uint64_t parsed = _raw_bytes_parsed;
+	writeRaw(_batch_buffer.data(), _batch_buffer.size());
+
+	// All replies are consumed before reporting an error to keep the connection in sync
+	const size_t first_error = readRawReplies(count);
+
+	_pipeset_timing.calls++;
+	_pipeset_timing.bytes_sent += _batch_buffer.size();
+	_pipeset_timing.bytes_received += _raw_bytes_parsed - parsed;
+	_pipeset_timing.encode.record(sent - encode_start);
+	_pipeset_timing.round_trip.record(std::chrono::steady_clock::now() - sent);
+	return first_error;
 }
 
 std::vector<std::string> RedisClient::mget(const std::vector<std::string>& keys) {
 	// Prepare key list
 	std::vector<const char *> argv = {"MGET"};
+	std::vector<size_t> argvlen = {4};
 	for (const auto& key : keys) {
-		argv.push_back(key.c_str());
+		argv.push_back(key.data());
+		argvlen.push_back(key.size());
 	}
 
-	// Call MGET command with variable argument formatting
-	redisReply *r = (redisReply *)redisCommandArgv(context_.get(), argv.size(), &argv[0], nullptr);
+	// Call MGET command with binary-safe arguments
+	useHiredis();
+	redisReply *r = (redisReply *)redisCommandArgv(context_.get(), argv.size(), &argv[0], &argvlen[0]);
 	std::unique_ptr<redisReply, redisReplyDeleter> reply(r);
 
 	// Check for errors
@@ -156,7 +347,7 @@ std::vector<std::string> RedisClient::mget(const std::vector<std::string>& keys)
 		if (reply->element[i]->type != REDIS_REPLY_STRING)
 			throw std::runtime_error("RedisClient: MGET command returned non-string values.");
 
-		values.push_back(reply->element[i]->str);
+		values.emplace_back(reply->element[i]->str, reply->element[i]->len);
 	}
 	return values;
 }
@@ -164,13 +355,19 @@ std::vector<std::string> RedisClient::mget(const std::vector<std::string>& keys)
 void RedisClient::mset(const std::vector<std::pair<std::string, std::string>>& keyvals) {
 	// Prepare key-value list
 	std::vector<const char *> argv = {"MSET"};
+	std::vector<size_t> argvlen = {4};
+	argv.reserve(2 * keyvals.size() + 1);
+	argvlen.reserve(2 * keyvals.size() + 1);
 	for (const auto& keyval : keyvals) {
-		argv.push_back(keyval.first.c_str());
-		argv.push_back(keyval.second.c_str());
+		argv.push_back(keyval.first.data());
+		argvlen.push_back(keyval.first.size());
+		argv.push_back(keyval.second.data());
+		argvlen.push_back(keyval.second.size());
 	}
 
-	// Call MSET command with variable argument formatting
-	redisReply *r = (redisReply *)redisCommandArgv(context_.get(), argv.size(), &argv[0], nullptr);
+	// Call MSET command with binary-safe arguments
+	useHiredis();
+	redisReply *r = (redisReply *)redisCommandArgv(context_.get(), argv.size(), &argv[0], &argvlen[0]);
 	std::unique_ptr<redisReply, redisReplyDeleter> reply(r);
 
 	// Check for errors
@@ -178,6 +375,383 @@ void RedisClient::mset(const std::vector<std::pair<std::string, std::string>>& k
 		throw std::runtime_error("RedisClient: MSET command failed.");
 }
 
+/**
+ * Stream commands
+ */
+static void parseStreamEntries(const redisReply *reply, std::vector<RedisClient::StreamEntry>& entries, const std::string& command) {
+	// Array of [id, [field1, val1, ...]]
+	if (reply->type != REDIS_REPLY_ARRAY)
+		throw std::runtime_error("RedisClient: " + command + " returned a non-array reply.");
+
+	entries.reserve(entries.size() + reply->elements);
+	for (size_t i = 0; i < reply->elements; i++) {
+		const redisReply *entry = reply->element[i];
+		if (entry->type != REDIS_REPLY_ARRAY || entry->elements != 2 ||
+		    entry->element[0]->type != REDIS_REPLY_STRING || entry->element[1]->type != REDIS_REPLY_ARRAY)
+			throw std::runtime_error("RedisClient: " + command + " returned a malformed stream entry.");
+
+		const redisReply *fields = entry->element[1];
+		entries.emplace_back();
+		entries.back().id.assign(entry->element[0]->str, entry->element[0]->len);
+		entries.back().fields.reserve(fields->elements / 2);
+		for (size_t j = 0; j + 1 < fields->elements; j += 2) {
+			entries.back().fields.emplace_back(std::string(fields->element[j]->str, fields->element[j]->len),
+			                                   std::string(fields->element[j + 1]->str, fields->element[j + 1]->len));
+		}
+	}
+}
+
+std::string RedisClient::xadd(const std::string& key, const std::vector<std::pair<std::string, std::string>>& fields,
+                              const size_t max_length) {
+	const std::string max_length_str = std::to_string(max_length);
+
+	// Prepare binary safe argument list
+	std::vector<const char *> argv = {"XADD", key.c_str()};
+	std::vector<size_t> argvlen = {4, key.size()};
+	if (max_length > 0) {
+		argv.insert(argv.end(), {"MAXLEN", "~", max_length_str.c_str()});
+		argvlen.insert(argvlen.end(), {6, 1, max_length_str.size()});
+	}
+	argv.push_back("*");
+	argvlen.push_back(1);
+	for (const auto& field : fields) {
+		argv.push_back(field.first.data());
+		argvlen.push_back(field.first.size());
+		argv.push_back(field.second.data());
+		argvlen.push_back(field.second.size());
+	}
+
+	useHiredis();
+	redisReply *r = (redisReply *)redisCommandArgv(context_.get(), argv.size(), &argv[0], &argvlen[0]);
+	std::unique_ptr<redisReply, redisReplyDeleter> reply(r);
+
+	// Check for errors
+	if (!reply || reply->type != REDIS_REPLY_STRING)
+		throw std::runtime_error("RedisClient: XADD '" + key + "' failed.");
+	return std::string(reply->str, reply->len);
+}
+
+std::vector<RedisClient::StreamEntry> RedisClient::xrange(const std::string& key, const std::string& start,
+                                                          const std::string& end, const size_t count) {
+	// Binary safe arguments, so keys and ids are never split at spaces
+	std::unique_ptr<redisReply, redisReplyDeleter> reply;
+	if (count > 0)
+		reply = commandArgv({"XRANGE", key, start, end, "COUNT", std::to_string(count)});
+	else
+		reply = commandArgv({"XRANGE", key, start, end});
+
+	// Check for errors
+	if (!reply || reply->type == REDIS_REPLY_ERROR)
+		throw std::runtime_error("RedisClient: XRANGE '" + key + "' failed.");
+
+	std::vector<StreamEntry> entries;
+	parseStreamEntries(reply.get(), entries, "XRANGE '" + key + "'");
+	return entries;
+}
+
+std::vector<RedisClient::StreamEntry> RedisClient::xread(const std::string& key, const std::string& last_id,
+                                                         const size_t count, const int block_ms) {
+	const std::string count_str = std::to_string(count);
+	const std::string block_str = std::to_string(block_ms);
+
+	// Prepare binary safe argument list
+	std::vector<const char *> argv = {"XREAD"};
+	std::vector<size_t> argvlen = {5};
+	if (count > 0) {
+		argv.insert(argv.end(), {"COUNT", count_str.c_str()});
+		argvlen.insert(argvlen.end(), {5, count_str.size()});
+	}
+	if (block_ms >= 0) {
+		argv.insert(argv.end(), {"BLOCK", block_str.c_str()});
+		argvlen.insert(argvlen.end(), {5, block_str.size()});
+	}
+	argv.insert(argv.end(), {"STREAMS", key.data(), last_id.data()});
+	argvlen.insert(argvlen.end(), {7, key.size(), last_id.size()});
+
+	useHiredis();
+	redisReply *r = (redisReply *)redisCommandArgv(context_.get(), argv.size(), &argv[0], &argvlen[0]);
+	std::unique_ptr<redisReply, redisReplyDeleter> reply(r);
+
+	// Check for errors
+	if (!reply || reply->type == REDIS_REPLY_ERROR)
+		throw std::runtime_error("RedisClient: XREAD '" + key + "' failed.");
+
+	// Nil if nothing arrived before the timeout, else [[key, entries]]
+	std::vector<StreamEntry> entries;
+	if (reply->type == REDIS_REPLY_NIL)
+		return entries;
+	if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 1 ||
+	    reply->element[0]->type != REDIS_REPLY_ARRAY || reply->element[0]->elements != 2)
+		throw std::runtime_error("RedisClient: XREAD '" + key + "' returned a malformed reply.");
+	parseStreamEntries(reply->element[0]->element[1], entries, "XREAD '" + key + "'");
+	return entries;
+}
+
+std::string RedisClient::nextStreamId(const std::string& id) {
+	// Ids are "<ms>-<seq>"; a bare "<ms>" means "<ms>-0"
+	unsigned long long ms = 0, seq = 0;
+	const char *begin = id.data();
+	const char *end = id.data() + id.size();
+	const char *dash = std::find(begin, end, '-');
+	if (std::from_chars(begin, dash, ms).ptr != dash ||
+	    (dash != end && std::from_chars(dash + 1, end, seq).ptr != end))
+		throw std::runtime_error("RedisClient: invalid stream id '" + id + "'.");
+
+	if (dash != end && seq == ~0ULL)
+		return std::to_string(ms + 1) + "-0";
+	return std::to_string(ms) + "-" + std::to_string(dash != end ? seq + 1 : 1);
+}
+
+/**
+ * Pub/Sub commands
+ */
+int RedisClient::publish(const std::string& channel, const std::string& message) {
+	// Call PUBLISH command
+	auto reply = commandArgv({"PUBLISH", channel, message});
+
+	// Check for errors
+	if (!reply || reply->type != REDIS_REPLY_INTEGER)
+		throw std::runtime_error("RedisClient: PUBLISH '" + channel + "' failed.");
+	return static_cast<int>(reply->integer);
+}
+
+void RedisClient::subscribe(const std::string& channel) {
+	// Call SUBSCRIBE command, the reply is ["subscribe", channel, count]
+	auto reply = commandArgv({"SUBSCRIBE", channel});
+
+	// Check for errors
+	if (!reply || reply->type != REDIS_REPLY_ARRAY)
+		throw std::runtime_error("RedisClient: SUBSCRIBE '" + channel + "' failed.");
+	_subscribed = true;
+}
+
+void RedisClient::receive(std::string& channel, std::string& message) {
+	useHiredis();
+	while (true) {
+		redisReply *r;
+		if (redisGetReply(context_.get(), (void **)&r) == REDIS_ERR)
+			throw std::runtime_error("RedisClient: Receiving a message failed: " + std::string(context_->errstr));
+		std::unique_ptr<redisReply, redisReplyDeleter> reply(r);
+
+		// Skip confirmations of further SUBSCRIBE commands, messages are ["message", channel, payload]
+		if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 3 ||
+		    reply->element[0]->type != REDIS_REPLY_STRING || std::strcmp(reply->element[0]->str, "message") != 0)
+			continue;
+
+		channel.assign(reply->element[1]->str, reply->element[1]->len);
+		message.assign(reply->element[2]->str, reply->element[2]->len);
+		return;
+	}
+}
+
+
+/**
+ * Write callback entries for plain values
+ */
+template<typename T>
+struct RedisClient::NumberWriteEntry : public RedisClient::WriteEntry
+{
+	const T& object;
+	T last = T();  // value of the last write, for the deadband
+	bool has_last = false;
+
+	NumberWriteEntry(const std::string& key, const T& object)
+		: WriteEntry(key), object(object) {}
+
+	double changeSinceWritten() const override
+	{
+		return has_last ? std::abs(static_cast<double>(object) - static_cast<double>(last)) : std::numeric_limits<double>::infinity();
+	}
+
+	void rememberValue() override
+	{
+		last = object;
+		has_last = true;
+	}
+
+	void forgetValue() override
+	{
+		has_last = false;
+	}
+
+	bool appendValue(std::string& out, std::string& scratch) const override
+	{
+		scratch.clear();
+		appendNumber(scratch, object);
+		appendBulkString(out, scratch.data(), scratch.size());
+		return true;
+	}
+};
+
+struct RedisClient::StringWriteEntry : public RedisClient::WriteEntry
+{
+	const std::string& object;
+
+	StringWriteEntry(const std::string& key, const std::string& object)
+		: WriteEntry(key), object(object) {}
+
+	bool appendValue(std::string& out, std::string& /*scratch*/) const override
+	{
+		// Empty strings are skipped
+		if(object.empty()) return false;
+		appendBulkString(out, object.data(), object.size());
+		return true;
+	}
+};
+
+RedisClient::WriteEntry::WriteEntry(const std::string& key)
+	: key(key)
+{
+	setExpiry(0);
+}
+
+void RedisClient::WriteEntry::setExpiry(const int milliseconds)
+{
+	command_prefix = (milliseconds > 0) ? "*5\r\n$3\r\nSET\r\n" : "*3\r\n$3\r\nSET\r\n";
+	appendBulkString(command_prefix, key.data(), key.size());
+
+	command_suffix.clear();
+	if(milliseconds > 0)
+	{
+		const std::string ms = std::to_string(milliseconds);
+		command_suffix = "$2\r\nPX\r\n";
+		appendBulkString(command_suffix, ms.data(), ms.size());
+	}
+}
+
+RedisClient::WritePlan& RedisClient::findWritePlan(const int callback_number, const char *caller)
+{
+	auto it = _write_plans.find(callback_number);
+	if(it == _write_plans.end())
+	{
+		throw runtime_error(std::string("no write callback with this index in ") + caller + "\n");
+	}
+	return it->second;
+}
+
+void RedisClient::addToWritePlan(const int callback_number, const char *caller, std::unique_ptr<WriteEntry> entry)
+{
+	WritePlan& plan = findWritePlan(callback_number, caller);
+	if(plan.expiry_ms > 0)
+	{
+		entry->setExpiry(plan.expiry_ms);
+	}
+	switch(entry->valueKind())
+	{
+		case WriteEntry::POSITION_VALUE:
+			entry->deadband = plan.position_deadband;
+			entry->precision = plan.position_precision;
+			break;
+		case WriteEntry::ORIENTATION_VALUE:
+			entry->deadband = plan.orientation_deadband;
+			entry->precision = plan.orientation_precision;
+			break;
+		default: break;
+	}
+	plan.entries.push_back(std::move(entry));
+	plan.sent.reserve(plan.entries.size());
+}
+
+void RedisClient::appendDecimal(std::string& out, const size_t value)
+{
+	char buf[24];
+	auto result = std::to_chars(buf, buf + sizeof(buf), value);
+	out.append(buf, result.ptr - buf);
+}
+
+// Shortest text that parses back to the same value, or fixed decimals. Locale-independent.
+template<typename T>
+static void appendFloatingPoint(std::string& out, const T value, const int precision)
+{
+	char buf[64];
+	std::to_chars_result result{buf, std::errc::value_too_large};
+	if(precision >= 0)
+	{
+		result = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed, precision);
+	}
+	// Values too large for fixed notation in the buffer fall back to the shortest text
+	if(result.ec != std::errc())
+	{
+		result = std::to_chars(buf, buf + sizeof(buf), value);
+	}
+	out.append(buf, result.ptr - buf);
+}
+
+void RedisClient::appendNumber(std::string& out, const double value, const int precision)
+{
+	appendFloatingPoint(out, value, precision);
+}
+
+void RedisClient::appendNumber(std::string& out, const float value, const int precision)
+{
+	appendFloatingPoint(out, value, precision);
+}
+
+// Integer matrices go through the same encoders as floating point ones; instantiating them here
+// keeps the appendNumber() overloads unambiguous for integer scalars
+template std::string RedisClient::encodeEigenMatrixJSON(const Eigen::MatrixBase<Eigen::Vector3i>&, const int);
+template std::string RedisClient::encodeEigenMatrixString(const Eigen::MatrixBase<Eigen::Vector3i>&, const int);
+template std::string RedisClient::encodeEigenMatrixJSON(const Eigen::MatrixBase<Eigen::Matrix<int64_t, 2, 2>>&, const int);
+template std::string RedisClient::encodeEigenMatrixString(const Eigen::MatrixBase<Eigen::Matrix<int64_t, 2, 2>>&, const int);
+
+void RedisClient::appendBulkString(std::string& out, const char *data, const size_t len)
+{
+	out.append("$");
+	appendDecimal(out, len);
+	out.append("\r\n");
+	out.append(data, len);
+	out.append("\r\n");
+}
+
+
+
+// Parses a whole number value, ignoring surrounding whitespace like stod/stoi
+template<typename T>
+static bool parseNumber(const char *data, const size_t len, T& value)
+{
+	const char *p = data;
+	const char *end = data + len;
+	while(p != end && isspace(static_cast<unsigned char>(*p))) ++p;
+	const auto result = std::from_chars(p, end, value);
+	if(result.ec != std::errc()) return false;
+	p = result.ptr;
+	while(p != end && isspace(static_cast<unsigned char>(*p))) ++p;
+	return p == end;
+}
+
+/**
+ * Read callback entries for plain values
+ */
+template<typename T>
+struct RedisClient::NumberReadEntry : public RedisClient::ReadEntry
+{
+	T& object;
+
+	explicit NumberReadEntry(T& object) : object(object) {}
+
+	void decode(const char *data, const size_t len) override
+	{
+		if(!parseNumber(data, len, object))
+		{
+			throw std::runtime_error(std::string("RedisClient: Failed to decode ") + (std::is_integral<T>::value ? "int" : "double") +
+			                         " from: " + std::string(data, len) + ".");
+		}
+	}
+};
+
+struct RedisClient::StringReadEntry : public RedisClient::ReadEntry
+{
+	std::string& object;
+
+	explicit StringReadEntry(std::string& object) : object(object) {}
+
+	void decode(const char *data, const size_t len) override
+	{
+		object.assign(data, len);
+	}
+};
+
+
 
 void RedisClient::createReadCallback(const int callback_number)
 {
@@ -199,33 +773,22 @@ void RedisClient::createReadCallback(const int callback_number)
 
 	_read_callback_indexes.push_back(callback_number);
 	_keys_to_read.push_back(vector<string>());
-	_objects_to_read.push_back(vector<void *>());
-	_objects_to_read_types.push_back(vector<RedisSupportedTypes>());
+	_objects_to_read.push_back(vector<std::unique_ptr<ReadEntry>>());
+	_read_commands.push_back(string());
+	_read_command_offsets.push_back(vector<size_t>());
+	_read_dirty.push_back(vector<char>());
+	_read_timing.push_back(RedisTimingStats());
 }
 
 void RedisClient::createWriteCallback(const int callback_number)
 {
-	int n = _write_callback_indexes.size();
-	bool found = false;
-	for(int callback_index=0 ; callback_index < n ; callback_index++)
-	{
-		if(_write_callback_indexes[callback_index] == callback_number)
-		{
-			found = true;
-			break;
-		}
-	}
-	if(found)
+	if(_write_plans.count(callback_number) > 0)
 	{
 		cout << "write callback already exists with this index. Not creating a new one" << endl;
 		return;
 	}
 
-	_write_callback_indexes.push_back(callback_number);
-	_keys_to_write.push_back(vector<string>());
-	_objects_to_write.push_back(vector<void *>());
-	_objects_to_write_types.push_back(vector<RedisSupportedTypes>());
-	_objects_to_write_sizes.push_back(vector<pair<int, int>>());
+	_write_plans[callback_number];
 }
 
 
@@ -250,9 +813,7 @@ void RedisClient::addDoubleToReadCallback(const int callback_number, const std::
 	}
 
 
-	_keys_to_read[callback_index].push_back(key);
-	_objects_to_read[callback_index].push_back(&object);
-	_objects_to_read_types[callback_index].push_back(DOUBLE_NUMBER);
+	addReadKey(callback_index, key, std::unique_ptr<ReadEntry>(new NumberReadEntry<double>(object)));
 }
 
 void RedisClient::addStringToReadCallback(const int callback_number, const std::string& key, std::string &object)
@@ -274,9 +835,7 @@ void RedisClient::addStringToReadCallback(const int callback_number, const std::
 		throw runtime_error("no read callback with this index in RedisClient::addStringToReadCallback(const int callback_number, const std::string& key, std::string &object)\n");
 	}
 
-	_keys_to_read[callback_index].push_back(key);
-	_objects_to_read[callback_index].push_back(&object);
-	_objects_to_read_types[callback_index].push_back(STRING);
+	addReadKey(callback_index, key, std::unique_ptr<ReadEntry>(new StringReadEntry(object)));
 }
 
 void RedisClient::addIntToReadCallback(const int callback_number, const std::string& key, int &object)
@@ -298,239 +857,1329 @@ void RedisClient::addIntToReadCallback(const int callback_number, const std::str
 		throw runtime_error("no read callback with this index in RedisClient::addIntToReadCallback(const int callback_number, const std::string& key, int &object)\n");
 	}
 
-	_keys_to_read[callback_index].push_back(key);
-	_objects_to_read[callback_index].push_back(&object);
-	_objects_to_read_types[callback_index].push_back(INT_NUMBER);
+	addReadKey(callback_index, key, std::unique_ptr<ReadEntry>(new NumberReadEntry<int>(object)));
 }
 
 
 
 void RedisClient::addDoubleToWriteCallback(const int callback_number, const std::string& key, double &object)
 {
-	int n = _write_callback_indexes.size();
-	int callback_index = 0;
-	bool found = false;
-	while(callback_index < n)
-	{
-		if(_write_callback_indexes[callback_index] == callback_number)
-		{
-			found = true;
-			break;
-		}
-		callback_index++;
-	}
-	if(!found)
-	{
-		throw runtime_error("no write callback with this index in RedisClient::addDoubleToWriteCallback(const int callback_number, const std::string& key, double &object)\n");
-	}
-
-	_keys_to_write[callback_index].push_back(key);
-	_objects_to_write[callback_index].push_back(&object);
-	_objects_to_write_types[callback_index].push_back(DOUBLE_NUMBER);
-	_objects_to_write_sizes[callback_index].push_back(std::make_pair(0,0));
+	addToWritePlan(callback_number, "RedisClient::addDoubleToWriteCallback(const int callback_number, const std::string& key, double &object)",
+	               std::unique_ptr<WriteEntry>(new NumberWriteEntry<double>(key, object)));
 }
 
 void RedisClient::addStringToWriteCallback(const int callback_number, const std::string& key, std::string &object)
 {
-	int n = _write_callback_indexes.size();
-	int callback_index = 0;
-	bool found = false;
-	while(callback_index < n)
-	{
-		if(_write_callback_indexes[callback_index] == callback_number)
-		{
-			found = true;
-			break;
-		}
-		callback_index++;
-	}
-	if(!found)
-	{
-		throw runtime_error("no write callback with this index in RedisClient::addStringToWriteCallback(const int callback_number, const std::string& key, std::string &object)\n");
-	}
-
-	_keys_to_write[callback_index].push_back(key);
-	_objects_to_write[callback_index].push_back(&object);
-	_objects_to_write_types[callback_index].push_back(STRING);
-	_objects_to_write_sizes[callback_index].push_back(std::make_pair(0,0));
+	addToWritePlan(callback_number, "RedisClient::addStringToWriteCallback(const int callback_number, const std::string& key, std::string &object)",
+	               std::unique_ptr<WriteEntry>(new StringWriteEntry(key, object)));
 }
 
 void RedisClient::addIntToWriteCallback(const int callback_number, const std::string& key, int &object)
 {
-	int n = _write_callback_indexes.size();
-	int callback_index = 0;
-	bool found = false;
-	while(callback_index < n)
-	{
-		if(_write_callback_indexes[callback_index] == callback_number)
-		{
-			found = true;
-			break;
-		}
-		callback_index++;
-	}
-	if(!found)
-	{
-		throw runtime_error("no write callback with this index in RedisClient::addIntToWriteCallback(const int callback_number, const std::string& key, int &object)\n");
-	}
-
-	_keys_to_write[callback_index].push_back(key);
-	_objects_to_write[callback_index].push_back(&object);
-	_objects_to_write_types[callback_index].push_back(INT_NUMBER);
-	_objects_to_write_sizes[callback_index].push_back(std::make_pair(0,0));
+	addToWritePlan(callback_number, "RedisClient::addIntToWriteCallback(const int callback_number, const std::string& key, int &object)",
+	               std::unique_ptr<WriteEntry>(new NumberWriteEntry<int>(key, object)));
 }
 
 
 
-void RedisClient::executeReadCallback(const int callback_number)
+size_t RedisClient::findReadCallback(const int callback_number, const char *caller) const
 {
-	int n = _read_callback_indexes.size();
-	int callback_index = 0;
-	bool found = false;
-	while(callback_index < n)
+	for(size_t callback_index=0 ; callback_index < _read_callback_indexes.size() ; callback_index++)
 	{
 		if(_read_callback_indexes[callback_index] == callback_number)
 		{
-			found = true;
-			break;
+			return callback_index;
 		}
-		callback_index++;
 	}
-	if(!found)
+	throw runtime_error(std::string("no read callback with this index in ") + caller + "\n");
+}
+
+void RedisClient::addReadKey(const size_t callback_index, const std::string& key, std::unique_ptr<ReadEntry> entry)
+{
+	_objects_to_read[callback_index].push_back(std::move(entry));
+	_notify_keys[key].emplace_back(callback_index, _keys_to_read[callback_index].size());
+	_read_dirty[callback_index].push_back(1);
+	_read_command_offsets[callback_index].push_back(_read_commands[callback_index].size());
+	_keys_to_read[callback_index].push_back(key);
+	_read_commands[callback_index].append("*2\r\n$3\r\nGET\r\n");
+	appendBulkString(_read_commands[callback_index], key.data(), key.size());
+}
+
+size_t RedisClient::executeReadCallback(const int callback_number)
+{
+	const size_t callback_index = findReadCallback(callback_number, "RedisClient::executeReadCallback(const int callback_number)");
+	const std::vector<std::string>& keys = _keys_to_read[callback_index];
+	if(keys.empty())
 	{
-		throw runtime_error("no read callback with this index in RedisClient::executeReadCallback(const int callback_number)\n");
+		return 0;
 	}
 
-	std::vector<std::string> return_values = pipeget(_keys_to_read[callback_index]);
-
-	for(int i=0 ; i<return_values.size() ; i++)
+	// With notifications, only GET the keys that changed
+	const std::string *commands = &_read_commands[callback_index];
+	const std::vector<size_t> *indexes = nullptr;
+	size_t num_read = keys.size();
+	if(keyspaceNotificationsActive())
 	{
-		switch(_objects_to_read_types[callback_index].at(i))
+		std::vector<char>& dirty = _read_dirty[callback_index];
+		const std::vector<size_t>& offsets = _read_command_offsets[callback_index];
+		_dirty_indexes.clear();
+		_dirty_commands.clear();
+		for(size_t i = 0; i < keys.size(); i++)
 		{
-			case DOUBLE_NUMBER :
-			{
-				double* tmp_pointer = (double*) _objects_to_read[callback_index].at(i);
-				*tmp_pointer = stod(return_values[i]);
-			}
-			break;
+			if(!dirty[i]) continue;
+			dirty[i] = 0;
+			_dirty_indexes.push_back(i);
+			const size_t end = (i + 1 < keys.size()) ? offsets[i + 1] : commands->size();
+			_dirty_commands.append(*commands, offsets[i], end - offsets[i]);
+		}
+		num_read = _dirty_indexes.size();
+		if(num_read == 0)
+		{
+			return 0;
+		}
+		if(num_read < keys.size())
+		{
+			commands = &_dirty_commands;
+			indexes = &_dirty_indexes;
+		}
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	const uint64_t parsed = _raw_bytes_parsed;
+	size_t first_error;
+	try
+	{
+		writeRaw(commands->data(), commands->size());
 
-			case INT_NUMBER :
+		// All replies are consumed before reporting an error to keep the connection in sync
+		first_error = decodeReadReplies(callback_index, indexes);
+	}
+	catch(const std::runtime_error&)
+	{
+		// The connection failed, so the keys may not have been read
+		markReadKeysDirty();
+		throw;
+	}
+
+	RedisTimingStats& timing = _read_timing[callback_index];
+	timing.calls++;
+	timing.bytes_sent += commands->size();
+	timing.bytes_received += _raw_bytes_parsed - parsed;
+	timing.round_trip.record(std::chrono::steady_clock::now() - start);
+
+	if(first_error < keys.size())
+	{
+		throw std::runtime_error("RedisClient: Pipeline GET command failed for key: " + keys[first_error] + ": " + _raw_reply_error);
+	}
+	return num_read;
+}
+
+size_t RedisClient::decodeReadReplies(const size_t callback_index, const std::vector<size_t> *indexes)
+{
+	const std::vector<std::string>& keys = _keys_to_read[callback_index];
+	const size_t count = indexes ? indexes->size() : keys.size();
+	size_t first_error = keys.size();
+	for(size_t n = 0; n < count; n++)
+	{
+		const size_t i = indexes ? (*indexes)[n] : n;
+		size_t reply_len;
+		const char *error = nullptr;
+		const char *p = nextRawReply(reply_len, error);
+		const char *data;
+		size_t len;
+		if(!parseBulkString(p, p + reply_len, data, len))
+		{
+			_read_dirty[callback_index][i] = 1;
+			if(first_error == keys.size())
 			{
-				int* tmp_pointer = (int*) _objects_to_read[callback_index].at(i);
-				*tmp_pointer = stoi(return_values[i]);				
+				first_error = i;
+				if(error != nullptr)
+				{
+					_raw_reply_error.assign(error + 1, static_cast<const char *>(memchr(error, '\r', p + reply_len - error)));
+				}
+				else
+				{
+					_raw_reply_error = "returned non-string value.";
+				}
 			}
-			break;
+			continue;
+		}
 
-			case STRING :
+		try
+		{
+			_objects_to_read[callback_index][i]->decode(data, len);
+		}
+		catch(const std::runtime_error& e)
+		{
+			_read_dirty[callback_index][i] = 1;
+			if(first_error == keys.size())
 			{
-				std::string* tmp_pointer = (std::string*) _objects_to_read[callback_index].at(i);
-				*tmp_pointer = return_values[i];
+				first_error = i;
+				_raw_reply_error = e.what();
+				_raw_reply_error.erase(0, _raw_reply_error.find("Failed"));
 			}
-			break;
+		}
+	}
+	return first_error;
+}
 
-			case EIGEN_OBJECT :
-			{
-				double* tmp_pointer = (double*) _objects_to_read[callback_index].at(i);
+void RedisClient::appendWritePlanCommands(WritePlan& plan, std::string& buffer, std::vector<WriteEntry *>& sent)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const size_t start_size = buffer.size();
+	const auto now = start;
+	for(const auto& entry : plan.entries)
+	{
+		// Skip values that stayed within their deadband, unless a refresh is due
+		if(entry->deadband > 0 && (plan.refresh.count() == 0 || now < entry->refresh_due) &&
+		   entry->changeSinceWritten() <= entry->deadband)
+		{
+			++plan.suppressed;
+			continue;
+		}
 
-				Eigen::MatrixXd tmp_return_matrix = RedisClient::decodeEigenMatrixJSON(return_values[i]);
+		const size_t mark = buffer.size();
+		buffer.append(entry->command_prefix);
+		if(entry->appendValue(buffer, plan.scratch))
+		{
+			buffer.append(entry->command_suffix);
+			sent.push_back(entry.get());
+			++plan.written;
+		}
+		else
+		{
+			buffer.resize(mark);
+		}
+	}
 
-				int nrows = tmp_return_matrix.rows();
-				int ncols = tmp_return_matrix.cols();
+	plan.timing.calls++;
+	plan.timing.bytes_sent += buffer.size() - start_size;
+	plan.timing.encode.record(std::chrono::steady_clock::now() - start);
+}
 
-				for(int k=0 ; k<nrows ; k++)
-				{
-					for(int l=0 ; l<ncols ; l++)
-					{
-						tmp_pointer[k + ncols*l] = tmp_return_matrix(k,l);
-					}
-				}
+void RedisClient::rememberSentValues(const std::vector<WriteEntry *>& sent)
+{
+	const auto now = std::chrono::steady_clock::now();
+	size_t i = 0;
+	for(const auto& batch_plan : _batch_plans)
+	{
+		for(const size_t end = i + batch_plan.second; i < end; ++i)
+		{
+			WriteEntry *entry = sent[i];
+			if(entry->deadband > 0)
+			{
+				entry->rememberValue();
+				entry->refresh_due = now + batch_plan.first->refresh;
 			}
-			break;
+		}
+	}
+}
 
-			default :
-			break;
+void RedisClient::forgetWrittenValues()
+{
+	for(auto& plan : _write_plans)
+	{
+		for(auto& entry : plan.second.entries)
+		{
+			entry->forgetValue();
+		}
+	}
+}
+
+size_t RedisClient::appendWritePlanKeyValues(WritePlan& plan, std::string& buffer)
+{
+	size_t num_pairs = 0;
+	for(const auto& entry : plan.entries)
+	{
+		const size_t mark = buffer.size();
+		appendBulkString(buffer, entry->key.data(), entry->key.size());
+		if(entry->appendValue(buffer, plan.scratch))
+		{
+			++num_pairs;
+		}
+		else
+		{
+			buffer.resize(mark);
+		}
+	}
+	return num_pairs;
+}
+
+void RedisClient::appendBatchCommands(const std::vector<int>& callback_numbers, std::string& out, const char *caller)
+{
+	_batch_sent.clear();
+	_batch_plans.clear();
+	for(const int callback_number : callback_numbers)
+	{
+		WritePlan& plan = findWritePlan(callback_number, caller);
+		const size_t num_sent = _batch_sent.size();
+		appendWritePlanCommands(plan, out, _batch_sent);
+		_batch_plans.emplace_back(&plan, _batch_sent.size() - num_sent);
+	}
+}
+
+void RedisClient::sendWriteCommands(const std::string& buffer, const std::vector<WriteEntry *>& sent, const size_t num_commands)
+{
+	if(sent.empty() && num_commands == 0)
+	{
+		return;
+	}
+	if(_deferred_replies)
+	{
+		// A failed SET makes readDeferredReplies() forget the remembered values
+		writeDeferred(buffer.data(), buffer.size(), sent.size() + num_commands);
+		rememberSentValues(sent);
+		return;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	writeRaw(buffer.data(), buffer.size());
+
+	// Replies are read plan by plan to time each plan's round trip. All replies
+	// are consumed before reporting an error to keep the connection in sync.
+	size_t first_error = sent.size();
+	size_t num_read = 0;
+	for(auto& batch_plan : _batch_plans)
+	{
+		if(batch_plan.second == 0)
+		{
+			continue;
+		}
+		const uint64_t parsed = _raw_bytes_parsed;
+		const size_t plan_error = readRawReplies(batch_plan.second);
+		if(plan_error < batch_plan.second && first_error == sent.size())
+		{
+			first_error = num_read + plan_error;
+			_first_reply_error.swap(_raw_reply_error);
 		}
+		num_read += batch_plan.second;
+
+		RedisTimingStats& timing = batch_plan.first->timing;
+		timing.bytes_received += _raw_bytes_parsed - parsed;
+		timing.round_trip.record(std::chrono::steady_clock::now() - start);
+	}
+	const size_t command_error = (num_commands > 0) ? readRawReplies(num_commands) : 0;
+	if(first_error < sent.size())
+	{
+		throw std::runtime_error("RedisClient: Pipeline SET command failed for key: " + sent[first_error]->key + ": " + _first_reply_error);
+	}
+	rememberSentValues(sent);
+	if(command_error < num_commands)
+	{
+		throw std::runtime_error("RedisClient: Pipeline command failed: " + _raw_reply_error);
 	}
 }
 
 void RedisClient::executeWriteCallback(const int callback_number)
 {
-	int n = _write_callback_indexes.size();
-	int callback_index = 0;
-	bool found = false;
-	while(callback_index < n)
+	WritePlan& plan = findWritePlan(callback_number, "RedisClient::executeWriteCallback(const int callback_number)");
+
+	// Serialize all SET commands into the reused plan buffer
+	plan.buffer.clear();
+	plan.sent.clear();
+	appendWritePlanCommands(plan, plan.buffer, plan.sent);
+	_batch_plans.clear();
+	_batch_plans.emplace_back(&plan, plan.sent.size());
+	sendWriteCommands(plan.buffer, plan.sent);
+	publishTimingStatsIfDue();
+}
+
+void RedisClient::executeWriteCallbacks(const std::vector<int>& callback_numbers)
+{
+	_batch_buffer.clear();
+	appendBatchCommands(callback_numbers, _batch_buffer, "RedisClient::executeWriteCallbacks(const std::vector<int>& callback_numbers)");
+	sendWriteCommands(_batch_buffer, _batch_sent);
+	publishTimingStatsIfDue();
+}
+
+void RedisClient::executeWriteCallbacks(const std::vector<int>& callback_numbers, const std::string& commands, const size_t num_commands)
+{
+	_batch_buffer.clear();
+	appendBatchCommands(callback_numbers, _batch_buffer, "RedisClient::executeWriteCallbacks(const std::vector<int>& callback_numbers, const std::string& commands, const size_t num_commands)");
+	_batch_buffer.append(commands);
+	sendWriteCommands(_batch_buffer, _batch_sent, num_commands);
+	publishTimingStatsIfDue();
+}
+
+void RedisClient::setWriteCallbackExpiry(const int callback_number, const int milliseconds)
+{
+	WritePlan& plan = findWritePlan(callback_number, "RedisClient::setWriteCallbackExpiry(const int callback_number, const int milliseconds)");
+	plan.expiry_ms = milliseconds;
+	for(auto& entry : plan.entries)
 	{
-		if(_write_callback_indexes[callback_index] == callback_number)
+		entry->setExpiry(milliseconds);
+	}
+}
+
+void RedisClient::setWriteCallbackDeadband(const int callback_number, const double position_threshold,
+                                           const double orientation_threshold, const int refresh_ms)
+{
+	WritePlan& plan = findWritePlan(callback_number, "RedisClient::setWriteCallbackDeadband(const int callback_number, const double position_threshold, const double orientation_threshold, const int refresh_ms)");
+	plan.position_deadband = position_threshold;
+	plan.orientation_deadband = orientation_threshold;
+	plan.refresh = std::chrono::milliseconds(std::max(refresh_ms, 0));
+	for(auto& entry : plan.entries)
+	{
+		switch(entry->valueKind())
 		{
-			found = true;
-			break;
+			case WriteEntry::POSITION_VALUE: entry->deadband = position_threshold; break;
+			case WriteEntry::ORIENTATION_VALUE: entry->deadband = orientation_threshold; break;
+			default: break;
 		}
-		callback_index++;
 	}
-	if(!found)
+	plan.deadband = plan.deadband || position_threshold > 0 || orientation_threshold > 0;
+}
+
+void RedisClient::setWriteCallbackPrecision(const int callback_number, const int position_digits, const int orientation_digits)
+{
+	WritePlan& plan = findWritePlan(callback_number, "RedisClient::setWriteCallbackPrecision(const int callback_number, const int position_digits, const int orientation_digits)");
+	plan.position_precision = position_digits;
+	plan.orientation_precision = orientation_digits;
+	for(auto& entry : plan.entries)
+	{
+		switch(entry->valueKind())
+		{
+			case WriteEntry::POSITION_VALUE: entry->precision = position_digits; break;
+			case WriteEntry::ORIENTATION_VALUE: entry->precision = orientation_digits; break;
+			default: break;
+		}
+	}
+}
+
+void RedisClient::setWriteKeyDeadband(const int callback_number, const std::string& key, const double threshold)
+{
+	WritePlan& plan = findWritePlan(callback_number, "RedisClient::setWriteKeyDeadband(const int callback_number, const std::string& key, const double threshold)");
+	for(auto& entry : plan.entries)
+	{
+		if(entry->key == key)
+		{
+			entry->deadband = threshold;
+			plan.deadband = plan.deadband || threshold > 0;
+			return;
+		}
+	}
+	throw runtime_error("RedisClient: write callback " + std::to_string(callback_number) + " has no key '" + key + "'.");
+}
+
+RedisClient::WriteCallbackStats RedisClient::writeCallbackStats(const int callback_number)
+{
+	const WritePlan& plan = findWritePlan(callback_number, "RedisClient::writeCallbackStats(const int callback_number)");
+	WriteCallbackStats stats;
+	stats.written = plan.written;
+	stats.suppressed = plan.suppressed;
+	return stats;
+}
+
+void RedisClient::removeWriteCallback(const int callback_number)
+{
+	findWritePlan(callback_number, "RedisClient::removeWriteCallback(const int callback_number)");
+	_write_plans.erase(callback_number);
+}
+
+const RedisTimingStats& RedisClient::writeCallbackTiming(const int callback_number)
+{
+	return findWritePlan(callback_number, "RedisClient::writeCallbackTiming(const int callback_number)").timing;
+}
+
+const RedisTimingStats& RedisClient::readCallbackTiming(const int callback_number)
+{
+	return _read_timing[findReadCallback(callback_number, "RedisClient::readCallbackTiming(const int callback_number)")];
+}
+
+void RedisClient::resetTiming()
+{
+	for(auto& plan : _write_plans)
+	{
+		plan.second.timing = RedisTimingStats();
+	}
+	for(auto& timing : _read_timing)
+	{
+		timing = RedisTimingStats();
+	}
+	_pipeset_timing = RedisTimingStats();
+	_pipeget_timing = RedisTimingStats();
+}
+
+void RedisClient::appendTimingStatsJSON(std::string& out, const RedisTimingStats& stats)
+{
+	auto appendHistogram = [&out](const char *name, const LatencyHistogram& histogram)
+	{
+		out.append(",\"").append(name).append("\":{\"mean\":");
+		appendNumber(out, histogram.mean() / 1000.0, 1);
+		out.append(",\"p50\":");
+		appendNumber(out, histogram.percentile(0.50) / 1000.0, 1);
+		out.append(",\"p99\":");
+		appendNumber(out, histogram.percentile(0.99) / 1000.0, 1);
+		out.append(",\"max\":");
+		appendNumber(out, histogram.max() / 1000.0, 1);
+		out.append("}");
+	};
+
+	out.append("{\"calls\":");
+	appendDecimal(out, stats.calls);
+	out.append(",\"bytes_sent\":");
+	appendDecimal(out, stats.bytes_sent);
+	out.append(",\"bytes_received\":");
+	appendDecimal(out, stats.bytes_received);
+	appendHistogram("encode_us", stats.encode);
+	appendHistogram("round_trip_us", stats.round_trip);
+	out.append("}");
+}
+
+std::string RedisClient::encodeTimingStatsJSON(const RedisTimingStats& stats)
+{
+	std::string s;
+	appendTimingStatsJSON(s, stats);
+	return s;
+}
+
+void RedisClient::publishTimingStats(const std::string& key_prefix)
+{
+	// Serialized like pipesetBinary(), but not recorded in _pipeset_timing
+	_batch_buffer.clear();
+	size_t count = 0;
+	std::string value;
+	auto appendSet = [&](const std::string& key, const RedisTimingStats& stats)
+	{
+		value.clear();
+		appendTimingStatsJSON(value, stats);
+		_batch_buffer.append("*3\r\n$3\r\nSET\r\n");
+		appendBulkString(_batch_buffer, key.data(), key.size());
+		appendBulkString(_batch_buffer, value.data(), value.size());
+		++count;
+	};
+	for(const auto& plan : _write_plans)
+	{
+		appendSet(key_prefix + "write::" + std::to_string(plan.first), plan.second.timing);
+	}
+	for(size_t i = 0; i < _read_timing.size(); ++i)
+	{
+		appendSet(key_prefix + "read::" + std::to_string(_read_callback_indexes[i]), _read_timing[i]);
+	}
+	appendSet(key_prefix + "pipeset", _pipeset_timing);
+	appendSet(key_prefix + "pipeget", _pipeget_timing);
+
+	if(_deferred_replies)
+	{
+		writeDeferred(_batch_buffer.data(), _batch_buffer.size(), count);
+		return;
+	}
+	writeRaw(_batch_buffer.data(), _batch_buffer.size());
+	if(readRawReplies(count) < count)
+	{
+		throw std::runtime_error("RedisClient: Publishing timing stats failed: " + _raw_reply_error);
+	}
+}
+
+void RedisClient::setTimingStatsPublishing(const std::string& key_prefix, const int interval_ms)
+{
+	_timing_key_prefix = key_prefix;
+	_timing_interval = std::chrono::milliseconds(std::max(interval_ms, 0));
+	_timing_due = std::chrono::steady_clock::now() + _timing_interval;
+}
+
+void RedisClient::publishTimingStatsIfDue()
+{
+	if(_timing_interval.count() == 0)
+	{
+		return;
+	}
+	const auto now = std::chrono::steady_clock::now();
+	if(now < _timing_due)
+	{
+		return;
+	}
+	_timing_due = now + _timing_interval;
+	publishTimingStats(_timing_key_prefix);
+}
+
+void RedisClient::appendPublishCommand(std::string& out, const std::string& channel, const size_t num_pairs)
+{
+	// Message: RESP array of alternating keys and values
+	_publish_message.assign("*");
+	appendDecimal(_publish_message, 2 * num_pairs);
+	_publish_message.append("\r\n");
+	_publish_message.append(_batch_buffer);
+
+	// Command: PUBLISH channel message
+	out.append("*3\r\n$7\r\nPUBLISH\r\n");
+	appendBulkString(out, channel.data(), channel.size());
+	appendBulkString(out, _publish_message.data(), _publish_message.size());
+}
+
+int RedisClient::sendPublishMessage(const std::string& channel, const size_t num_pairs)
+{
+	// _batch_buffer is copied into the message before it is overwritten by the command
+	appendPublishCommand(_publish_command, channel, num_pairs);
+	_batch_buffer.swap(_publish_command);
+	_publish_command.clear();
+
+	writeRaw(_batch_buffer.data(), _batch_buffer.size());
+	if(readRawReplies(1) < 1)
 	{
-		throw runtime_error("no write callback with this index in RedisClient::executeWriteCallback(const int callback_number)\n");
+		throw std::runtime_error("RedisClient: PUBLISH '" + channel + "' failed: " + _raw_reply_error);
 	}
+	return static_cast<int>(_raw_reply_integer);
+}
+
+int RedisClient::publishWriteCallback(const int callback_number, const std::string& channel)
+{
+	WritePlan& plan = findWritePlan(callback_number, "RedisClient::publishWriteCallback(const int callback_number, const std::string& channel)");
+
+	_batch_buffer.clear();
+	const size_t num_pairs = appendWritePlanKeyValues(plan, _batch_buffer);
+	return sendPublishMessage(channel, num_pairs);
+}
+
+size_t RedisClient::formatWriteCallbacks(const std::vector<int>& callback_numbers, std::string& out)
+{
+	appendBatchCommands(callback_numbers, out, "RedisClient::formatWriteCallbacks(const std::vector<int>& callback_numbers, std::string& out)");
 
+	// The caller sends the commands, so their values count as written
+	rememberSentValues(_batch_sent);
+	return _batch_sent.size();
+}
 
-	std::vector<std::pair<std::string,std::string>> write_key_value_pairs;
+size_t RedisClient::formatWriteCallbacksAtomic(const std::vector<int>& callback_numbers, const std::string& seq_key,
+                                               const std::string& timestamp_key, const uint64_t timestamp, std::string& out)
+{
+	appendAtomicWriteCommands(callback_numbers, seq_key, timestamp_key, timestamp, out,
+	                          "RedisClient::formatWriteCallbacksAtomic(const std::vector<int>& callback_numbers, const std::string& seq_key, const std::string& timestamp_key, const uint64_t timestamp, std::string& out)");
+	rememberSentValues(_batch_sent);
+	return _batch_sent.size() + 4;
+}
+
+size_t RedisClient::formatPublishWriteCallbacks(const std::vector<int>& callback_numbers, const std::string& channel, std::string& out)
+{
+	_batch_buffer.clear();
+	size_t num_pairs = 0;
+	for(const int callback_number : callback_numbers)
+	{
+		WritePlan& plan = findWritePlan(callback_number, "RedisClient::formatPublishWriteCallbacks(const std::vector<int>& callback_numbers, const std::string& channel, std::string& out)");
+		num_pairs += appendWritePlanKeyValues(plan, _batch_buffer);
+	}
+	appendPublishCommand(out, channel, num_pairs);
+	return 1;
+}
+
+int RedisClient::publishWriteCallbacks(const std::vector<int>& callback_numbers, const std::string& channel)
+{
+	_batch_buffer.clear();
+	size_t num_pairs = 0;
+	for(const int callback_number : callback_numbers)
+	{
+		WritePlan& plan = findWritePlan(callback_number, "RedisClient::publishWriteCallbacks(const std::vector<int>& callback_numbers, const std::string& channel)");
+		num_pairs += appendWritePlanKeyValues(plan, _batch_buffer);
+	}
+	return sendPublishMessage(channel, num_pairs);
+}
+
+std::string RedisClient::receiveReadCallback(const int callback_number)
+{
+	const size_t callback_index = findReadCallback(callback_number, "RedisClient::receiveReadCallback(const int callback_number)");
+	const std::vector<std::string>& keys = _keys_to_read[callback_index];
+
+	std::string channel, message;
+	receive(channel, message);
+
+	const char *p = message.data();
+	const char *end = message.data() + message.size();
+	size_t num_elements = 0;
+	const char *count_end = (p != end && *p == '*') ? std::from_chars(p + 1, end, num_elements).ptr : nullptr;
+	if(count_end == nullptr || end - count_end < 2 || num_elements % 2 != 0)
+	{
+		throw std::runtime_error("RedisClient: message on '" + channel + "' is not a key-value message.");
+	}
+	p = count_end + 2;
 
-	for(int i=0 ; i<_keys_to_write[callback_index].size() ; i++)
+	for(size_t n = 0; n < num_elements / 2; n++)
 	{
-		std::string encoded_value = "";
+		const char *key_data, *value_data;
+		size_t key_len, value_len;
+		if(!parseBulkString(p, end, key_data, key_len) || !parseBulkString(p, end, value_data, value_len))
+		{
+			throw std::runtime_error("RedisClient: message on '" + channel + "' is not a key-value message.");
+		}
 
-		switch(_objects_to_write_types[callback_index].at(i))
+		// Publisher and subscriber usually register keys in the same order
+		size_t i = n;
+		if(i >= keys.size() || keys[i].compare(0, std::string::npos, key_data, key_len) != 0)
 		{
-			case DOUBLE_NUMBER:
+			for(i = 0; i < keys.size(); i++)
 			{
-				double* tmp_pointer = (double*) _objects_to_write[callback_index].at(i);
-				encoded_value = std::to_string(*tmp_pointer);
+				if(keys[i].compare(0, std::string::npos, key_data, key_len) == 0) break;
 			}
-			break;
+			if(i == keys.size()) continue;
+		}
+
+		_objects_to_read[callback_index][i]->decode(value_data, value_len);
+	}
+	return channel;
+}
+
+
+
+/**
+ * Raw socket path for write plans
+ */
+#ifdef _WIN32
+static inline bool interruptedSocketCall() { return WSAGetLastError() == WSAEINTR; }
+static inline bool wouldBlockSocketCall() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+static inline bool setSocketNonBlocking(redisFD fd) { u_long mode = 1; return ioctlsocket(fd, FIONBIO, &mode) == 0; }
+static inline size_t availableSocketBytes(redisFD fd) { u_long n = 0; return ioctlsocket(fd, FIONREAD, &n) == 0 ? n : 0; }
+#define REDIS_CLIENT_SEND_FLAGS 0
+#else
+static inline bool interruptedSocketCall() { return errno == EINTR; }
+static inline bool wouldBlockSocketCall() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+static inline bool setSocketNonBlocking(redisFD fd) { const int flags = fcntl(fd, F_GETFL, 0); return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0; }
+static inline size_t availableSocketBytes(redisFD fd) { int n = 0; return ioctl(fd, FIONREAD, &n) == 0 && n > 0 ? static_cast<size_t>(n) : 0; }
+#ifdef MSG_NOSIGNAL
+#define REDIS_CLIENT_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define REDIS_CLIENT_SEND_FLAGS 0
+#endif
+#endif
+
+// Reply buffers hold two chunks, so a partial reply plus a whole chunk fit without growing
+static const size_t RECEIVE_CHUNK_SIZE = 4096;
+
+// Receive at most max_len bytes into the free capacity of buffer. recv() never gets more room
+// than the buffer already has, so the buffer only grows when it is full, i.e. when a single
+// reply or message is larger than the buffer, and steady-state reads do not allocate. Returns
+// the result of recv(), with the buffer resized to the bytes received.
+static long receiveIntoBuffer(redisFD fd, std::string& buffer, const size_t max_len)
+{
+	if(buffer.capacity() < 2 * RECEIVE_CHUNK_SIZE)
+	{
+		buffer.reserve(2 * RECEIVE_CHUNK_SIZE);
+	}
+	else if(buffer.size() == buffer.capacity())
+	{
+		buffer.reserve(2 * buffer.capacity());
+	}
+	const size_t pos = buffer.size();
+	const size_t len = std::min(max_len, buffer.capacity() - pos);
+	buffer.resize(pos + len);
+	const auto n = recv(fd, &buffer[pos], static_cast<int>(len), 0);
+	buffer.resize(n > 0 ? pos + static_cast<size_t>(n) : pos);
+	return static_cast<long>(n);
+}
+
+void RedisClient::useHiredis()
+{
+	finishDeferredReplies();
+	if(_raw_reply_begin != _raw_reply_buffer.size())
+		throw std::runtime_error("RedisClient: Unconsumed raw socket replies before a hiredis command.");
+}
+
+void RedisClient::useRawSocket()
+{
+	// Every hiredis call reads all of its replies or leaves the context failed, so hiredis holds
+	// nothing unless the connection failed or receives messages of a subscription
+	if(context_->err)
+		throw std::runtime_error("RedisClient: Connection failed: " + std::string(context_->errstr));
+	if(_subscribed)
+		throw std::runtime_error("RedisClient: Raw socket writes are not possible on a subscribed connection.");
+}
+
+void RedisClient::writeRaw(const char *data, const size_t len)
+{
+	finishDeferredReplies();
+	sendRaw(data, len);
+}
 
-			case INT_NUMBER:
+void RedisClient::sendRaw(const char *data, const size_t len)
+{
+	if(!context_)
+		throw std::runtime_error("RedisClient: Not connected to redis server.");
+	useRawSocket();
+
+	size_t written = 0;
+	while(written < len)
+	{
+		auto n = send(context_->fd, data + written, static_cast<int>(len - written), REDIS_CLIENT_SEND_FLAGS);
+		if(n < 0)
+		{
+			if(interruptedSocketCall()) continue;
+			throw std::runtime_error("RedisClient: Failed to write to redis server.");
+		}
+		written += static_cast<size_t>(n);
+	}
+}
+
+// Length of the complete RESP reply starting at p, or 0 if more data is needed.
+// error points at the first error reply (including inside arrays), if any.
+static size_t parseReplyLength(const char *p, const char *end, const char *&error)
+{
+	const char *line_end = static_cast<const char *>(memchr(p, '\n', end - p));
+	if(line_end == nullptr) return 0;
+	const size_t header_len = line_end + 1 - p;
+
+	long long n = 0;
+	bool negative = false;
+	if(*p == '$' || *p == '*')
+	{
+		const char *c = p + 1;
+		if(*c == '-') { negative = true; ++c; }
+		for(; *c >= '0' && *c <= '9'; ++c) n = 10 * n + (*c - '0');
+	}
+
+	switch(*p)
+	{
+		case '+':
+		case ':':
+			return header_len;
+
+		case '-':
+			if(error == nullptr) error = p;
+			return header_len;
+
+		case '$':
+		{
+			if(negative) return header_len;
+			const size_t total = header_len + static_cast<size_t>(n) + 2;
+			return (static_cast<size_t>(end - p) >= total) ? total : 0;
+		}
+
+		case '*':
+		{
+			size_t total = header_len;
+			for(long long i = 0; !negative && i < n; ++i)
 			{
-				int* tmp_pointer = (int*) _objects_to_write[callback_index].at(i);
-				encoded_value = std::to_string(*tmp_pointer);
+				const size_t element_len = parseReplyLength(p + total, end, error);
+				if(element_len == 0) return 0;
+				total += element_len;
 			}
-			break;
+			return total;
+		}
+
+		default:
+			throw std::runtime_error("RedisClient: Unexpected reply from redis server.");
+	}
+}
+
+const char *RedisClient::nextRawReply(size_t& reply_len, const char *&error)
+{
+	// The previous reply has been consumed by now
+	if(_raw_reply_begin == _raw_reply_buffer.size())
+	{
+		_raw_reply_buffer.clear();
+		_raw_reply_begin = 0;
+	}
+
+	while(true)
+	{
+		// Consume a reply that is already buffered
+		const char *begin = _raw_reply_buffer.data() + _raw_reply_begin;
+		const char *end = _raw_reply_buffer.data() + _raw_reply_buffer.size();
+		error = nullptr;
+		reply_len = (begin < end) ? parseReplyLength(begin, end, error) : 0;
+		if(reply_len > 0)
+		{
+			_raw_reply_begin += reply_len;
+			_raw_bytes_parsed += reply_len;
+			return begin;
+		}
+
+		// Need more data, behind the partial reply
+		_raw_reply_buffer.erase(0, _raw_reply_begin);
+		_raw_reply_begin = 0;
+		const long n = receiveIntoBuffer(context_->fd, _raw_reply_buffer, RECEIVE_CHUNK_SIZE);
+		if(n <= 0)
+		{
+			if(n < 0 && interruptedSocketCall()) continue;
+			throw std::runtime_error("RedisClient: Connection lost while reading replies.");
+		}
+	}
+}
+
+size_t RedisClient::readRawReplies(const size_t count)
+{
+	size_t first_error = count;
+	for(size_t parsed = 0; parsed < count; ++parsed)
+	{
+		size_t reply_len;
+		const char *error;
+		const char *reply = nextRawReply(reply_len, error);
+		if(error != nullptr && first_error == count)
+		{
+			first_error = parsed;
+			_raw_reply_error.assign(error + 1, static_cast<const char *>(memchr(error, '\r', reply + reply_len - error)));
+		}
+		else if(*reply == ':')
+		{
+			std::from_chars(reply + 1, reply + reply_len, _raw_reply_integer);
+		}
+	}
+	return first_error;
+}
+
+
+
+/**
+ * Deferred replies of writes
+ */
+void RedisClient::setDeferredReplies(const bool enabled, const size_t max_pending)
+{
+	if(!enabled)
+	{
+		finishDeferredReplies();
+	}
+	_deferred_replies = enabled;
+	_max_pending_replies = max_pending;
+}
 
-			case STRING:
+void RedisClient::writeDeferred(const char *data, const size_t len, const size_t count)
+{
+	readDeferredReplies(_max_pending_replies);
+	sendRaw(data, len);
+	_pending_replies += count;
+}
+
+void RedisClient::readDeferredReplies(const size_t max_pending)
+{
+	receiveAvailable();
+	while(_pending_replies > 0 && (_pending_replies > max_pending || rawReplyBuffered()))
+	{
+		size_t reply_len;
+		const char *error;
+		const char *reply = nextRawReply(reply_len, error);
+		--_pending_replies;
+		if(error != nullptr)
+		{
+			// The failed write may be one the deadband now skips, so every value is written again
+			forgetWrittenValues();
+			++_deferred_errors;
+			_last_deferred_error.assign(error + 1, static_cast<const char *>(memchr(error, '\r', reply + reply_len - error)));
+			if(_deferred_error_callback)
 			{
-				std::string* tmp_pointer = (std::string*) _objects_to_write[callback_index].at(i);
-				encoded_value = (*tmp_pointer);
+				_deferred_error_callback(_last_deferred_error);
 			}
-			break;
+		}
+	}
+}
 
-			case EIGEN_OBJECT:
-			{
-				double* tmp_pointer = (double*) _objects_to_write[callback_index].at(i);
-				int nrows = _objects_to_write_sizes[callback_index].at(i).first;
-				int ncols = _objects_to_write_sizes[callback_index].at(i).second;
+void RedisClient::receiveAvailable()
+{
+	// Only fill the room the buffer already has, so a backlog of replies does not grow it
+	if(!context_ || _pending_replies == 0)
+	{
+		return;
+	}
+	const size_t buffered = _raw_reply_buffer.size() - _raw_reply_begin;
+	const size_t room = _raw_reply_buffer.capacity() > buffered ? _raw_reply_buffer.capacity() - buffered : 0;
+	const size_t available = std::min(availableSocketBytes(context_->fd), room);
+	if(available == 0)
+	{
+		return;
+	}
+
+	_raw_reply_buffer.erase(0, _raw_reply_begin);
+	_raw_reply_begin = 0;
+	const long n = receiveIntoBuffer(context_->fd, _raw_reply_buffer, available);
+	if(n <= 0)
+	{
+		if(n < 0 && interruptedSocketCall()) return;
+		throw std::runtime_error("RedisClient: Connection lost while reading replies.");
+	}
+}
+
+bool RedisClient::rawReplyBuffered() const
+{
+	const char *begin = _raw_reply_buffer.data() + _raw_reply_begin;
+	const char *end = _raw_reply_buffer.data() + _raw_reply_buffer.size();
+	const char *error = nullptr;
+	return begin < end && parseReplyLength(begin, end, error) > 0;
+}
 
-				Eigen::MatrixXd tmp_matrix = Eigen::MatrixXd::Zero(nrows, ncols);
-				for(int k=0 ; k<nrows ; k++)
+
+
+/**
+ * Keyspace notifications for read callbacks
+ */
+bool RedisClient::enableKeyspaceNotifications(const std::string& key_pattern, const int db, const bool configure_server)
+{
+	if(!context_)
+		throw std::runtime_error("RedisClient: Not connected to redis server.");
+	disableKeyspaceNotifications();
+
+	// Check the flags for keyspace events of strings, DEL and expiry
+	auto config = commandArgv({"CONFIG", "GET", "notify-keyspace-events"});
+	if(!config || config->type != REDIS_REPLY_ARRAY || config->elements != 2 || config->element[1]->type != REDIS_REPLY_STRING)
+	{
+		std::cout << "RedisClient: Warning: Could not read notify-keyspace-events"
+		          << (config && config->type == REDIS_REPLY_ERROR ? ": " + std::string(config->str, config->len) : std::string())
+		          << ", reading all keys." << std::endl;
+		return false;
+	}
+	const std::string flags(config->element[1]->str, config->element[1]->len);
+	std::string missing = (flags.find('K') == std::string::npos) ? "K" : "";
+	for(const char c : {'$', 'g', 'x'})
+	{
+		if(flags.find('A') == std::string::npos && flags.find(c) == std::string::npos) missing += c;
+	}
+	if(!missing.empty())
+	{
+		std::unique_ptr<redisReply, redisReplyDeleter> reply;
+		if(configure_server)
+			reply = commandArgv({"CONFIG", "SET", "notify-keyspace-events", flags + missing});
+		if(!reply || reply->type == REDIS_REPLY_ERROR)
+		{
+			std::cout << "RedisClient: Warning: notify-keyspace-events '" << flags << "' lacks '" << missing << "'"
+			          << (reply ? ", CONFIG SET failed: " + std::string(reply->str, reply->len) : std::string())
+			          << ", reading all keys." << std::endl;
+			return false;
+		}
+	}
+
+	_notify_channel_prefix = "__keyspace@" + std::to_string(db) + "__:";
+	_notify_pattern = _notify_channel_prefix + key_pattern;
+	const std::string error = connectKeyspaceNotifications();
+	if(!error.empty())
+	{
+		_notify_pattern.clear();
+		throw std::runtime_error("RedisClient: " + error);
+	}
+	return true;
+}
+
+std::string RedisClient::connectKeyspaceNotifications()
+{
+	// Subscribe on a second connection, which only receives from then on
+	std::unique_ptr<redisContext, redisContextDeleter> context(redisConnectWithTimeout(_hostname.c_str(), _port, _timeout));
+	if(!context)
+		return "Could not allocate redis context.";
+	if(context->err)
+		return "Could not connect to redis server: " + std::string(context->errstr);
+	const char *argv[] = {"PSUBSCRIBE", _notify_pattern.c_str()};
+	const size_t argvlen[] = {10, _notify_pattern.size()};
+	std::unique_ptr<redisReply, redisReplyDeleter> reply((redisReply *)redisCommandArgv(context.get(), 2, argv, argvlen));
+	if(!reply || reply->type != REDIS_REPLY_ARRAY)
+		return "PSUBSCRIBE '" + _notify_pattern + "' failed.";
+	if(!setSocketNonBlocking(context->fd))
+		return "Could not make the keyspace notification connection non-blocking.";
+
+	_notify_context = std::move(context);
+	_notify_buffer.clear();
+
+	// Writes before the subscription have no notification
+	markReadKeysDirty();
+	return std::string();
+}
+
+void RedisClient::disableKeyspaceNotifications()
+{
+	_notify_context.reset(nullptr);
+	_notify_buffer.clear();
+	_notify_pattern.clear();
+}
+
+// Reconnect attempts of a lost notification connection, which may block for the connect timeout
+static const std::chrono::seconds NOTIFY_RETRY_INTERVAL(1);
+
+bool RedisClient::keyspaceNotificationsActive()
+{
+	if(_notify_pattern.empty())
+		return false;
+
+	// Reconnect a lost notification connection at most once per interval, reading all keys meanwhile
+	if(!_notify_context)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		if(now < _notify_retry_due)
+			return false;
+		_notify_retry_due = now + NOTIFY_RETRY_INTERVAL;
+		if(!connectKeyspaceNotifications().empty())
+			return false;
+		std::cout << "RedisClient: Keyspace notification connection restored." << std::endl;
+	}
+
+	if(drainKeyspaceNotifications())
+		return true;
+
+	// Notifications may have been lost, so every key has to be read again
+	std::cout << "RedisClient: Warning: Keyspace notification connection lost, reading all keys until it is restored." << std::endl;
+	_notify_context.reset(nullptr);
+	_notify_buffer.clear();
+	_notify_retry_due = std::chrono::steady_clock::now() + NOTIFY_RETRY_INTERVAL;
+	markReadKeysDirty();
+	return false;
+}
+
+void RedisClient::markReadKeysDirty()
+{
+	for(auto& dirty : _read_dirty)
+	{
+		std::fill(dirty.begin(), dirty.end(), 1);
+	}
+}
+
+bool RedisClient::drainKeyspaceNotifications()
+{
+	// Read whatever has arrived
+	while(true)
+	{
+		const long n = receiveIntoBuffer(_notify_context->fd, _notify_buffer, RECEIVE_CHUNK_SIZE);
+		if(n > 0) continue;
+		if(n < 0 && interruptedSocketCall()) continue;
+		if(n < 0 && wouldBlockSocketCall()) break;
+		return false;
+	}
+
+	// Messages are ["pmessage", pattern, "__keyspace@<db>__:<key>", event]
+	const char *p = _notify_buffer.data();
+	const char *end = p + _notify_buffer.size();
+	while(p != end)
+	{
+		const char *error = nullptr;
+		const size_t message_len = parseReplyLength(p, end, error);
+		if(message_len == 0) break;
+		const char *message_end = p + message_len;
+
+		const char *q = p + std::min<size_t>(message_len, 4);
+		const char *kind, *pattern, *channel;
+		size_t kind_len, pattern_len, channel_len;
+		if(message_len > 4 && std::memcmp(p, "*4\r\n", 4) == 0 &&
+		   parseBulkString(q, message_end, kind, kind_len) && std::string_view(kind, kind_len) == "pmessage" &&
+		   parseBulkString(q, message_end, pattern, pattern_len) && parseBulkString(q, message_end, channel, channel_len))
+		{
+			const std::string_view key(channel, channel_len);
+			if(key.compare(0, _notify_channel_prefix.size(), _notify_channel_prefix) == 0)
+			{
+				const auto it = _notify_keys.find(key.substr(_notify_channel_prefix.size()));
+				if(it != _notify_keys.end())
 				{
-					for(int l=0 ; l<ncols ; l++)
+					for(const auto& read_key : it->second)
 					{
-						tmp_matrix(k,l) = tmp_pointer[k + ncols*l];
+						_read_dirty[read_key.first][read_key.second] = 1;
 					}
 				}
-
-				encoded_value = encodeEigenMatrixJSON(tmp_matrix);
 			}
-			break;
+		}
+		p = message_end;
+	}
+	_notify_buffer.erase(0, p - _notify_buffer.data());
+	return true;
+}
+
+void RedisClient::appendAtomicWriteCommands(const std::vector<int>& callback_numbers, const std::string& seq_key,
+                                            const std::string& timestamp_key, const uint64_t timestamp,
+                                            std::string& out, const char *caller)
+{
+	out.append("*1\r\n$5\r\nMULTI\r\n");
+	appendBatchCommands(callback_numbers, out, caller);
+
+	out.append("*2\r\n$4\r\nINCR\r\n");
+	appendBulkString(out, seq_key.data(), seq_key.size());
+
+	char buf[24];
+	const auto result = std::to_chars(buf, buf + sizeof(buf), timestamp);
+	out.append("*3\r\n$3\r\nSET\r\n");
+	appendBulkString(out, timestamp_key.data(), timestamp_key.size());
+	appendBulkString(out, buf, result.ptr - buf);
+
+	out.append("*1\r\n$4\r\nEXEC\r\n");
+}
+
+uint64_t RedisClient::executeWriteCallbacksAtomic(const std::vector<int>& callback_numbers, const std::string& seq_key,
+                                                  const std::string& timestamp_key, const uint64_t timestamp)
+{
+	return executeWriteCallbacksAtomic(callback_numbers, seq_key, timestamp_key, timestamp, std::string(), 0);
+}
+
+uint64_t RedisClient::executeWriteCallbacksAtomic(const std::vector<int>& callback_numbers, const std::string& seq_key,
+                                                  const std::string& timestamp_key, const uint64_t timestamp,
+                                                  const std::string& commands, const size_t num_commands)
+{
+	_batch_buffer.clear();
+	appendAtomicWriteCommands(callback_numbers, seq_key, timestamp_key, timestamp, _batch_buffer,
+	                          "RedisClient::executeWriteCallbacksAtomic(const std::vector<int>& callback_numbers, const std::string& seq_key, const std::string& timestamp_key, const uint64_t timestamp)");
+	_batch_buffer.append(commands);
+	const auto start = std::chrono::steady_clock::now();
+	writeRaw(_batch_buffer.data(), _batch_buffer.size());
+
+	// +OK for MULTI and +QUEUED for every command. A command that is not
+	// queued makes EXEC discard the whole transaction.
+	const size_t num_queued = _batch_sent.size() + 2;
+	const size_t first_error = readRawReplies(1 + num_queued);
+	_first_reply_error.swap(_raw_reply_error);
+	size_t reply_len;
+	const char *error;
+	const char *reply = nextRawReply(reply_len, error);
+	const auto round_trip = std::chrono::steady_clock::now() - start;
+	for(auto& batch_plan : _batch_plans)
+	{
+		batch_plan.first->timing.round_trip.record(round_trip);
+	}
+
+	// EXEC replies with the replies of all queued commands, the INCR one after the SETs.
+	// The reply is parsed before reading further replies, which may move the buffer.
+	const bool exec_failed = (error != nullptr);
+	uint64_t seq = 0;
+	bool seq_found = false;
+	if(exec_failed && first_error == 1 + num_queued)
+	{
+		_first_reply_error.assign(error + 1, static_cast<const char *>(memchr(error, '\r', reply + reply_len - error)));
+	}
+	else if(!exec_failed)
+	{
+		const char *end = reply + reply_len;
+		const char *p = static_cast<const char *>(memchr(reply, '\n', reply_len)) + 1;
+		for(size_t i = 0; *reply == '*' && i < _batch_sent.size() && p < end; ++i)
+		{
+			p += parseReplyLength(p, end, error);
+		}
+		seq_found = *reply == '*' && p < end && *p == ':' && std::from_chars(p + 1, end, seq).ec == std::errc();
+	}
+
+	// All replies are consumed before reporting an error to keep the connection in sync
+	const size_t command_error = (num_commands > 0) ? readRawReplies(num_commands) : 0;
+	if(first_error >= 1 && first_error <= _batch_sent.size())
+	{
+		throw std::runtime_error("RedisClient: Transaction SET command failed for key: " + _batch_sent[first_error - 1]->key + ": " + _first_reply_error);
+	}
+	if(first_error < 1 + num_queued || exec_failed)
+	{
+		throw std::runtime_error("RedisClient: Transaction failed: " + _first_reply_error);
+	}
+	if(!seq_found)
+	{
+		throw std::runtime_error("RedisClient: Transaction failed: unexpected EXEC reply.");
+	}
+	rememberSentValues(_batch_sent);
+	if(command_error < num_commands)
+	{
+		throw std::runtime_error("RedisClient: Pipeline command failed: " + _raw_reply_error);
+	}
+	publishTimingStatsIfDue();
+	return seq;
+}
+
+// Reads the value of a sequence key from a GET reply. A missing key is 0.
+static bool parseSequenceReply(const char *reply, const size_t reply_len, uint64_t& seq)
+{
+	const char *p = reply;
+	const char *data;
+	size_t len;
+	if(reply_len >= 3 && std::memcmp(reply, "$-1", 3) == 0)
+	{
+		seq = 0;
+		return true;
+	}
+	return parseBulkString(p, reply + reply_len, data, len) &&
+	       std::from_chars(data, data + len, seq).ptr == data + len;
+}
+
+uint64_t RedisClient::executeReadCallbackConsistent(const int callback_number, const std::string& seq_key, const int max_attempts)
+{
+	const size_t callback_index = findReadCallback(callback_number, "RedisClient::executeReadCallbackConsistent(const int callback_number, const std::string& seq_key, const int max_attempts)");
+	const std::vector<std::string>& keys = _keys_to_read[callback_index];
+
+	// GET seq_key, the GETs of the callback, GET seq_key
+	_batch_buffer.assign("*2\r\n$3\r\nGET\r\n");
+	appendBulkString(_batch_buffer, seq_key.data(), seq_key.size());
+	_batch_buffer.append(_read_commands[callback_index]);
+	_batch_buffer.append("*2\r\n$3\r\nGET\r\n");
+	appendBulkString(_batch_buffer, seq_key.data(), seq_key.size());
+
+	// Repeated attempts are timed as one call
+	RedisTimingStats& timing = _read_timing[callback_index];
+	const auto start = std::chrono::steady_clock::now();
+	timing.calls++;
+	for(int attempt = 0; attempt < std::max(max_attempts, 1); ++attempt)
+	{
+		const uint64_t parsed = _raw_bytes_parsed;
+		writeRaw(_batch_buffer.data(), _batch_buffer.size());
+
+		// All replies are consumed before reporting an error to keep the connection in sync
+		uint64_t seq_before = 0;
+		uint64_t seq_after = 0;
+		size_t reply_len;
+		const char *error;
+		const char *reply = nextRawReply(reply_len, error);
+		bool seq_valid = parseSequenceReply(reply, reply_len, seq_before);
+		const size_t first_error = decodeReadReplies(callback_index);
+		reply = nextRawReply(reply_len, error);
+		seq_valid = parseSequenceReply(reply, reply_len, seq_after) && seq_valid;
+		timing.bytes_sent += _batch_buffer.size();
+		timing.bytes_received += _raw_bytes_parsed - parsed;
+		if(!seq_valid || first_error < keys.size() || seq_before == seq_after || attempt + 1 >= max_attempts)
+		{
+			timing.round_trip.record(std::chrono::steady_clock::now() - start);
 		}
 
-		if(encoded_value != "")
+		if(!seq_valid)
+		{
+			throw std::runtime_error("RedisClient: Sequence key '" + seq_key + "' does not hold an integer.");
+		}
+		if(first_error < keys.size())
 		{
-				write_key_value_pairs.push_back(make_pair(_keys_to_write[callback_index].at(i),encoded_value));
+			throw std::runtime_error("RedisClient: Pipeline GET command failed for key: " + keys[first_error] + ": " + _raw_reply_error);
+		}
+		if(seq_before == seq_after)
+		{
+			return seq_after;
 		}
 	}
+	throw std::runtime_error("RedisClient: Sequence key '" + seq_key + "' changed during every read of read callback " +
+	                         std::to_string(callback_number) + ".");
+}
 
-	pipeset(write_key_value_pairs);
+// Single pass JSON matrix parser writing straight into the storage of a
+// registered object. Vectors accept "[1,2,3]" as well as nested rows or
+// columns with the same number of coefficients; matrices must be nested with
+// exactly rows x cols coefficients. Returns false on any mismatch.
+template<typename Scalar>
+static bool parseEigenMatrixJSON(const char *p, const char *end, Scalar *data, const int rows, const int cols, const bool row_major)
+{
+	const bool is_vector = (rows == 1 || cols == 1);
+	const size_t size = static_cast<size_t>(rows) * cols;
+	auto skipSpace = [&p, end]() { while (p != end && isspace(static_cast<unsigned char>(*p))) ++p; };
+	auto expect = [&p, end, &skipSpace](char c) { skipSpace(); if (p == end || *p != c) return false; ++p; return true; };
+
+	if (!expect('[')) return false;
+	skipSpace();
+	const bool nested = (p != end && *p == '[');
+
+	size_t count = 0;
+	for (int row = 0; ; ++row) {
+		if (nested && !expect('[')) return false;
+		int col = 0;
+		for (; ; ++col) {
+			skipSpace();
+			double value;
+			const auto result = std::from_chars(p, end, value);
+			if (result.ec != std::errc() || count == size) return false;
+			p = result.ptr;
+
+			size_t index = count++;
+			if (!is_vector) {
+				if (row >= rows || col >= cols) return false;
+				index = row_major ? static_cast<size_t>(row) * cols + col : static_cast<size_t>(col) * rows + row;
+			}
+			data[index] = static_cast<Scalar>(value);
+			if (!expect(',')) break;
+		}
+		if (!nested) break;
+		if (!expect(']') || (!is_vector && col + 1 != cols)) return false;
+		if (!expect(',')) break;
+	}
+
+	if (!expect(']') || count != size) return false;
+	skipSpace();
+	return p == end;
 }
 
+template<typename Scalar>
+bool RedisClient::decodeEigenMatrixJSONInto(const char *data, const size_t len, Scalar *object, const int rows, const int cols, const bool row_major)
+{
+	return parseEigenMatrixJSON(data, data + len, object, rows, cols, row_major);
+}
+
+template bool RedisClient::decodeEigenMatrixJSONInto<float>(const char *, const size_t, float *, const int, const int, const bool);
+template bool RedisClient::decodeEigenMatrixJSONInto<double>(const char *, const size_t, double *, const int, const int, const bool);
+template bool RedisClient::decodeEigenMatrixJSONInto<int32_t>(const char *, const size_t, int32_t *, const int, const int, const bool);
+
 
 
 
@@ -598,6 +2247,17 @@ static inline Eigen::MatrixXd decodeEigenMatrixWithDelimiters(const std::string&
 	return matrix;
 }
 
+Eigen::MatrixXd RedisClient::decodeEigenMatrixBinary(const std::string& str) {
+	RedisEigenBinary::ScalarType type;
+	uint32_t rows, cols;
+	if (!RedisEigenBinary::readHeader(str.data(), str.size(), type, rows, cols))
+		throw std::runtime_error("RedisClient: Failed to decode binary Eigen Matrix: invalid header or length.");
+
+	Eigen::MatrixXd matrix(rows, cols);
+	decodeEigenMatrixBinary(str, matrix);
+	return matrix;
+}
+
 Eigen::MatrixXd RedisClient::decodeEigenMatrixString(const std::string& str) {
 	return decodeEigenMatrixWithDelimiters(str, ' ', ';', ";");
 }
@@ -11,11 +11,25 @@
 
 #include <Eigen/Core>
 #include <hiredis/hiredis.h>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <initializer_list>
 #include <vector>
 #include <thread>
 #include <chrono>
+#include <functional>
 #include <stdexcept>
+#include <type_traits>
+
+#include "LatencyHistogram.h"
 
 #define KEEP_DEPRECATED
 
@@ -40,6 +54,98 @@ namespace RedisServer {
 	static const std::string KEY_PREFIX = "sai2::";
 }
 
+/**
+ * Binary wire encoding for Eigen objects.
+ *
+ * Layout (12 byte header followed by the payload):
+ *   [0..1]  magic "EB"
+ *   [2]     scalar type (FLOAT32, FLOAT64 or INT32)
+ *   [3]     reserved (0)
+ *   [4..7]  rows, uint32 little-endian
+ *   [8..11] cols, uint32 little-endian
+ *   [12..]  rows * cols coefficients, little-endian, column-major order
+ */
+namespace RedisEigenBinary {
+	const char MAGIC_0 = 'E';
+	const char MAGIC_1 = 'B';
+	const size_t HEADER_SIZE = 12;
+
+	enum ScalarType : uint8_t
+	{
+		FLOAT32 = 1,
+		FLOAT64 = 2,
+		INT32 = 3,
+	};
+
+	// Maps a C++ scalar to its wire type. Unsupported scalars fail to compile.
+	template<typename Scalar> struct ScalarTraits;
+	template<> struct ScalarTraits<float>   { static const ScalarType type = FLOAT32; };
+	template<> struct ScalarTraits<double>  { static const ScalarType type = FLOAT64; };
+	template<> struct ScalarTraits<int32_t> { static const ScalarType type = INT32; };
+
+	inline size_t scalarSize(const ScalarType type) {
+		return (type == FLOAT64) ? 8 : 4;
+	}
+
+	inline bool hostIsLittleEndian() {
+		const uint16_t probe = 1;
+		uint8_t first_byte;
+		std::memcpy(&first_byte, &probe, 1);
+		return first_byte == 1;
+	}
+
+	template<typename T>
+	inline void storeLittleEndian(char *dst, const T value) {
+		std::memcpy(dst, &value, sizeof(T));
+		if (!hostIsLittleEndian()) std::reverse(dst, dst + sizeof(T));
+	}
+
+	template<typename T>
+	inline T loadLittleEndian(const char *src) {
+		char bytes[sizeof(T)];
+		std::memcpy(bytes, src, sizeof(T));
+		if (!hostIsLittleEndian()) std::reverse(bytes, bytes + sizeof(T));
+		T value;
+		std::memcpy(&value, bytes, sizeof(T));
+		return value;
+	}
+
+	inline void writeHeader(char *dst, const ScalarType type, const uint32_t rows, const uint32_t cols) {
+		dst[0] = MAGIC_0;
+		dst[1] = MAGIC_1;
+		dst[2] = static_cast<char>(type);
+		dst[3] = 0;
+		storeLittleEndian<uint32_t>(dst + 4, rows);
+		storeLittleEndian<uint32_t>(dst + 8, cols);
+	}
+
+	/**
+	 * Parse and validate a header. Returns false if the magic, scalar type or
+	 * payload length do not match.
+	 */
+	inline bool readHeader(const char *src, const size_t len, ScalarType& type, uint32_t& rows, uint32_t& cols) {
+		if (len < HEADER_SIZE || src[0] != MAGIC_0 || src[1] != MAGIC_1) return false;
+		type = static_cast<ScalarType>(src[2]);
+		if (type != FLOAT32 && type != FLOAT64 && type != INT32) return false;
+		rows = loadLittleEndian<uint32_t>(src + 4);
+		cols = loadLittleEndian<uint32_t>(src + 8);
+		return len == HEADER_SIZE + static_cast<size_t>(rows) * cols * scalarSize(type);
+	}
+
+	inline bool isEncoded(const std::string& str) {
+		return str.size() >= HEADER_SIZE && str[0] == MAGIC_0 && str[1] == MAGIC_1;
+	}
+
+	template<typename Scalar>
+	inline Scalar loadCoefficient(const char *src, const ScalarType type) {
+		switch (type) {
+			case FLOAT32: return static_cast<Scalar>(loadLittleEndian<float>(src));
+			case FLOAT64: return static_cast<Scalar>(loadLittleEndian<double>(src));
+			default:      return static_cast<Scalar>(loadLittleEndian<int32_t>(src));
+		}
+	}
+}
+
 struct redisReplyDeleter {
 	void operator()(redisReply *r) { freeReplyObject(r); }
 };
@@ -57,33 +163,319 @@ struct HiredisServerInfo {
 };
 #endif  // KEEP_DEPRECATED
 
+/**
+ * Timing and traffic of one kind of RedisClient call, e.g. the executions of
+ * one write callback. Recorded on every call; durations in nanoseconds.
+ */
+struct RedisTimingStats {
+	uint64_t calls = 0;
+	uint64_t bytes_sent = 0;      // RESP commands written
+	uint64_t bytes_received = 0;  // RESP replies parsed
+
+	// Serializing the commands (writes only)
+	LatencyHistogram encode;
+
+	// From writing the commands until their last reply is parsed, including
+	// decoding into the registered objects for read callbacks
+	LatencyHistogram round_trip;
+
+	void merge(const RedisTimingStats& other) {
+		calls += other.calls;
+		bytes_sent += other.bytes_sent;
+		bytes_received += other.bytes_received;
+		encode.merge(other.encode);
+		round_trip.merge(other.round_trip);
+	}
+};
+
 class RedisClient {
 
 private:
 
 	/**
-	 * private variables for automating pipeget and pipeset
+	 * One key of a read callback, compiled at registration.
+	 *
+	 * Each subclass decodes the value straight into the registered object of
+	 * the exact registered type, like WriteEntry encodes it.
 	 */
-	enum RedisSupportedTypes
+	struct ReadEntry
 	{
-		INT_NUMBER,
-		DOUBLE_NUMBER,
-		STRING,
-		EIGEN_OBJECT,
+		virtual ~ReadEntry() {}
+
+		// Throw if the value does not parse or does not have the registered shape
+		virtual void decode(const char *data, const size_t len) = 0;
 	};
 
+	template<typename T> struct NumberReadEntry;
+	struct StringReadEntry;
+	template<typename MatrixType> struct EigenJSONReadEntry;
+	template<typename MatrixType> struct EigenBinaryReadEntry;
+
+	/**
+	 * private variables for automating pipeget and pipeset
+	 */
 	std::vector<int> _read_callback_indexes;
 	std::vector<std::vector<std::string>> _keys_to_read;
-	std::vector<std::vector<void *>> _objects_to_read;
-	std::vector<std::vector<RedisSupportedTypes>> _objects_to_read_types;
+	std::vector<std::vector<std::unique_ptr<ReadEntry>>> _objects_to_read;
+	std::vector<std::string> _read_commands;  // pipelined GETs of each read callback, in key order
+	std::vector<std::vector<size_t>> _read_command_offsets;  // start of the GET of each key in _read_commands
+	std::vector<RedisTimingStats> _read_timing;
 
-	std::vector<int> _write_callback_indexes;
-	std::vector<std::vector<std::string>> _keys_to_write;
-	std::vector<std::vector<void *>> _objects_to_write;
-	std::vector<std::vector<RedisSupportedTypes>> _objects_to_write_types;
-	std::vector<std::vector<std::pair<int, int>>> _objects_to_write_sizes;
+	/**
+	 * Keyspace notifications, see enableKeyspaceNotifications().
+	 *
+	 * Every read key has a dirty flag, set when the key is registered and by
+	 * every notification of the key, and cleared right before the key is
+	 * read. A write is either executed before the GET, which then returns it,
+	 * or its notification arrives later, so no write is missed.
+	 */
+	std::unique_ptr<redisContext, redisContextDeleter> _notify_context;
+	std::string _notify_buffer;
+	std::string _notify_channel_prefix;  // "__keyspace@<db>__:"
+	std::string _notify_pattern;  // empty if notifications are disabled
+	std::chrono::steady_clock::time_point _notify_retry_due;  // next reconnect after the connection was lost
+	std::map<std::string, std::vector<std::pair<size_t, size_t>>, std::less<>> _notify_keys;  // read key -> callback and key index
+	std::vector<std::vector<char>> _read_dirty;
+	std::vector<size_t> _dirty_indexes;
+	std::string _dirty_commands;
+
+	// Server of connect(), for the notification connection
+	std::string _hostname;
+	int _port = 0;
+	struct timeval _timeout = {0, 0};
+
+	// Open the notification connection of _notify_pattern. Returns the error, empty on success.
+	std::string connectKeyspaceNotifications();
+	// Whether executeReadCallback() may only read dirty keys. Drains the notifications, and
+	// reconnects a lost notification connection once its retry is due.
+	bool keyspaceNotificationsActive();
+	// Read the pending notifications without waiting and mark their keys dirty. Returns false
+	// if the notification connection was lost.
+	bool drainKeyspaceNotifications();
+	void markReadKeysDirty();
+
+	// Decode a JSON value straight into the storage of a registered Eigen
+	// object. Return false if the value does not parse or does not have its shape.
+	template<typename Scalar>
+	static bool decodeEigenMatrixJSONInto(const char *data, const size_t len, Scalar *object, const int rows, const int cols, const bool row_major);
+
+	size_t findReadCallback(const int callback_number, const char *caller) const;
+	void addReadKey(const size_t callback_index, const std::string& key, std::unique_ptr<ReadEntry> entry);
+
+	// Read the GET replies of a read callback and decode them, of all keys or
+	// of the given key indexes. Returns the index of the first failed key, or
+	// the key count, with _raw_reply_error set. Failed keys are marked dirty.
+	size_t decodeReadReplies(const size_t callback_index, const std::vector<size_t> *indexes=nullptr);
+
+	/**
+	 * One key of a write callback, compiled at registration.
+	 *
+	 * The RESP fragment "*3 $3 SET $<len> <key>" is serialized once, and each
+	 * subclass encodes its value for the exact registered type, so executing a
+	 * write callback needs neither a type switch nor heap allocations once the
+	 * plan buffers have grown to their working size.
+	 */
+	struct WriteEntry
+	{
+		std::string key;
+		std::string command_prefix;
+		std::string command_suffix;  // "PX <ms>" if the callback has an expiry
+
+		explicit WriteEntry(const std::string& key);
+		virtual ~WriteEntry() {}
+
+		// Rebuild the command fragments for SET key value [PX milliseconds]
+		void setExpiry(const int milliseconds);
+
+		// Append the RESP bulk string "$<len>\r\n<value>\r\n" to out, using
+		// scratch for variable-length text. Returns false to skip the key.
+		virtual bool appendValue(std::string& out, std::string& scratch) const = 0;
+
+		// Deadband, see setWriteCallbackDeadband(). 0 writes on every execution.
+		double deadband = 0;
+		// Decimals of text values, see setWriteCallbackPrecision(). -1 for lossless.
+		int precision = -1;
+		std::chrono::steady_clock::time_point refresh_due;
+
+		enum ValueKind { OTHER_VALUE, POSITION_VALUE, ORIENTATION_VALUE };
+		virtual ValueKind valueKind() const { return OTHER_VALUE; }
+
+		// Largest change of a coefficient since rememberValue(), infinity
+		// before the first call, after forgetValue() or for values that are
+		// not tracked. Values are remembered once Redis accepted them.
+		virtual double changeSinceWritten() const { return std::numeric_limits<double>::infinity(); }
+		virtual void rememberValue() {}
+		virtual void forgetValue() {}
+	};
+
+	template<typename T> struct NumberWriteEntry;
+	struct StringWriteEntry;
+	template<typename MatrixType> struct EigenWriteEntry;
+	template<typename MatrixType> struct EigenJSONWriteEntry;
+	template<typename MatrixType> struct EigenBinaryWriteEntry;
+
+	struct WritePlan
+	{
+		std::vector<std::unique_ptr<WriteEntry>> entries;
+		std::vector<WriteEntry *> sent;  // entries written by the last execution
+		std::string buffer;                    // RESP commands of one execution
+		std::string scratch;                   // text value of one entry
+		int expiry_ms = 0;                     // PX of every SET, 0 for none
+
+		// Deadband thresholds for keys added later, and write statistics
+		double position_deadband = 0;
+		double orientation_deadband = 0;
+		std::chrono::milliseconds refresh{1000};  // longest time a key is skipped, 0 for no limit
+		bool deadband = false;                    // some entry has a deadband
+		uint64_t written = 0;
+		uint64_t suppressed = 0;
+
+		// Decimals of text values for keys added later
+		int position_precision = -1;
+		int orientation_precision = -1;
+
+		RedisTimingStats timing;
+	};
+
+	std::map<int, WritePlan> _write_plans;
+
+	WritePlan& findWritePlan(const int callback_number, const char *caller);
+	void addToWritePlan(const int callback_number, const char *caller, std::unique_ptr<WriteEntry> entry);
+
+	// Serialize the SET commands / alternating keys and values of a plan. The
+	// SET commands are timed as encoding of the plan.
+	void appendWritePlanCommands(WritePlan& plan, std::string& buffer, std::vector<WriteEntry *>& sent);
+	size_t appendWritePlanKeyValues(WritePlan& plan, std::string& buffer);
+
+	// Serialize the SET commands of several plans into _batch_sent and _batch_plans
+	void appendBatchCommands(const std::vector<int>& callback_numbers, std::string& out, const char *caller);
+
+	// Send serialized SET commands of the plans in _batch_plans, followed by
+	// num_commands other commands, and check their replies
+	void sendWriteCommands(const std::string& buffer, const std::vector<WriteEntry *>& sent, const size_t num_commands=0);
+
+	// Let the deadband of the entries in sent, of the plans in _batch_plans, compare with the
+	// values just written; forget all written values after a deferred write failed
+	void rememberSentValues(const std::vector<WriteEntry *>& sent);
+	void forgetWrittenValues();
+
+	// Serialize MULTI, the SET commands of several plans into _batch_sent,
+	// INCR seq_key, SET timestamp_key timestamp and EXEC
+	void appendAtomicWriteCommands(const std::vector<int>& callback_numbers, const std::string& seq_key,
+	                               const std::string& timestamp_key, const uint64_t timestamp,
+	                               std::string& out, const char *caller);
+
+	// Serialize the PUBLISH command for _batch_buffer, holding num_pairs keys and values
+	void appendPublishCommand(std::string& out, const std::string& channel, const size_t num_pairs);
+
+	// PUBLISH _batch_buffer, holding num_pairs keys and values, as one message
+	int sendPublishMessage(const std::string& channel, const size_t num_pairs);
+
+	// Buffers of commands spanning several plans
+	std::string _batch_buffer;
+	std::vector<WriteEntry *> _batch_sent;
+	std::vector<std::pair<WritePlan *, size_t>> _batch_plans;  // plans in _batch_sent and their number of commands
+	std::string _first_reply_error;
+	std::string _publish_message;
+	std::string _publish_command;
+
+	/**
+	 * Raw socket path used by executeWriteCallback() and executeReadCallback().
+	 *
+	 * Plans are written directly to the connection socket and their replies
+	 * are parsed in place in _raw_reply_buffer instead of going through
+	 * hiredis reply objects. Both share the socket, so every hiredis call
+	 * goes through useHiredis() and every raw write through useRawSocket(),
+	 * which throw if the other side may still hold replies. Only the public
+	 * fd and err fields of the hiredis context are used, so the raw path does
+	 * not depend on the internal layout of a hiredis version.
+	 */
+	std::string _raw_reply_buffer;
+	size_t _raw_reply_begin = 0;
+	std::string _raw_reply_error;
+	long long _raw_reply_integer = 0;  // last integer reply
+	uint64_t _raw_bytes_parsed = 0;    // bytes of all replies parsed so far
+
+	// Waits for the replies of deferred writes first, so the next replies read are those of data
+	void writeRaw(const char *data, const size_t len);
+	void sendRaw(const char *data, const size_t len);
+	const char *nextRawReply(size_t& reply_len, const char *&error);
+	size_t readRawReplies(const size_t count);
+
+	/**
+	 * Deferred replies, see setDeferredReplies(). Replies of deferred writes
+	 * stay in the socket until a later call reads them: deferred writes only
+	 * take the ones that already arrived, every other command first waits for
+	 * all of them, since Redis replies in order.
+	 */
+	bool _deferred_replies = false;
+	size_t _max_pending_replies = 0;
+	size_t _pending_replies = 0;
+	uint64_t _deferred_errors = 0;
+	std::string _last_deferred_error;
+	std::function<void(const std::string&)> _deferred_error_callback;
+
+	// Write commands without waiting for their count replies
+	void writeDeferred(const char *data, const size_t len, const size_t count);
+	// Consume the replies already received, and wait for more while over max_pending are outstanding
+	void readDeferredReplies(const size_t max_pending);
+	void finishDeferredReplies() {
+		if(_pending_replies > 0) readDeferredReplies(0);
+	}
+	void receiveAvailable();
+	bool rawReplyBuffered() const;
+
+	// Wait for deferred replies and check that _raw_reply_buffer is consumed, before a hiredis call
+	void useHiredis();
+	// Check that hiredis holds no replies, before a raw socket write
+	void useRawSocket();
+	bool _subscribed = false;  // hiredis receives messages from SUBSCRIBE on
+
+	// Timing of pipeset() / pipesetBinary() and pipeget(), and self-publishing of all timing
+	RedisTimingStats _pipeset_timing;
+	RedisTimingStats _pipeget_timing;
+	std::string _timing_key_prefix;
+	std::chrono::milliseconds _timing_interval{0};
+	std::chrono::steady_clock::time_point _timing_due;
+
+	// Send the SET commands in _batch_buffer as a pipeline, timed in _pipeset_timing. Used by
+	// pipesetBinary(), and by pipeset() with deferred replies.
+	size_t sendPipelineSets(const size_t count, const std::chrono::steady_clock::time_point& encode_start);
+	void publishTimingStatsIfDue();
+	static void appendTimingStatsJSON(std::string& out, const RedisTimingStats& stats);
+
+	static void appendDecimal(std::string& out, const size_t value);
+	// Shortest round-trip digits, or precision fixed decimals if >= 0. Integers of any width are
+	// written in full, so matrices of every scalar type can share the encoders.
+	static void appendNumber(std::string& out, const double value, const int precision=-1);
+	static void appendNumber(std::string& out, const float value, const int precision=-1);
+	template<typename Integer, typename = std::enable_if_t<std::is_integral_v<Integer>>>
+	static void appendNumber(std::string& out, const Integer value, const int /*precision*/=-1) {
+		char buf[24];
+		auto result = std::to_chars(buf, buf + sizeof(buf), value);
+		out.append(buf, result.ptr - buf);
+	}
+	static void appendBulkString(std::string& out, const char *data, const size_t len);
+
+	template<typename Derived>
+	static void appendEigenMatrixJSON(std::string& s, const Eigen::MatrixBase<Derived>& matrix, const int precision=-1);
+	template<typename Derived>
+	static void appendEigenMatrixString(std::string& s, const Eigen::MatrixBase<Derived>& matrix, const int precision=-1);
 
 public:
+	/**
+	 * Wire encoding of Eigen objects in read and write callbacks.
+	 *
+	 * EIGEN_JSON:   "[1,2,3]" text, readable by any client (default).
+	 * EIGEN_BINARY: RedisEigenBinary header followed by the raw coefficients.
+	 *               Avoids text formatting and parsing on both ends.
+	 */
+	enum RedisEigenEncoding
+	{
+		EIGEN_JSON,
+		EIGEN_BINARY,
+	};
+
 	std::unique_ptr<redisContext, redisContextDeleter> context_;
 
 	/**
@@ -109,6 +501,18 @@ public:
  	 */
 	std::unique_ptr<redisReply, redisReplyDeleter> command(const char *format, ...);
 
+	/**
+	 * Issue a binary-safe command to Redis, e.g. commandArgv({"SET", key, value}).
+	 *
+	 * Wrapper around hiredis::redisCommandArgv() with precomputed argument
+	 * lengths: no format string is parsed and arguments may contain spaces
+	 * or NUL characters.
+	 *
+	 * @param args  Command name and arguments (at most 16).
+	 * @return      redisReply pointer.
+	 */
+	std::unique_ptr<redisReply, redisReplyDeleter> commandArgv(std::initializer_list<std::string_view> args);
+
 	/**
  	 * Perform Redis command: PING.
  	 *
@@ -176,6 +580,23 @@ public:
 	 */
 	void pipeset(const std::vector<std::pair<std::string, std::string>>& keyvals);
 
+	/**
+	 * Perform Redis SET commands in bulk, like pipeset(), from views of keys
+	 * and binary values.
+	 *
+	 * The commands are serialized into a reused buffer and written directly
+	 * to the connection, so after warm-up this does not allocate. The viewed
+	 * data only needs to stay valid during the call.
+	 *
+	 * @param keyvals  Key-value pairs to set in Redis.
+	 * @param count    Number of pairs.
+	 */
+	void pipesetBinary(const std::pair<std::string_view, std::string_view> *keyvals, const size_t count);
+
+	void pipesetBinary(const std::vector<std::pair<std::string_view, std::string_view>>& keyvals) {
+		pipesetBinary(keyvals.data(), keyvals.size());
+	}
+
 	/**
 	 * Perform Redis command: MGET key1 key2...
 	 *
@@ -197,6 +618,101 @@ public:
 	 */
 	void mset(const std::vector<std::pair<std::string, std::string>>& keyvals);
 
+	/**
+	 * Entry of a Redis stream: id ("<ms>-<seq>") and field-value pairs.
+	 */
+	struct StreamEntry {
+		std::string id;
+		std::vector<std::pair<std::string, std::string>> fields;
+	};
+
+	/**
+	 * Perform Redis command: XADD key [MAXLEN ~ max_length] * field1 val1...
+	 *
+	 * Appends an entry with an auto-generated id. Values are binary safe. If
+	 * max_length is nonzero, the stream is trimmed to approximately that many
+	 * entries, which lets Redis trim whole macro nodes cheaply. See:
+	 * https://redis.io/commands/xadd
+	 *
+	 * @param key         Key of the stream.
+	 * @param fields      Field-value pairs of the new entry.
+	 * @param max_length  Approximate retention of the stream (0 for unbounded).
+	 * @return            Id of the new entry.
+	 */
+	std::string xadd(const std::string& key, const std::vector<std::pair<std::string, std::string>>& fields,
+	                 const size_t max_length = 0);
+
+	/**
+	 * Perform Redis command: XRANGE key start end [COUNT count]
+	 *
+	 * Reads the entries with ids in [start, end] in order. See:
+	 * https://redis.io/commands/xrange
+	 *
+	 * @param key    Key of the stream.
+	 * @param start  First id ("-" for the oldest entry).
+	 * @param end    Last id ("+" for the newest entry).
+	 * @param count  Maximum number of entries to return (0 for all).
+	 * @return       Entries in the range. Optimized with RVO.
+	 */
+	std::vector<StreamEntry> xrange(const std::string& key, const std::string& start = "-",
+	                                const std::string& end = "+", const size_t count = 0);
+
+	/**
+	 * Perform Redis command: XREAD [COUNT count] [BLOCK block_ms] STREAMS key last_id
+	 *
+	 * Reads the entries with ids greater than last_id. With block_ms >= 0,
+	 * waits up to block_ms milliseconds (0 waits forever) for new entries.
+	 * See: https://redis.io/commands/xread
+	 *
+	 * @param key       Key of the stream.
+	 * @param last_id   Id after which to read ("$" for entries added from now on).
+	 * @param count     Maximum number of entries to return (0 for all).
+	 * @param block_ms  Milliseconds to block, or -1 to return immediately.
+	 * @return          New entries; empty if none arrived in time.
+	 */
+	std::vector<StreamEntry> xread(const std::string& key, const std::string& last_id,
+	                               const size_t count = 0, const int block_ms = -1);
+
+	/**
+	 * Returns the smallest stream id greater than the given one, e.g. to
+	 * continue an XRANGE after the last entry of the previous batch.
+	 */
+	static std::string nextStreamId(const std::string& id);
+
+	/**
+	 * Perform Redis command: PUBLISH channel message
+	 *
+	 * The message is binary safe. See:
+	 * https://redis.io/commands/publish
+	 *
+	 * @param channel  Channel to publish to.
+	 * @param message  Message to publish.
+	 * @return         Number of subscribers that received the message.
+	 */
+	int publish(const std::string& channel, const std::string& message);
+
+	/**
+	 * Perform Redis command: SUBSCRIBE channel
+	 *
+	 * After subscribing, the connection is dedicated to receiving messages:
+	 * only receive() and receiveReadCallback() may be used on this client.
+	 * Use a separate RedisClient for other commands. See:
+	 * https://redis.io/commands/subscribe
+	 *
+	 * @param channel  Channel to subscribe to.
+	 */
+	void subscribe(const std::string& channel);
+
+	/**
+	 * Block until a message arrives on a subscribed channel.
+	 *
+	 * Throws if the connection fails or the connect() timeout expires.
+	 *
+	 * @param channel  Set to the channel of the message.
+	 * @param message  Set to the message.
+	 */
+	void receive(std::string& channel, std::string& message);
+
 
 	void createReadCallback(const int callback_number);
 	void createWriteCallback(const int callback_number);
@@ -205,18 +721,339 @@ public:
 	void addStringToReadCallback(const int callback_number, const std::string& key, std::string &object);
 	void addIntToReadCallback(const int callback_number, const std::string& key, int &object);
 
+	/**
+	 * Fixed-size objects only accept values of their own shape. Dynamic-size
+	 * objects are resized when a value of another shape arrives, which
+	 * allocates; values of the current shape are decoded in place.
+	 */
 	template<typename _Scalar, int _Rows, int _Cols, int _Options, int _MaxRows, int _MaxCols>
-	void addEigenToReadCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object);
+	void addEigenToReadCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object,
+	                            const RedisEigenEncoding encoding = EIGEN_JSON);
 
 	void addDoubleToWriteCallback(const int callback_number, const std::string& key, double &object);
 	void addStringToWriteCallback(const int callback_number, const std::string& key, std::string &object);
 	void addIntToWriteCallback(const int callback_number, const std::string& key, int &object);
 	template<typename _Scalar, int _Rows, int _Cols, int _Options, int _MaxRows, int _MaxCols>
-	void addEigenToWriteCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object);
+	void addEigenToWriteCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object,
+	                             const RedisEigenEncoding encoding = EIGEN_JSON);
+
+	/**
+	 * Read all keys of a read callback with one pipelined batch of GETs and
+	 * decode each value in place from the reply into its registered object.
+	 *
+	 * Numbers and JSON matrices are parsed with std::from_chars, and Eigen
+	 * values must have exactly the shape of the registered object. All
+	 * replies are consumed before an error is thrown, so the connection stays
+	 * usable; objects of keys after a failed one are still updated.
+	 *
+	 * With enableKeyspaceNotifications(), only the keys written, deleted or
+	 * expired since the last execution are read, and nothing is sent if no
+	 * key changed.
+	 *
+	 * @return  Number of keys read.
+	 */
+	size_t executeReadCallback(const int callback_number);
+
+	/**
+	 * Let executeReadCallback() only read the keys that changed, instead of
+	 * polling every key.
+	 *
+	 * Opens a second connection to the server of connect() that subscribes to
+	 * the keyspace notifications of the keys matching key_pattern (PSUBSCRIBE
+	 * __keyspace@<db>__:<key_pattern>, e.g. with the pattern "kinect::*").
+	 * executeReadCallback() takes the pending notifications off it without
+	 * waiting and marks their keys as changed. All keys count as changed
+	 * when notifications are enabled, so the next execution reads them all.
+	 * Registered keys that do not match key_pattern are never read again.
+	 *
+	 * The server only sends notifications if notify-keyspace-events includes
+	 * K and the string, generic and expired classes ($, g and x, or A). The
+	 * setting is only read: if flags are missing, or CONFIG is disabled as on
+	 * many managed servers, a warning is printed and executeReadCallback()
+	 * keeps reading every key. With configure_server, the missing flags are
+	 * added with CONFIG SET instead, which changes the server for all its
+	 * clients and stays set; if that fails, the same fallback applies.
+	 *
+	 * If the notification connection fails, a warning is printed and
+	 * executeReadCallback() reads every key, like without notifications,
+	 * while it tries to reconnect once per second. The main connection is
+	 * not affected. executeReadCallbackConsistent() always reads every key.
+	 *
+	 * @param key_pattern       Glob pattern of the keys to watch.
+	 * @param db                Database of the keys (default 0).
+	 * @param configure_server  Add missing notify-keyspace-events flags (default false).
+	 * @return                  Whether notifications are enabled.
+	 */
+	bool enableKeyspaceNotifications(const std::string& key_pattern, const int db=0, const bool configure_server=false);
 
-	void executeReadCallback(const int callback_number);
+	/**
+	 * Close the notification connection, so executeReadCallback() reads every key again.
+	 */
+	void disableKeyspaceNotifications();
+
+	// Whether executeReadCallback() only reads the keys that changed
+	bool keyspaceNotificationsEnabled() const { return _notify_context != nullptr; }
+
+	/**
+	 * Do not wait for the replies of writes that nobody uses: with deferred
+	 * replies, pipeset(), pipesetBinary(), executeWriteCallback() and
+	 * executeWriteCallbacks() return as soon as their commands are written to
+	 * the socket, so a frame costs the write instead of a round trip.
+	 *
+	 * The replies are consumed later: every deferred write first takes the
+	 * replies that already arrived without blocking, and every other command
+	 * waits for all of them before it is sent. If more than max_pending
+	 * replies are outstanding, a deferred write waits until that is no longer
+	 * the case, which bounds the commands Redis holds for a slow client.
+	 *
+	 * Failed writes cannot throw from the call that sent them. They are
+	 * counted in deferredErrorCount() and passed to the error callback when
+	 * their reply is read. Transactions, PUBLISH and reads stay synchronous.
+	 * Turning deferred replies off waits for the pending ones.
+	 */
+	void setDeferredReplies(const bool enabled, const size_t max_pending=4096);
+	bool deferredReplies() const { return _deferred_replies; }
+
+	/**
+	 * Called with the error message of every failed deferred write, on the
+	 * thread that reads its reply.
+	 */
+	void setDeferredErrorCallback(std::function<void(const std::string&)> callback) {
+		_deferred_error_callback = std::move(callback);
+	}
+
+	// Wait until Redis replied to all deferred writes, e.g. before reading deferredErrorCount()
+	void waitForDeferredReplies() { finishDeferredReplies(); }
+
+	size_t pendingReplyCount() const { return _pending_replies; }
+	uint64_t deferredErrorCount() const { return _deferred_errors; }
+	const std::string& lastDeferredError() const { return _last_deferred_error; }
+
+	/**
+	 * Read a read callback as one consistent frame written by
+	 * executeWriteCallbacksAtomic().
+	 *
+	 * The GETs are pipelined between two GETs of seq_key, in one round trip.
+	 * If the sequence numbers differ, a frame was written while the keys were
+	 * read and the read is repeated, up to max_attempts times. Keys written
+	 * without executeWriteCallbacksAtomic() do not advance the sequence, so
+	 * their changes are not detected.
+	 *
+	 * @param callback_number  Read callback to execute.
+	 * @param seq_key          Sequence key of the writer, e.g. kinect::frame_seq.
+	 * @param max_attempts     Reads before giving up (default 3).
+	 * @return                 Sequence number of the frame read, 0 if none was written yet.
+	 * @throws                 If every attempt overlapped a write; the objects
+	 *                         then hold the values of the last attempt.
+	 */
+	uint64_t executeReadCallbackConsistent(const int callback_number, const std::string& seq_key, const int max_attempts=3);
+
+	/**
+	 * Write all keys of a write callback with one pipelined batch of SETs.
+	 *
+	 * The callback is compiled into a write plan when keys are registered;
+	 * after the first few executions this performs no heap allocations.
+	 */
 	void executeWriteCallback(const int callback_number);
 
+	/**
+	 * Write all keys of several write callbacks with one pipelined batch, so
+	 * the cost grows with the payload rather than with round trips. Does not
+	 * allocate after warm-up if the same vector is reused.
+	 */
+	void executeWriteCallbacks(const std::vector<int>& callback_numbers);
+
+	/**
+	 * Like executeWriteCallbacks(), with further commands in the same
+	 * pipelined batch after the SETs, e.g. PUBLISH or XADD commands formatted
+	 * with formatPublishWriteCallbacks() or RedisAsyncClient::appendCommandArgv().
+	 * Their replies are only checked for errors.
+	 *
+	 * @param commands      RESP commands to send after the SETs.
+	 * @param num_commands  Number of commands in commands.
+	 */
+	void executeWriteCallbacks(const std::vector<int>& callback_numbers, const std::string& commands, const size_t num_commands);
+
+	/**
+	 * Write all keys of several write callbacks as one MULTI/EXEC transaction
+	 * in one round trip, so readers never see keys of two different frames.
+	 *
+	 * The transaction also increments seq_key with INCR and sets
+	 * timestamp_key to timestamp, so readers can tell frames apart and detect
+	 * a read that overlapped a write, see executeReadCallbackConsistent().
+	 * Since the sequence is kept by Redis, it keeps increasing across
+	 * restarts of the writer. Does not allocate after warm-up.
+	 *
+	 * @param callback_numbers  Write callbacks of the frame.
+	 * @param seq_key           Frame sequence key, e.g. kinect::frame_seq.
+	 * @param timestamp_key     Frame timestamp key.
+	 * @param timestamp         Timestamp of the frame, e.g. in microseconds.
+	 * @return                  Sequence number of the frame.
+	 */
+	uint64_t executeWriteCallbacksAtomic(const std::vector<int>& callback_numbers, const std::string& seq_key,
+	                                     const std::string& timestamp_key, const uint64_t timestamp);
+
+	/**
+	 * Like executeWriteCallbacksAtomic(), with further commands in the same
+	 * round trip after EXEC, outside of the transaction. See
+	 * executeWriteCallbacks(callback_numbers, commands, num_commands).
+	 */
+	uint64_t executeWriteCallbacksAtomic(const std::vector<int>& callback_numbers, const std::string& seq_key,
+	                                     const std::string& timestamp_key, const uint64_t timestamp,
+	                                     const std::string& commands, const size_t num_commands);
+
+	/**
+	 * Let every key written by a write callback expire after the given time
+	 * (SET key value PX milliseconds), so keys that stop being written are
+	 * removed by Redis. Pass 0 to disable expiry.
+	 */
+	void setWriteCallbackExpiry(const int callback_number, const int milliseconds);
+
+	/**
+	 * Only write the keys of a write callback whose value moved, to save
+	 * network and Redis CPU while the values stand still.
+	 *
+	 * A key is skipped while none of its coefficients changed by more than
+	 * its threshold since it was last written. Eigen 3-vectors use
+	 * position_threshold, all other Eigen values (rotation matrices,
+	 * quaternions) orientation_threshold; for a rotation matrix the largest
+	 * coefficient change is about the rotation angle in radians. Every key is
+	 * still written at least every refresh_ms, so readers see it updated and
+	 * an expiry set with setWriteCallbackExpiry() does not run out; keep
+	 * refresh_ms below the expiry. A threshold of 0 writes on every
+	 * execution. Keys added later get the same thresholds.
+	 *
+	 * A value counts as written once Redis replied OK to it, so after a
+	 * failed write the key is written again. With deferred replies, a value
+	 * counts as written when it is sent, and any failed deferred write makes
+	 * every key count as not written. formatWriteCallbacks() leaves sending
+	 * to the caller, so its values count as written when formatted.
+	 *
+	 * Only SET commands are affected: publishWriteCallback() always sends
+	 * every key, so subscribers receive whole frames.
+	 */
+	void setWriteCallbackDeadband(const int callback_number, const double position_threshold,
+	                              const double orientation_threshold, const int refresh_ms=1000);
+
+	/**
+	 * Write the JSON values of a write callback with a fixed number of
+	 * decimals instead of the shortest lossless digits, e.g. 1 decimal for
+	 * positions in millimetres, where further digits are sensor noise.
+	 * Eigen 3-vectors use position_digits, all other Eigen values
+	 * orientation_digits. Pass -1 to keep values lossless. Keys added later
+	 * get the same precision. Binary values are not affected.
+	 */
+	void setWriteCallbackPrecision(const int callback_number, const int position_digits, const int orientation_digits=-1);
+
+	/**
+	 * Set the deadband of one key of a write callback, e.g. of a double or int
+	 * key, which setWriteCallbackDeadband() leaves alone.
+	 */
+	void setWriteKeyDeadband(const int callback_number, const std::string& key, const double threshold);
+
+	/**
+	 * Keys written by a write callback, and keys skipped by its deadband.
+	 */
+	struct WriteCallbackStats
+	{
+		uint64_t written = 0;
+		uint64_t suppressed = 0;
+	};
+	WriteCallbackStats writeCallbackStats(const int callback_number);
+
+	/**
+	 * Remove a write callback, e.g. to register it again with other keys.
+	 */
+	void removeWriteCallback(const int callback_number);
+
+	/**
+	 * Timing of a write callback: encoding of its SET commands by every
+	 * execute and format call, and the round trip until Redis acknowledged
+	 * them. Callbacks executed together in one batch each record the time
+	 * until their own replies arrived; in executeWriteCallbacksAtomic() they
+	 * record the round trip of the whole transaction and no received bytes.
+	 */
+	const RedisTimingStats& writeCallbackTiming(const int callback_number);
+
+	/**
+	 * Timing of a read callback: the round trip of executeReadCallback() or
+	 * executeReadCallbackConsistent(), including decoding of the values.
+	 */
+	const RedisTimingStats& readCallbackTiming(const int callback_number);
+
+	// Timing of pipeset() and pipesetBinary(), and of pipeget()
+	const RedisTimingStats& pipesetTiming() const { return _pipeset_timing; }
+	const RedisTimingStats& pipegetTiming() const { return _pipeget_timing; }
+
+	/**
+	 * Clear the timing of all callbacks and pipelines, e.g. to start a new
+	 * measurement interval.
+	 */
+	void resetTiming();
+
+	/**
+	 * SET the timing of all callbacks and pipelines as JSON values under
+	 * key_prefix: <prefix>write::<n>, <prefix>read::<n>, <prefix>pipeset and
+	 * <prefix>pipeget, e.g.
+	 *   {"calls":100,"bytes_sent":285000,"bytes_received":32000,
+	 *    "encode_us":{"mean":6.1,"p50":5.9,"p99":9.8,"max":21.4},
+	 *    "round_trip_us":{...}}
+	 * The SETs are not recorded in the timing themselves.
+	 */
+	void publishTimingStats(const std::string& key_prefix);
+
+	/**
+	 * Publish the timing with publishTimingStats() every interval_ms, from
+	 * the write callback executions after the interval has passed, so no
+	 * thread is needed. Pass 0 to stop publishing.
+	 */
+	void setTimingStatsPublishing(const std::string& key_prefix, const int interval_ms);
+
+	static std::string encodeTimingStatsJSON(const RedisTimingStats& stats);
+
+	/**
+	 * PUBLISH all keys of a write callback as one message on a channel.
+	 *
+	 * The message is a RESP array of alternating keys and values, encoded the
+	 * same way executeWriteCallback() would SET them, so subscribers can decode
+	 * it with receiveReadCallback(). Like executeWriteCallback(), this does not
+	 * allocate once the plan buffers have grown to their working size.
+	 *
+	 * @return  Number of subscribers that received the message.
+	 */
+	int publishWriteCallback(const int callback_number, const std::string& channel);
+
+	/**
+	 * PUBLISH all keys of several write callbacks as one message on a channel.
+	 * See publishWriteCallback().
+	 */
+	int publishWriteCallbacks(const std::vector<int>& callback_numbers, const std::string& channel);
+
+	/**
+	 * Append the RESP commands that executeWriteCallbacks(),
+	 * executeWriteCallbacksAtomic() and publishWriteCallbacks() would send to out, without sending them, e.g.
+	 * to hand them to a RedisAsyncClient. The write callbacks do not need a
+	 * connection for this.
+	 *
+	 * @return  Number of commands appended.
+	 */
+	size_t formatWriteCallbacks(const std::vector<int>& callback_numbers, std::string& out);
+	size_t formatWriteCallbacksAtomic(const std::vector<int>& callback_numbers, const std::string& seq_key,
+	                                  const std::string& timestamp_key, const uint64_t timestamp, std::string& out);
+	size_t formatPublishWriteCallbacks(const std::vector<int>& callback_numbers, const std::string& channel, std::string& out);
+
+	/**
+	 * Block until a message published by publishWriteCallback() arrives on a
+	 * subscribed channel, and decode it into the objects of a read callback.
+	 *
+	 * Keys of the message that are not registered in the read callback are
+	 * ignored, and objects of keys missing from the message keep their value.
+	 * Throws if the message is not a key-value message.
+	 *
+	 * @return  Channel of the message.
+	 */
+	std::string receiveReadCallback(const int callback_number);
+
 	/**
  	 * Encode Eigen::MatrixXd as JSON or space-delimited string.
 	 *
@@ -231,14 +1068,20 @@ public:
 	 * encodeEigenMatrix():
 	 *   Encodes JSON or space-delimited string depending on JSON_DEFAULT.
 	 *
-	 * @param matrix  Eigen::MatrixXd to encode.
-	 * @return        Encoded string.
+	 * Coefficients are written with the shortest digits that parse back to
+	 * the same value (e.g. "0.1", "1e-07"), independent of the locale. With
+	 * precision >= 0 they are written with that many decimals instead, e.g.
+	 * 1 for positions in millimetres, which shortens the text but is lossy.
+	 *
+	 * @param matrix     Eigen::MatrixXd to encode.
+	 * @param precision  Fixed number of decimals, or -1 for lossless.
+	 * @return           Encoded string.
 	 */
 	template<typename Derived>
-	static std::string encodeEigenMatrixJSON(const Eigen::MatrixBase<Derived>& matrix);
+	static std::string encodeEigenMatrixJSON(const Eigen::MatrixBase<Derived>& matrix, const int precision=-1);
 
 	template<typename Derived>
-	static std::string encodeEigenMatrixString(const Eigen::MatrixBase<Derived>& matrix);
+	static std::string encodeEigenMatrixString(const Eigen::MatrixBase<Derived>& matrix, const int precision=-1);
 
 	template<typename Derived>
 	static std::string encodeEigenMatrix(const Eigen::MatrixBase<Derived>& matrix) {
@@ -249,6 +1092,38 @@ public:
 #endif  // JSON_DEFAULT
 	}
 
+	/**
+	 * Encode Eigen matrix in the RedisEigenBinary format.
+	 *
+	 * The scalar type of the matrix is kept on the wire (float, double or
+	 * int32_t), so the encoded size is 12 + rows * cols * sizeof(Scalar).
+	 *
+	 * @param matrix  Eigen matrix to encode.
+	 * @return        Encoded byte string (may contain NUL characters).
+	 */
+	template<typename Derived>
+	static std::string encodeEigenMatrixBinary(const Eigen::MatrixBase<Derived>& matrix);
+
+	/**
+	 * Decode Eigen matrix from the RedisEigenBinary format.
+	 *
+	 * The first overload decodes into a matrix that must already have the
+	 * encoded shape; coefficients are converted to its scalar type. The
+	 * second overload returns a Eigen::MatrixXd of the encoded shape.
+	 *
+	 * @param str     Encoded byte string.
+	 * @param matrix  Destination matrix.
+	 */
+	template<typename Derived>
+	static void decodeEigenMatrixBinary(const std::string& str, Eigen::MatrixBase<Derived>& matrix) {
+		decodeEigenMatrixBinary(str.data(), str.size(), matrix);
+	}
+
+	template<typename Derived>
+	static void decodeEigenMatrixBinary(const char *data, const size_t len, Eigen::MatrixBase<Derived>& matrix);
+
+	static Eigen::MatrixXd decodeEigenMatrixBinary(const std::string& str);
+
 	/**
  	 * Decode Eigen::MatrixXd from JSON or space-delimited string.
 	 *
@@ -261,7 +1136,7 @@ public:
 	 *   "1 2; 3 4" => [[1,2],[3,4]]
 	 *
 	 * decodeEigenMatrix():
-	 *   Decodes both JSON and space-delimited strings.
+	 *   Decodes JSON, space-delimited and binary strings.
 	 *
 	 * @param str  String to decode.
 	 * @return     Decoded Eigen::Matrix. Optimized with RVO.
@@ -271,6 +1146,7 @@ public:
 	static Eigen::MatrixXd decodeEigenMatrixString(const std::string& str);
 
 	static Eigen::MatrixXd decodeEigenMatrix(const std::string& str) {
+		if (RedisEigenBinary::isEncoded(str)) return decodeEigenMatrixBinary(str);
 		return (str[0] == '[') ? decodeEigenMatrixJSON(str) : decodeEigenMatrixString(str);
 	}
 
@@ -291,6 +1167,10 @@ public:
 		return decodeEigenMatrixString(get(key));
 	}
 
+	inline Eigen::MatrixXd getEigenMatrixBinary(const std::string& key) {
+		return decodeEigenMatrixBinary(get(key));
+	}
+
 	inline Eigen::MatrixXd getEigenMatrix(const std::string& key) {
 		return decodeEigenMatrix(get(key));
 	}
@@ -314,6 +1194,11 @@ public:
 		set(key, encodeEigenMatrixString(value));
 	}
 
+	template<typename Derived>
+	inline void setEigenMatrixBinary(const std::string& key, const Eigen::MatrixBase<Derived>& value) {
+		set(key, encodeEigenMatrixBinary(value));
+	}
+
 	template<typename Derived>
 	inline void setEigenMatrix(const std::string& key, const Eigen::MatrixBase<Derived>& value) {
 		set(key, encodeEigenMatrix(value));
@@ -351,9 +1236,8 @@ public:
 
 	// set expiry (ms) on an existing db key
 	void keyExpiryIs(const std::string& key, const uint expiry_ms) {
-		reply_ = (redisReply *)redisCommand(context_.get(), "PEXPIRE %s %s", key.c_str(), std::to_string(expiry_ms).c_str());
+		commandArgv({"PEXPIRE", key, std::to_string(expiry_ms)});
 		// NOTE: write commands dont check for write errors.
-		freeReplyObject((void*)reply_);
 	}
 
 	// get command, without return string. for internal use primarily.
@@ -380,9 +1264,8 @@ public:
 	}
 
 	void setCommandIs(const std::string &cmd_mssg, const std::string &data_mssg) {
-		reply_ = (redisReply *)redisCommand(context_.get(), "SET %s %s", cmd_mssg.c_str(), data_mssg.c_str());
+		commandArgv({"SET", cmd_mssg, data_mssg});
 		// NOTE: set commands dont check for write errors.
-      	freeReplyObject((void*)reply_);
 	}
 
 	// write raw eigen vector
@@ -443,13 +1326,13 @@ public:
 
 //Implementation must be part of header for compile time template specialization
 template<typename Derived>
-std::string RedisClient::encodeEigenMatrixJSON(const Eigen::MatrixBase<Derived>& matrix) {
-	std::string s = "[";
+void RedisClient::appendEigenMatrixJSON(std::string& s, const Eigen::MatrixBase<Derived>& matrix, const int precision) {
+	s.append("[");
 	if (matrix.cols() == 1) { // Column vector
 		// [[1],[2],[3],[4]] => "[1,2,3,4]"
 		for (int i = 0; i < matrix.rows(); ++i) {
 			if (i > 0) s.append(",");
-			s.append(std::to_string(matrix(i,0)));
+			appendNumber(s, matrix(i,0), precision);
 		}
 	} else { // Matrix
 		// [[1,2,3,4]]   => "[1,2,3,4]"
@@ -460,41 +1343,149 @@ std::string RedisClient::encodeEigenMatrixJSON(const Eigen::MatrixBase<Derived>&
 			if (matrix.rows() > 1) s.append("[");
 			for (int j = 0; j < matrix.cols(); ++j) {
 				if (j > 0) s.append(",");
-				s.append(std::to_string(matrix(i,j)));
+				appendNumber(s, matrix(i,j), precision);
 			}
 			// Nest arrays only if there are multiple rows
 			if (matrix.rows() > 1) s.append("]");
 		}
 	}
 	s.append("]");
-	return s;
 }
 
 template<typename Derived>
-std::string RedisClient::encodeEigenMatrixString(const Eigen::MatrixBase<Derived>& matrix) {
-	std::string s;
+void RedisClient::appendEigenMatrixString(std::string& s, const Eigen::MatrixBase<Derived>& matrix, const int precision) {
 	if (matrix.cols() == 1) { // Column vector
 		// [[1],[2],[3],[4]] => "1 2 3 4"
 		for (int i = 0; i < matrix.rows(); ++i) {
-			if (i > 0) s += " ";
-			s += std::to_string(matrix(i,0));
+			if (i > 0) s.append(" ");
+			appendNumber(s, matrix(i,0), precision);
 		}
 	} else { // Matrix
 		// [1,2,3,4]     => "1 2 3 4"
 		// [[1,2],[3,4]] => "1 2; 3 4"
 		for (int i = 0; i < matrix.rows(); ++i) {
-			if (i > 0) s += "; ";
+			if (i > 0) s.append("; ");
 			for (int j = 0; j < matrix.cols(); ++j) {
-				if (j > 0) s += " ";
-				s += std::to_string(matrix(i,j));
+				if (j > 0) s.append(" ");
+				appendNumber(s, matrix(i,j), precision);
 			}
 		}
 	}
+}
+
+template<typename Derived>
+std::string RedisClient::encodeEigenMatrixJSON(const Eigen::MatrixBase<Derived>& matrix, const int precision) {
+	std::string s;
+	s.reserve(matrix.size() * 24 + matrix.rows() + 2);
+	appendEigenMatrixJSON(s, matrix, precision);
+	return s;
+}
+
+template<typename Derived>
+std::string RedisClient::encodeEigenMatrixString(const Eigen::MatrixBase<Derived>& matrix, const int precision) {
+	std::string s;
+	s.reserve(matrix.size() * 24 + matrix.rows());
+	appendEigenMatrixString(s, matrix, precision);
 	return s;
 }
 
+template<typename Derived>
+std::string RedisClient::encodeEigenMatrixBinary(const Eigen::MatrixBase<Derived>& matrix) {
+	typedef typename Derived::Scalar Scalar;
+	std::string s(RedisEigenBinary::HEADER_SIZE + matrix.size() * sizeof(Scalar), '\0');
+	RedisEigenBinary::writeHeader(&s[0], RedisEigenBinary::ScalarTraits<Scalar>::type, matrix.rows(), matrix.cols());
+	char *payload = &s[RedisEigenBinary::HEADER_SIZE];
+	for (int j = 0; j < matrix.cols(); ++j) {
+		for (int i = 0; i < matrix.rows(); ++i) {
+			RedisEigenBinary::storeLittleEndian<Scalar>(payload, matrix(i,j));
+			payload += sizeof(Scalar);
+		}
+	}
+	return s;
+}
+
+template<typename Derived>
+void RedisClient::decodeEigenMatrixBinary(const char *data, const size_t len, Eigen::MatrixBase<Derived>& matrix) {
+	typedef typename Derived::Scalar Scalar;
+	RedisEigenBinary::ScalarType type;
+	uint32_t rows, cols;
+	if (!RedisEigenBinary::readHeader(data, len, type, rows, cols))
+		throw std::runtime_error("RedisClient: Failed to decode binary Eigen Matrix: invalid header or length.");
+	if (rows != static_cast<uint32_t>(matrix.rows()) || cols != static_cast<uint32_t>(matrix.cols()))
+		throw std::runtime_error("RedisClient: Failed to decode binary Eigen Matrix: expected " +
+		                         std::to_string(matrix.rows()) + "x" + std::to_string(matrix.cols()) + ", got " +
+		                         std::to_string(rows) + "x" + std::to_string(cols) + ".");
+
+	const size_t scalar_size = RedisEigenBinary::scalarSize(type);
+	const char *payload = data + RedisEigenBinary::HEADER_SIZE;
+	for (uint32_t j = 0; j < cols; ++j) {
+		for (uint32_t i = 0; i < rows; ++i) {
+			matrix(i,j) = RedisEigenBinary::loadCoefficient<Scalar>(payload, type);
+			payload += scalar_size;
+		}
+	}
+}
+
+template<typename MatrixType>
+struct RedisClient::EigenJSONReadEntry : public RedisClient::ReadEntry
+{
+	MatrixType& object;
+
+	explicit EigenJSONReadEntry(MatrixType& object) : object(object) {}
+
+	void decode(const char *data, const size_t len) override {
+		if (decodeEigenMatrixJSONInto(data, len, object.data(), static_cast<int>(object.rows()), static_cast<int>(object.cols()),
+		                              (MatrixType::Options & Eigen::RowMajor) != 0))
+			return;
+
+		// The value has another shape: dynamic dimensions take it on, fixed ones must match
+		typedef typename MatrixType::Scalar Scalar;
+		if constexpr (MatrixType::SizeAtCompileTime == Eigen::Dynamic) {
+			const Eigen::MatrixXd value = decodeEigenMatrixJSON(std::string(data, len));
+			if constexpr (MatrixType::IsVectorAtCompileTime) {
+				if (value.rows() == 1 || value.cols() == 1) {
+					object.resize(value.size());
+					for (Eigen::Index i = 0; i < value.size(); ++i) object(i) = static_cast<Scalar>(value(i));
+					return;
+				}
+			} else {
+				if ((MatrixType::RowsAtCompileTime == Eigen::Dynamic || value.rows() == MatrixType::RowsAtCompileTime) &&
+				    (MatrixType::ColsAtCompileTime == Eigen::Dynamic || value.cols() == MatrixType::ColsAtCompileTime)) {
+					object = value.cast<Scalar>();
+					return;
+				}
+			}
+		}
+		auto dimension = [](const int size) { return size == Eigen::Dynamic ? std::string("N") : std::to_string(size); };
+		throw std::runtime_error("RedisClient: Failed to decode " + dimension(MatrixType::RowsAtCompileTime) + "x" +
+		                         dimension(MatrixType::ColsAtCompileTime) + " Eigen Matrix from: " + std::string(data, len) + ".");
+	}
+};
+
+template<typename MatrixType>
+struct RedisClient::EigenBinaryReadEntry : public RedisClient::ReadEntry
+{
+	MatrixType& object;
+
+	explicit EigenBinaryReadEntry(MatrixType& object) : object(object) {}
+
+	void decode(const char *data, const size_t len) override {
+		// Dynamic dimensions take the shape of the value; fixed ones are checked by the decoder
+		if constexpr (MatrixType::SizeAtCompileTime == Eigen::Dynamic) {
+			RedisEigenBinary::ScalarType type;
+			uint32_t rows, cols;
+			if (RedisEigenBinary::readHeader(data, len, type, rows, cols) &&
+			    (MatrixType::RowsAtCompileTime == Eigen::Dynamic || rows == static_cast<uint32_t>(MatrixType::RowsAtCompileTime)) &&
+			    (MatrixType::ColsAtCompileTime == Eigen::Dynamic || cols == static_cast<uint32_t>(MatrixType::ColsAtCompileTime)))
+				object.resize(rows, cols);
+		}
+		decodeEigenMatrixBinary(data, len, object);
+	}
+};
+
 template<typename _Scalar, int _Rows, int _Cols, int _Options, int _MaxRows, int _MaxCols>
-void RedisClient::addEigenToReadCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object)
+void RedisClient::addEigenToReadCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object,
+                                         const RedisEigenEncoding encoding)
 {
 	int n = _read_callback_indexes.size();
 	int callback_index = 0;
@@ -513,35 +1504,121 @@ void RedisClient::addEigenToReadCallback(const int callback_number, const std::s
 		throw std::runtime_error("no read callback with this index in RedisClient::addEigenToReadCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object)\n");
 	}
 
-	_keys_to_read[callback_index].push_back(key);
-	_objects_to_read[callback_index].push_back(object.data());
-	_objects_to_read_types[callback_index].push_back(EIGEN_OBJECT);
+	typedef Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols > MatrixType;
+	if(encoding == EIGEN_BINARY)
+		addReadKey(callback_index, key, std::unique_ptr<ReadEntry>(new EigenBinaryReadEntry<MatrixType>(object)));
+	else
+		addReadKey(callback_index, key, std::unique_ptr<ReadEntry>(new EigenJSONReadEntry<MatrixType>(object)));
 }
 
-template<typename _Scalar, int _Rows, int _Cols, int _Options, int _MaxRows, int _MaxCols>
-void RedisClient::addEigenToWriteCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object)
+template<typename MatrixType>
+struct RedisClient::EigenWriteEntry : public RedisClient::WriteEntry
 {
-	int n = _write_callback_indexes.size();
-	int callback_index = 0;
-	bool found = false;
-	while(callback_index < n)
-	{
-		if(_write_callback_indexes[callback_index] == callback_number)
-		{
-			found = true;
-			break;
+	const MatrixType& object;
+	MatrixType last;  // value of the last write, for the deadband
+	bool has_last = false;
+
+	EigenWriteEntry(const std::string& key, const MatrixType& object)
+		: WriteEntry(key), object(object) {}
+
+	ValueKind valueKind() const override {
+		return (object.size() == 3 && (object.rows() == 1 || object.cols() == 1)) ? POSITION_VALUE : ORIENTATION_VALUE;
+	}
+
+	double changeSinceWritten() const override {
+		if (!has_last || last.rows() != object.rows() || last.cols() != object.cols())
+			return std::numeric_limits<double>::infinity();
+		double change = 0;
+		for (Eigen::Index i = 0; i < object.size(); ++i) {
+			change = std::max(change, std::abs(static_cast<double>(object.coeff(i)) - static_cast<double>(last.coeff(i))));
 		}
-		callback_index++;
+		return change;
 	}
-	if(!found)
+
+	void rememberValue() override {
+		last = object;
+		has_last = true;
+	}
+
+	void forgetValue() override {
+		has_last = false;
+	}
+};
+
+template<typename MatrixType>
+struct RedisClient::EigenJSONWriteEntry : public RedisClient::EigenWriteEntry<MatrixType>
+{
+	EigenJSONWriteEntry(const std::string& key, const MatrixType& object)
+		: EigenWriteEntry<MatrixType>(key, object) {}
+
+	bool appendValue(std::string& out, std::string& scratch) const override {
+		scratch.clear();
+		appendEigenMatrixJSON(scratch, this->object, this->precision);
+		appendBulkString(out, scratch.data(), scratch.size());
+		return true;
+	}
+};
+
+template<typename MatrixType>
+struct RedisClient::EigenBinaryWriteEntry : public RedisClient::EigenWriteEntry<MatrixType>
+{
+	typedef typename MatrixType::Scalar Scalar;
+	static const bool FIXED_SIZE = MatrixType::SizeAtCompileTime != Eigen::Dynamic;
+	static const bool COLUMN_MAJOR = MatrixType::IsVectorAtCompileTime || !(MatrixType::Flags & Eigen::RowMajorBit);
+
+	using EigenWriteEntry<MatrixType>::object;
+	std::string value_prefix;  // "$<len>\r\n" and binary header, fixed-size types only
+
+	EigenBinaryWriteEntry(const std::string& key, const MatrixType& object)
+		: EigenWriteEntry<MatrixType>(key, object)
 	{
-		throw std::runtime_error("no write callback with this index in RedisClient::addEigenToWriteCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object)\n");
+		if (FIXED_SIZE) appendValuePrefix(value_prefix);
+	}
+
+	void appendValuePrefix(std::string& out) const {
+		out.append("$");
+		appendDecimal(out, RedisEigenBinary::HEADER_SIZE + object.size() * sizeof(Scalar));
+		out.append("\r\n");
+		const size_t pos = out.size();
+		out.resize(pos + RedisEigenBinary::HEADER_SIZE);
+		RedisEigenBinary::writeHeader(&out[pos], RedisEigenBinary::ScalarTraits<Scalar>::type, object.rows(), object.cols());
 	}
 
-	_keys_to_write[callback_index].push_back(key);
-	_objects_to_write[callback_index].push_back(object.data());
-	_objects_to_write_types[callback_index].push_back(EIGEN_OBJECT);
-	_objects_to_write_sizes[callback_index].push_back(std::make_pair(object.rows(),object.cols()));
+	bool appendValue(std::string& out, std::string& /*scratch*/) const override {
+		if (FIXED_SIZE) out.append(value_prefix);
+		else appendValuePrefix(out);
+
+		const size_t payload_size = object.size() * sizeof(Scalar);
+		const size_t pos = out.size();
+		out.resize(pos + payload_size);
+		char *payload = &out[pos];
+		if (COLUMN_MAJOR && RedisEigenBinary::hostIsLittleEndian()) {
+			std::memcpy(payload, object.data(), payload_size);
+		} else {
+			for (int j = 0; j < object.cols(); ++j) {
+				for (int i = 0; i < object.rows(); ++i) {
+					RedisEigenBinary::storeLittleEndian<Scalar>(payload, object(i,j));
+					payload += sizeof(Scalar);
+				}
+			}
+		}
+		out.append("\r\n");
+		return true;
+	}
+};
+
+template<typename _Scalar, int _Rows, int _Cols, int _Options, int _MaxRows, int _MaxCols>
+void RedisClient::addEigenToWriteCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object,
+                                          const RedisEigenEncoding encoding)
+{
+	typedef Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols > MatrixType;
+	std::unique_ptr<WriteEntry> entry;
+	if (encoding == EIGEN_BINARY)
+		entry.reset(new EigenBinaryWriteEntry<MatrixType>(key, object));
+	else
+		entry.reset(new EigenJSONWriteEntry<MatrixType>(key, object));
+
+	addToWritePlan(callback_number, "RedisClient::addEigenToWriteCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object)", std::move(entry));
 }
 
 #ifdef KEEP_DEPRECATED
@@ -0,0 +1,127 @@
+/**
+ * RedisClientPool.cpp
+ */
+
+#include "RedisClientPool.h"
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+// Distinguishes pools in the per-thread connection assignments, so a new pool
+// at the address of a destroyed one does not inherit its assignments
+std::atomic<uint64_t> next_pool_id{1};
+
+}  // namespace
+
+RedisClientPool::Lease& RedisClientPool::Lease::operator=(Lease&& other) noexcept
+{
+	if(this != &other)
+	{
+		release();
+		_slot = other._slot;
+		other._slot = nullptr;
+	}
+	return *this;
+}
+
+void RedisClientPool::Lease::release()
+{
+	if(_slot != nullptr)
+	{
+		_slot->mutex.unlock();
+		_slot = nullptr;
+	}
+}
+
+RedisClientPool::RedisClientPool()
+	: _id(next_pool_id.fetch_add(1, std::memory_order_relaxed))
+{
+}
+
+void RedisClientPool::connect(const std::string& hostname, const int port, const size_t size)
+{
+	if(size == 0)
+	{
+		throw std::runtime_error("RedisClientPool: Pool size must be positive.");
+	}
+
+	std::vector<std::unique_ptr<Slot>> slots;
+	for(size_t i = 0; i < size; ++i)
+	{
+		slots.push_back(std::make_unique<Slot>());
+		slots.back()->client.connect(hostname, port);
+	}
+
+	std::lock_guard<std::mutex> lock(_registrations_mutex);
+	for(auto& slot : slots)
+	{
+		for(const auto& registration : _registrations)
+		{
+			registration(slot->client);
+		}
+	}
+	_slots = std::move(slots);
+}
+
+void RedisClientPool::registerCallbacks(const std::function<void(RedisClient&)>& registration)
+{
+	std::lock_guard<std::mutex> lock(_registrations_mutex);
+	for(auto& slot : _slots)
+	{
+		std::lock_guard<std::mutex> slot_lock(slot->mutex);
+		registration(slot->client);
+	}
+	_registrations.push_back(registration);
+}
+
+RedisClientPool::Slot& RedisClientPool::findSlot(const size_t index, const char *caller)
+{
+	if(_slots.empty())
+	{
+		throw std::runtime_error(std::string("RedisClientPool: Not connected in ") + caller + ".");
+	}
+	return *_slots[index % _slots.size()];
+}
+
+RedisClientPool::Lease RedisClientPool::acquire()
+{
+	// Start at a different connection on every call to spread the load
+	const size_t start = _next_slot.fetch_add(1, std::memory_order_relaxed);
+	for(size_t i = 0; i < _slots.size(); ++i)
+	{
+		Slot& slot = *_slots[(start + i) % _slots.size()];
+		if(slot.mutex.try_lock())
+		{
+			return Lease(&slot);
+		}
+	}
+
+	// All connections are in use
+	Slot& slot = findSlot(start, "RedisClientPool::acquire()");
+	slot.mutex.lock();
+	return Lease(&slot);
+}
+
+RedisClientPool::Lease RedisClientPool::acquireLocal()
+{
+	// Pool id and connection index of the pools used by this thread
+	thread_local std::vector<std::pair<uint64_t, size_t>> assignments;
+
+	size_t index = 0;
+	auto it = assignments.begin();
+	for(; it != assignments.end() && it->first != _id; ++it) {}
+	if(it != assignments.end())
+	{
+		index = it->second;
+	}
+	else
+	{
+		index = _next_local_slot.fetch_add(1, std::memory_order_relaxed);
+		assignments.emplace_back(_id, index);
+	}
+
+	Slot& slot = findSlot(index, "RedisClientPool::acquireLocal()");
+	slot.mutex.lock();
+	return Lease(&slot);
+}
@@ -0,0 +1,135 @@
+/**
+ * RedisClientPool.h
+ *
+ * Fixed set of RedisClient connections shared by the producer threads of a
+ * process.
+ */
+
+#ifndef REDIS_CLIENT_POOL_H
+#define REDIS_CLIENT_POOL_H
+
+#include "RedisClient.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Pool of blocking RedisClient connections for processes where several
+ * threads write to Redis, e.g. skeletons, floor plane and diagnostics.
+ *
+ * RedisClient is not thread-safe, so a thread leases a connection for
+ * exclusive use and returns it when the lease is destroyed:
+ *
+ *   acquire():       any free connection (checkout / checkin).
+ *   acquireLocal():  the same connection every time on the calling thread.
+ *                    Threads are spread round-robin over the connections,
+ *                    so with as many connections as threads they never wait
+ *                    for each other, and per-connection state such as the
+ *                    deadband of write callbacks always sees the same writer.
+ *
+ * Every connection has its own lock; there is no pool-wide lock on the
+ * acquire path, so producers on different connections run in parallel.
+ *
+ * Callbacks registered with registerCallbacks() exist on every connection
+ * under the same numbers, so any lease can execute them. The registered
+ * objects are shared by all connections, so a thread must not change them
+ * while another thread executes a callback that holds them.
+ */
+class RedisClientPool {
+
+private:
+	struct Slot
+	{
+		std::mutex mutex;
+		RedisClient client;
+	};
+
+public:
+	/**
+	 * Exclusive use of one connection of the pool until destroyed or released.
+	 */
+	class Lease {
+	public:
+		Lease() {}
+		~Lease() { release(); }
+
+		Lease(Lease&& other) noexcept : _slot(other._slot) { other._slot = nullptr; }
+		Lease& operator=(Lease&& other) noexcept;
+
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+
+		RedisClient& operator*() const { return _slot->client; }
+		RedisClient *operator->() const { return &_slot->client; }
+		explicit operator bool() const { return _slot != nullptr; }
+
+		// Return the connection to the pool early
+		void release();
+
+	private:
+		friend class RedisClientPool;
+		explicit Lease(Slot *slot) : _slot(slot) {}
+
+		Slot *_slot = nullptr;
+	};
+
+	RedisClientPool();
+
+	RedisClientPool(const RedisClientPool&) = delete;
+	RedisClientPool& operator=(const RedisClientPool&) = delete;
+
+	/**
+	 * Open size connections to a Redis server and register the callbacks
+	 * added so far on each of them. Must not be called while connections are
+	 * leased. Throws if a connection fails.
+	 *
+	 * @param hostname  Redis server IP address (default 127.0.0.1).
+	 * @param port      Redis server port number (default 6379).
+	 * @param size      Number of connections (default 4).
+	 */
+	void connect(const std::string& hostname="127.0.0.1", const int port=6379, const size_t size=4);
+
+	/**
+	 * Register read and write callbacks on every connection, now and on
+	 * connections opened later by connect(). Waits for leased connections to
+	 * be returned, so the calling thread must not hold a lease.
+	 *
+	 * e.g. pool.registerCallbacks([&](RedisClient& client) {
+	 *          client.createWriteCallback(0);
+	 *          client.addEigenToWriteCallback(0, "kinect::pos::pelvis", pelvis);
+	 *      });
+	 */
+	void registerCallbacks(const std::function<void(RedisClient&)>& registration);
+
+	/**
+	 * Lease a free connection, or wait for one if all are in use.
+	 */
+	Lease acquire();
+
+	/**
+	 * Lease the connection assigned to the calling thread, waiting while
+	 * another thread assigned to the same connection uses it.
+	 */
+	Lease acquireLocal();
+
+	// Number of connections
+	size_t size() const { return _slots.size(); }
+
+private:
+	Slot& findSlot(const size_t index, const char *caller);
+
+	std::vector<std::unique_ptr<Slot>> _slots;
+
+	std::mutex _registrations_mutex;
+	std::vector<std::function<void(RedisClient&)>> _registrations;
+
+	std::atomic<size_t> _next_slot{0};        // first connection tried by acquire()
+	std::atomic<size_t> _next_local_slot{0};  // connection of the next thread in acquireLocal()
+	const uint64_t _id;                       // key of the pool in the per-thread assignments
+};
+
+#endif  // REDIS_CLIENT_POOL_H
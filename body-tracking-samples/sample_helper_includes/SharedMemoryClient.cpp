@@ -0,0 +1,504 @@
+/**
+ * SharedMemoryClient.cpp
+ */
+
+#include "SharedMemoryClient.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::runtime_error;
+
+namespace {
+
+/**
+ * Region layout:
+ *   RegionHeader, padded to REGION_HEADER_SIZE
+ *   max_slots slots of slot_size bytes: SlotHeader, padded to
+ *   SLOT_HEADER_SIZE, followed by the value
+ *
+ * Only the writer changes the region. The sequence numbers are seqlocks:
+ * odd while the writer changes what they protect, and readers retry when
+ * they see an odd or changed number. The value copy itself races with the
+ * writer by design and is only used if the sequence number did not change.
+ */
+const char REGION_MAGIC[8] = {'K', 'S', 'H', 'M', 'E', 'M', '1', '\0'};
+const size_t KEY_SIZE = 104;
+const size_t REGION_HEADER_SIZE = 64;
+const size_t SLOT_HEADER_SIZE = 128;
+
+struct RegionHeader
+{
+	char magic[8];
+	uint32_t max_slots;
+	uint32_t slot_size;
+	std::atomic<uint32_t> num_slots;    // slots in use, published after the slot is filled in
+	uint32_t reserved;
+	std::atomic<uint64_t> frame_seq;    // seqlock over write callback executions
+};
+
+struct SlotHeader
+{
+	std::atomic<uint64_t> seq;          // seqlock over length and value
+	uint32_t type;
+	uint32_t length;
+	char key[KEY_SIZE];                 // NUL-terminated
+};
+
+static_assert(sizeof(RegionHeader) <= REGION_HEADER_SIZE, "RegionHeader does not fit its padding");
+static_assert(sizeof(SlotHeader) <= SLOT_HEADER_SIZE, "SlotHeader does not fit its padding");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory seqlocks need lock-free 64-bit atomics");
+
+inline RegionHeader *regionHeader(char *region)
+{
+	return reinterpret_cast<RegionHeader *>(region);
+}
+
+inline SlotHeader *slotHeader(char *slot)
+{
+	return reinterpret_cast<SlotHeader *>(slot);
+}
+
+}  // namespace
+
+struct SharedMemoryClient::StringEntry : public SharedMemoryClient::Entry
+{
+	std::string& object;
+
+	StringEntry(const std::string& key, std::string& object)
+		: Entry(key, STRING_VALUE), object(object) {}
+
+	size_t size() const override { return object.size(); }
+	void encode(char *dst) const override { std::memcpy(dst, object.data(), object.size()); }
+
+	bool decode(const char *src, const size_t len) override
+	{
+		object.assign(src, len);
+		return true;
+	}
+};
+
+SharedMemoryClient::~SharedMemoryClient()
+{
+	close();
+}
+
+void SharedMemoryClient::mapRegion(const std::string& name, const bool writer, const size_t size)
+{
+	// size 0 maps the whole existing region
+#ifdef _WIN32
+	HANDLE mapping = (size > 0)
+		? CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+		                     static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), name.c_str())
+		: OpenFileMappingA(writer ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, FALSE, name.c_str());
+	if(mapping == nullptr)
+	{
+		throw runtime_error("SharedMemoryClient: Could not open region '" + name + "'.");
+	}
+	void *view = MapViewOfFile(mapping, writer ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, 0);
+	if(view == nullptr)
+	{
+		CloseHandle(mapping);
+		throw runtime_error("SharedMemoryClient: Could not map region '" + name + "'.");
+	}
+	MEMORY_BASIC_INFORMATION info;
+	VirtualQuery(view, &info, sizeof(info));
+	_mapping = mapping;
+	_region = static_cast<char *>(view);
+	_region_size = info.RegionSize;
+#else
+	const int flags = (size > 0) ? (O_CREAT | O_RDWR) : (writer ? O_RDWR : O_RDONLY);
+	const int fd = shm_open(name.c_str(), flags, 0666);
+	if(fd < 0)
+	{
+		throw runtime_error("SharedMemoryClient: Could not open region '" + name + "': " + std::strerror(errno));
+	}
+	struct stat status;
+	if((size > 0 && ftruncate(fd, static_cast<off_t>(size)) != 0) || fstat(fd, &status) != 0)
+	{
+		const int error = errno;
+		::close(fd);
+		throw runtime_error("SharedMemoryClient: Could not size region '" + name + "': " + std::strerror(error));
+	}
+	void *view = mmap(nullptr, static_cast<size_t>(status.st_size), writer ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(view == MAP_FAILED)
+	{
+		throw runtime_error("SharedMemoryClient: Could not map region '" + name + "': " + std::strerror(errno));
+	}
+	_region = static_cast<char *>(view);
+	_region_size = static_cast<size_t>(status.st_size);
+#endif
+	_name = name;
+	_writer = writer;
+}
+
+void SharedMemoryClient::create(const std::string& name, const size_t max_keys, const size_t max_value_size)
+{
+	close();
+	const size_t slot_size = (SLOT_HEADER_SIZE + max_value_size + 63) / 64 * 64;
+	const size_t size = REGION_HEADER_SIZE + max_keys * slot_size;
+
+	// Reuse a region of the same geometry, so attached readers keep working
+	try
+	{
+		mapRegion(name, true, 0);
+	}
+	catch(const runtime_error&)
+	{
+	}
+	if(_region != nullptr)
+	{
+		RegionHeader *header = regionHeader(_region);
+		if(_region_size >= size && std::memcmp(header->magic, REGION_MAGIC, sizeof(REGION_MAGIC)) == 0 &&
+		   header->max_slots == max_keys && header->slot_size == slot_size)
+		{
+			// A previous writer may have stopped in the middle of a write
+			const uint64_t frame_seq = header->frame_seq.load(std::memory_order_relaxed);
+			if(frame_seq & 1)
+			{
+				header->frame_seq.store(frame_seq + 1, std::memory_order_release);
+			}
+			return;
+		}
+		close();
+		remove(name);
+	}
+
+	mapRegion(name, true, size);
+	if(_region_size < size)
+	{
+		close();
+		throw runtime_error("SharedMemoryClient: Region '" + name + "' is in use with a smaller size.");
+	}
+	RegionHeader *header = new (_region) RegionHeader;
+	header->max_slots = static_cast<uint32_t>(max_keys);
+	header->slot_size = static_cast<uint32_t>(slot_size);
+	header->reserved = 0;
+	header->num_slots.store(0, std::memory_order_relaxed);
+	header->frame_seq.store(0, std::memory_order_relaxed);
+	std::memcpy(header->magic, REGION_MAGIC, sizeof(REGION_MAGIC));
+}
+
+void SharedMemoryClient::open(const std::string& name)
+{
+	close();
+	mapRegion(name, false, 0);
+	const RegionHeader *header = regionHeader(_region);
+	if(_region_size < REGION_HEADER_SIZE || std::memcmp(header->magic, REGION_MAGIC, sizeof(REGION_MAGIC)) != 0 ||
+	   _region_size < REGION_HEADER_SIZE + static_cast<size_t>(header->max_slots) * header->slot_size)
+	{
+		close();
+		throw runtime_error("SharedMemoryClient: '" + name + "' is not a shared memory client region.");
+	}
+}
+
+void SharedMemoryClient::close()
+{
+	if(_region == nullptr)
+	{
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(_region);
+	CloseHandle(_mapping);
+	_mapping = nullptr;
+#else
+	munmap(_region, _region_size);
+#endif
+	_region = nullptr;
+	_region_size = 0;
+	_writer = false;
+
+	for(auto *callbacks : {&_write_callbacks, &_read_callbacks})
+	{
+		for(auto& callback : *callbacks)
+		{
+			for(auto& entry : callback.second)
+			{
+				entry->slot = nullptr;
+			}
+		}
+	}
+}
+
+void SharedMemoryClient::remove(const std::string& name)
+{
+#ifndef _WIN32
+	// On Windows the region goes away with the last handle
+	shm_unlink(name.c_str());
+#endif
+}
+
+char *SharedMemoryClient::findSlot(const std::string& key) const
+{
+	RegionHeader *header = regionHeader(_region);
+	const uint32_t num_slots = header->num_slots.load(std::memory_order_acquire);
+	for(uint32_t i = 0; i < num_slots; ++i)
+	{
+		char *slot = _region + REGION_HEADER_SIZE + static_cast<size_t>(i) * header->slot_size;
+		if(std::strncmp(slotHeader(slot)->key, key.c_str(), KEY_SIZE) == 0)
+		{
+			return slot;
+		}
+	}
+	return nullptr;
+}
+
+char *SharedMemoryClient::addSlot(const Entry& entry)
+{
+	if(entry.key.size() >= KEY_SIZE)
+	{
+		throw runtime_error("SharedMemoryClient: Key '" + entry.key + "' is longer than " + std::to_string(KEY_SIZE - 1) + " characters.");
+	}
+
+	char *slot = findSlot(entry.key);
+	if(slot == nullptr)
+	{
+		RegionHeader *header = regionHeader(_region);
+		const uint32_t num_slots = header->num_slots.load(std::memory_order_relaxed);
+		if(num_slots == header->max_slots)
+		{
+			throw runtime_error("SharedMemoryClient: Region '" + _name + "' is full (" + std::to_string(num_slots) + " keys).");
+		}
+		slot = _region + REGION_HEADER_SIZE + static_cast<size_t>(num_slots) * header->slot_size;
+		SlotHeader *slot_header = new (slot) SlotHeader;
+		slot_header->seq.store(0, std::memory_order_relaxed);
+		slot_header->length = 0;
+		std::memset(slot_header->key, 0, KEY_SIZE);
+		std::memcpy(slot_header->key, entry.key.data(), entry.key.size());
+		header->num_slots.store(num_slots + 1, std::memory_order_release);
+	}
+	slotHeader(slot)->type = entry.type;
+	return slot;
+}
+
+SharedMemoryClient::Callback& SharedMemoryClient::findCallback(std::map<int, Callback>& callbacks, const int callback_number, const char *caller)
+{
+	auto it = callbacks.find(callback_number);
+	if(it == callbacks.end())
+	{
+		throw runtime_error(std::string("no callback with this index in ") + caller + "\n");
+	}
+	return it->second;
+}
+
+void SharedMemoryClient::addWriteEntry(const int callback_number, const char *caller, std::unique_ptr<Entry> entry)
+{
+	Callback& callback = findCallback(_write_callbacks, callback_number, caller);
+	if(_writer)
+	{
+		entry->slot = addSlot(*entry);
+	}
+	callback.push_back(std::move(entry));
+}
+
+void SharedMemoryClient::addReadEntry(const int callback_number, const char *caller, std::unique_ptr<Entry> entry)
+{
+	Callback& callback = findCallback(_read_callbacks, callback_number, caller);
+	if(_region != nullptr)
+	{
+		entry->slot = findSlot(entry->key);
+	}
+	callback.push_back(std::move(entry));
+}
+
+void SharedMemoryClient::createWriteCallback(const int callback_number)
+{
+	_write_callbacks[callback_number].clear();
+}
+
+void SharedMemoryClient::addDoubleToWriteCallback(const int callback_number, const std::string& key, double &object)
+{
+	addWriteEntry(callback_number, "SharedMemoryClient::addDoubleToWriteCallback(const int callback_number, const std::string& key, double &object)",
+	              std::unique_ptr<Entry>(new NumberEntry<double>(key, DOUBLE_VALUE, object)));
+}
+
+void SharedMemoryClient::addStringToWriteCallback(const int callback_number, const std::string& key, std::string &object)
+{
+	addWriteEntry(callback_number, "SharedMemoryClient::addStringToWriteCallback(const int callback_number, const std::string& key, std::string &object)",
+	              std::unique_ptr<Entry>(new StringEntry(key, object)));
+}
+
+void SharedMemoryClient::addIntToWriteCallback(const int callback_number, const std::string& key, int &object)
+{
+	addWriteEntry(callback_number, "SharedMemoryClient::addIntToWriteCallback(const int callback_number, const std::string& key, int &object)",
+	              std::unique_ptr<Entry>(new NumberEntry<int>(key, INT_VALUE, object)));
+}
+
+void SharedMemoryClient::createReadCallback(const int callback_number)
+{
+	_read_callbacks[callback_number].clear();
+}
+
+void SharedMemoryClient::addDoubleToReadCallback(const int callback_number, const std::string& key, double &object)
+{
+	addReadEntry(callback_number, "SharedMemoryClient::addDoubleToReadCallback(const int callback_number, const std::string& key, double &object)",
+	             std::unique_ptr<Entry>(new NumberEntry<double>(key, DOUBLE_VALUE, object)));
+}
+
+void SharedMemoryClient::addStringToReadCallback(const int callback_number, const std::string& key, std::string &object)
+{
+	addReadEntry(callback_number, "SharedMemoryClient::addStringToReadCallback(const int callback_number, const std::string& key, std::string &object)",
+	             std::unique_ptr<Entry>(new StringEntry(key, object)));
+}
+
+void SharedMemoryClient::addIntToReadCallback(const int callback_number, const std::string& key, int &object)
+{
+	addReadEntry(callback_number, "SharedMemoryClient::addIntToReadCallback(const int callback_number, const std::string& key, int &object)",
+	             std::unique_ptr<Entry>(new NumberEntry<int>(key, INT_VALUE, object)));
+}
+
+void SharedMemoryClient::writeCallback(Callback& callback, const Entry *&failed)
+{
+	const size_t capacity = regionHeader(_region)->slot_size - SLOT_HEADER_SIZE;
+	for(auto& entry : callback)
+	{
+		if(entry->slot == nullptr)
+		{
+			entry->slot = addSlot(*entry);
+		}
+
+		// Values that do not fit are reported after the frame is complete
+		const size_t size = entry->size();
+		if(size > capacity)
+		{
+			if(failed == nullptr) failed = entry.get();
+			continue;
+		}
+
+		SlotHeader *header = slotHeader(entry->slot);
+		const uint64_t seq = header->seq.load(std::memory_order_relaxed);
+		header->seq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		entry->encode(entry->slot + SLOT_HEADER_SIZE);
+		header->length = static_cast<uint32_t>(size);
+		header->seq.store(seq + 2, std::memory_order_release);
+	}
+}
+
+void SharedMemoryClient::executeWriteCallback(const int callback_number)
+{
+	_batch.assign(1, callback_number);
+	executeWriteCallbacks(_batch);
+}
+
+void SharedMemoryClient::executeWriteCallbacks(const std::vector<int>& callback_numbers)
+{
+	if(!_writer)
+	{
+		throw runtime_error("SharedMemoryClient: No region created for writing.");
+	}
+
+	RegionHeader *header = regionHeader(_region);
+	const uint64_t frame_seq = header->frame_seq.load(std::memory_order_relaxed);
+	header->frame_seq.store(frame_seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	const Entry *failed = nullptr;
+	try
+	{
+		for(const int callback_number : callback_numbers)
+		{
+			writeCallback(findCallback(_write_callbacks, callback_number, "SharedMemoryClient::executeWriteCallbacks(const std::vector<int>& callback_numbers)"), failed);
+		}
+	}
+	catch(...)
+	{
+		header->frame_seq.store(frame_seq + 2, std::memory_order_release);
+		throw;
+	}
+	header->frame_seq.store(frame_seq + 2, std::memory_order_release);
+
+	if(failed != nullptr)
+	{
+		throw runtime_error("SharedMemoryClient: Value of key '" + failed->key + "' does not fit the slots of region '" + _name + "'.");
+	}
+}
+
+bool SharedMemoryClient::readEntry(Entry& entry)
+{
+	if(entry.slot == nullptr)
+	{
+		entry.slot = findSlot(entry.key);
+		if(entry.slot == nullptr)
+		{
+			throw runtime_error("SharedMemoryClient: Key '" + entry.key + "' is not in region '" + _name + "'.");
+		}
+	}
+
+	SlotHeader *header = slotHeader(entry.slot);
+	if(header->type != entry.type)
+	{
+		throw runtime_error("SharedMemoryClient: Key '" + entry.key + "' holds a value of another type.");
+	}
+
+	const size_t capacity = regionHeader(_region)->slot_size - SLOT_HEADER_SIZE;
+	const uint64_t seq = header->seq.load(std::memory_order_acquire);
+	if(seq & 1)
+	{
+		return false;
+	}
+	const size_t length = header->length;
+	const bool decoded = length <= capacity && entry.decode(entry.slot + SLOT_HEADER_SIZE, length);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if(header->seq.load(std::memory_order_relaxed) != seq)
+	{
+		return false;
+	}
+	if(!decoded)
+	{
+		throw runtime_error("SharedMemoryClient: Value of key '" + entry.key + "' does not have the shape of the registered object.");
+	}
+	return true;
+}
+
+uint64_t SharedMemoryClient::executeReadCallback(const int callback_number, const int max_attempts)
+{
+	Callback& callback = findCallback(_read_callbacks, callback_number, "SharedMemoryClient::executeReadCallback(const int callback_number, const int max_attempts)");
+	if(_region == nullptr)
+	{
+		throw runtime_error("SharedMemoryClient: No region opened for reading.");
+	}
+
+	const RegionHeader *header = regionHeader(_region);
+	for(int attempt = 0; attempt < std::max(max_attempts, 1); ++attempt)
+	{
+		const uint64_t frame_seq = header->frame_seq.load(std::memory_order_acquire);
+		bool complete = !(frame_seq & 1);
+		for(auto it = callback.begin(); complete && it != callback.end(); ++it)
+		{
+			complete = readEntry(**it);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(complete && header->frame_seq.load(std::memory_order_relaxed) == frame_seq)
+		{
+			return frame_seq / 2;
+		}
+
+		// Let a writer on the same core finish
+		std::this_thread::yield();
+	}
+	throw runtime_error("SharedMemoryClient: Region '" + _name + "' was written during every read of read callback " +
+	                    std::to_string(callback_number) + ".");
+}
+
+uint64_t SharedMemoryClient::frameSeq() const
+{
+	if(_region == nullptr)
+	{
+		return 0;
+	}
+	return regionHeader(_region)->frame_seq.load(std::memory_order_acquire) / 2;
+}
@@ -0,0 +1,266 @@
+/**
+ * SharedMemoryClient.h
+ *
+ * Same-host transport for read and write callbacks through a shared memory
+ * region, with the callback API of RedisClient.
+ */
+
+#ifndef SHARED_MEMORY_CLIENT_H
+#define SHARED_MEMORY_CLIENT_H
+
+#include "RedisClient.h"
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Publishes callback values into a named shared memory region instead of
+ * Redis, for consumers on the same host.
+ *
+ * The region holds one fixed-size slot per key. Each slot is a seqlock: the
+ * writer makes its sequence number odd, copies the value in and makes it even
+ * again, and readers copy the value straight into their registered object and
+ * retry if the sequence number changed meanwhile. Neither side makes a system
+ * call or takes a lock, so a value is read in well under a microsecond.
+ *
+ * Values are stored like the EIGEN_BINARY encoding of RedisClient: Eigen
+ * objects as RedisEigenBinary, doubles and ints as their 8 / 4 bytes and
+ * strings as is.
+ *
+ * A region has a single writer process, which creates it with create();
+ * any number of readers attach with open(). Redis stays the transport for
+ * remote consumers: register the same objects on a RedisClient as well.
+ */
+class SharedMemoryClient {
+
+public:
+	SharedMemoryClient() {}
+	~SharedMemoryClient();
+
+	SharedMemoryClient(const SharedMemoryClient&) = delete;
+	SharedMemoryClient& operator=(const SharedMemoryClient&) = delete;
+
+	/**
+	 * Create a region and become its writer. An existing region of the same
+	 * name and geometry is reused, so readers attached to it keep working when
+	 * the writer restarts; otherwise it is replaced.
+	 *
+	 * @param name            Region name, e.g. "/kinect".
+	 * @param max_keys        Number of slots (default 1024).
+	 * @param max_value_size  Largest value in bytes (default 1024).
+	 */
+	void create(const std::string& name="/kinect", const size_t max_keys=1024, const size_t max_value_size=1024);
+
+	/**
+	 * Attach to a region created by a writer, as a reader. Throws if the
+	 * region does not exist.
+	 */
+	void open(const std::string& name="/kinect");
+
+	/**
+	 * Detach from the region. The region itself stays until remove().
+	 */
+	void close();
+
+	/**
+	 * Delete a region. Attached clients keep their mapping until they close.
+	 */
+	static void remove(const std::string& name);
+
+	/**
+	 * Write callbacks, see RedisClient. Keys get their slot when they are
+	 * added; throws if the region is full.
+	 */
+	void createWriteCallback(const int callback_number);
+	void addDoubleToWriteCallback(const int callback_number, const std::string& key, double &object);
+	void addStringToWriteCallback(const int callback_number, const std::string& key, std::string &object);
+	void addIntToWriteCallback(const int callback_number, const std::string& key, int &object);
+
+	template<typename _Scalar, int _Rows, int _Cols, int _Options, int _MaxRows, int _MaxCols>
+	void addEigenToWriteCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object);
+
+	/**
+	 * Copy all values of a write callback into their slots. Values larger than
+	 * the slots are skipped and reported by an exception after all other keys
+	 * were written.
+	 */
+	void executeWriteCallback(const int callback_number);
+	void executeWriteCallbacks(const std::vector<int>& callback_numbers);
+
+	/**
+	 * Read callbacks, see RedisClient. Keys the writer has not added yet are
+	 * looked up again on every execution.
+	 */
+	void createReadCallback(const int callback_number);
+	void addDoubleToReadCallback(const int callback_number, const std::string& key, double &object);
+	void addStringToReadCallback(const int callback_number, const std::string& key, std::string &object);
+	void addIntToReadCallback(const int callback_number, const std::string& key, int &object);
+
+	template<typename _Scalar, int _Rows, int _Cols, int _Options, int _MaxRows, int _MaxCols>
+	void addEigenToReadCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object);
+
+	/**
+	 * Copy the values of all keys of a read callback into their objects.
+	 *
+	 * Every value is copied whole. If the writer executed a write callback
+	 * while the keys were copied, they are copied again, up to max_attempts
+	 * times, so the objects normally hold one frame. Throws if a key is not
+	 * in the region or its value does not have the type and shape of the
+	 * object.
+	 *
+	 * @return  Number of write callback executions of the frame read, see frameSeq().
+	 */
+	uint64_t executeReadCallback(const int callback_number, const int max_attempts=100);
+
+	/**
+	 * Number of write callback executions in the region so far.
+	 */
+	uint64_t frameSeq() const;
+
+private:
+	enum ValueType : uint32_t
+	{
+		DOUBLE_VALUE = 1,
+		INT_VALUE = 2,
+		STRING_VALUE = 3,
+		EIGEN_VALUE = 4,
+	};
+
+	/**
+	 * One registered key. Writers encode the object into its slot, readers
+	 * decode the slot into the object.
+	 */
+	struct Entry
+	{
+		Entry(const std::string& key, const ValueType type) : key(key), type(type) {}
+		virtual ~Entry() {}
+
+		// Bytes encode() writes
+		virtual size_t size() const = 0;
+		virtual void encode(char *dst) const = 0;
+
+		// Returns false if the value does not fit the object
+		virtual bool decode(const char *src, const size_t len) = 0;
+
+		const std::string key;
+		const ValueType type;
+		char *slot = nullptr;  // slot in the region, nullptr until found
+	};
+
+	template<typename T> struct NumberEntry;
+	struct StringEntry;
+	template<typename MatrixType> struct EigenEntry;
+
+	typedef std::vector<std::unique_ptr<Entry>> Callback;
+
+	Callback& findCallback(std::map<int, Callback>& callbacks, const int callback_number, const char *caller);
+	void addWriteEntry(const int callback_number, const char *caller, std::unique_ptr<Entry> entry);
+	void addReadEntry(const int callback_number, const char *caller, std::unique_ptr<Entry> entry);
+	void writeCallback(Callback& callback, const Entry *&failed);
+	bool readEntry(Entry& entry);
+	char *findSlot(const std::string& key) const;
+	char *addSlot(const Entry& entry);
+	void mapRegion(const std::string& name, const bool writer, const size_t size);
+
+	std::map<int, Callback> _write_callbacks;
+	std::map<int, Callback> _read_callbacks;
+	std::vector<int> _batch;  // reused by executeWriteCallback()
+
+	std::string _name;
+	char *_region = nullptr;
+	size_t _region_size = 0;
+	bool _writer = false;
+	void *_mapping = nullptr;  // file mapping handle on Windows
+};
+
+template<typename T>
+struct SharedMemoryClient::NumberEntry : public SharedMemoryClient::Entry
+{
+	T& object;
+
+	NumberEntry(const std::string& key, const ValueType type, T& object)
+		: Entry(key, type), object(object) {}
+
+	size_t size() const override { return sizeof(T); }
+	void encode(char *dst) const override { std::memcpy(dst, &object, sizeof(T)); }
+
+	bool decode(const char *src, const size_t len) override {
+		if (len != sizeof(T)) return false;
+		std::memcpy(&object, src, sizeof(T));
+		return true;
+	}
+};
+
+template<typename MatrixType>
+struct SharedMemoryClient::EigenEntry : public SharedMemoryClient::Entry
+{
+	typedef typename MatrixType::Scalar Scalar;
+	static const bool COLUMN_MAJOR = MatrixType::IsVectorAtCompileTime || !(MatrixType::Flags & Eigen::RowMajorBit);
+
+	MatrixType& object;
+
+	EigenEntry(const std::string& key, MatrixType& object)
+		: Entry(key, EIGEN_VALUE), object(object) {}
+
+	size_t size() const override {
+		return RedisEigenBinary::HEADER_SIZE + object.size() * sizeof(Scalar);
+	}
+
+	void encode(char *dst) const override {
+		RedisEigenBinary::writeHeader(dst, RedisEigenBinary::ScalarTraits<Scalar>::type, object.rows(), object.cols());
+		char *payload = dst + RedisEigenBinary::HEADER_SIZE;
+		if (COLUMN_MAJOR && RedisEigenBinary::hostIsLittleEndian()) {
+			std::memcpy(payload, object.data(), object.size() * sizeof(Scalar));
+			return;
+		}
+		for (int j = 0; j < object.cols(); ++j) {
+			for (int i = 0; i < object.rows(); ++i) {
+				RedisEigenBinary::storeLittleEndian<Scalar>(payload, object(i,j));
+				payload += sizeof(Scalar);
+			}
+		}
+	}
+
+	bool decode(const char *src, const size_t len) override {
+		RedisEigenBinary::ScalarType type;
+		uint32_t rows, cols;
+		if (!RedisEigenBinary::readHeader(src, len, type, rows, cols) ||
+		    type != RedisEigenBinary::ScalarTraits<Scalar>::type ||
+		    rows != static_cast<uint32_t>(object.rows()) || cols != static_cast<uint32_t>(object.cols())) {
+			return false;
+		}
+		const char *payload = src + RedisEigenBinary::HEADER_SIZE;
+		if (COLUMN_MAJOR && RedisEigenBinary::hostIsLittleEndian()) {
+			std::memcpy(object.data(), payload, object.size() * sizeof(Scalar));
+			return true;
+		}
+		for (int j = 0; j < object.cols(); ++j) {
+			for (int i = 0; i < object.rows(); ++i) {
+				object(i,j) = RedisEigenBinary::loadLittleEndian<Scalar>(payload);
+				payload += sizeof(Scalar);
+			}
+		}
+		return true;
+	}
+};
+
+template<typename _Scalar, int _Rows, int _Cols, int _Options, int _MaxRows, int _MaxCols>
+void SharedMemoryClient::addEigenToWriteCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object)
+{
+	typedef Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols > MatrixType;
+	addWriteEntry(callback_number, "SharedMemoryClient::addEigenToWriteCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object)",
+	              std::unique_ptr<Entry>(new EigenEntry<MatrixType>(key, object)));
+}
+
+template<typename _Scalar, int _Rows, int _Cols, int _Options, int _MaxRows, int _MaxCols>
+void SharedMemoryClient::addEigenToReadCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object)
+{
+	typedef Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols > MatrixType;
+	addReadEntry(callback_number, "SharedMemoryClient::addEigenToReadCallback(const int callback_number, const std::string& key, Eigen::Matrix< _Scalar, _Rows, _Cols, _Options, _MaxRows, _MaxCols >& object)",
+	             std::unique_ptr<Entry>(new EigenEntry<MatrixType>(key, object)));
+}
+
+#endif  // SHARED_MEMORY_CLIENT_H
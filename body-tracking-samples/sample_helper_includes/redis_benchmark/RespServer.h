@@ -0,0 +1,504 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET RespSocket;
+static const RespSocket InvalidRespSocket = INVALID_SOCKET;
+static const int RespSendFlags = 0;
+inline void CloseRespSocket(RespSocket s) { closesocket(s); }
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int RespSocket;
+static const RespSocket InvalidRespSocket = -1;
+#ifdef MSG_NOSIGNAL
+static const int RespSendFlags = MSG_NOSIGNAL;
+#else
+static const int RespSendFlags = 0;
+#endif
+inline void CloseRespSocket(RespSocket s) { close(s); }
+#endif
+
+// Minimal in-process RESP server, so RedisClient can be benchmarked without a redis-server.
+//
+// Listens on 127.0.0.1 and serves each connection on its own thread. Only the commands the
+// benchmark needs are implemented (PING, GET, SET, MGET, MSET, DEL, EXISTS, INCR, PUBLISH,
+// MULTI/EXEC, CONFIG GET/SET and PSUBSCRIBE) against a single key-value map; SET options such as
+// PX are accepted and ignored. Replies to pipelined commands are sent with one write per received
+// chunk, like redis-server does. With notify-keyspace-events containing K, SET, MSET and DEL send
+// keyspace notifications to PSUBSCRIBE connections whose pattern matches; a subscribed connection
+// accepts no further commands. SetReplyFragments() splits the replies, so clients receive partial
+// replies, and SetRoundTripDelay() delays them like a remote server.
+class RespServer
+{
+public:
+    RespServer() = default;
+    RespServer(const RespServer&) = delete;
+    RespServer& operator=(const RespServer&) = delete;
+
+    ~RespServer()
+    {
+        Stop();
+    }
+
+    // Starts listening on an ephemeral port and returns it
+    int Start()
+    {
+#ifdef _WIN32
+        WSADATA wsaData;
+        WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+        m_listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        socklen_t addressLength = sizeof(address);
+        if (m_listenSocket == InvalidRespSocket ||
+            bind(m_listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(m_listenSocket, 16) != 0 ||
+            getsockname(m_listenSocket, reinterpret_cast<sockaddr*>(&address), &addressLength) != 0)
+        {
+            throw std::runtime_error("RespServer: Could not listen on 127.0.0.1.");
+        }
+
+        m_running = true;
+        m_acceptThread = std::thread(&RespServer::AcceptLoop, this);
+        return ntohs(address.sin_port);
+    }
+
+    // Sends replies in fragments of at most fragmentSize bytes with a pause of gap between them,
+    // so clients receive partial replies. 0 sends the replies of each received chunk at once.
+    void SetReplyFragments(size_t fragmentSize, std::chrono::microseconds gap)
+    {
+        m_fragmentGapUsec = gap.count();
+        m_fragmentSize = fragmentSize;
+    }
+
+    // Waits for delay after receiving each chunk before executing its commands, to simulate the
+    // network round trip of a remote server. Commands that arrive meanwhile stay in the socket and
+    // are executed together as the next chunk, so a client that pipelines its writes pays the delay
+    // once per chunk instead of once per call. 0 executes commands as soon as they arrive.
+    void SetRoundTripDelay(std::chrono::microseconds delay)
+    {
+        m_roundTripDelayUsec = delay.count();
+    }
+
+    void Stop()
+    {
+        if (!m_running.exchange(false))
+        {
+            return;
+        }
+
+        // Unblocks accept() and recv() of the serving threads
+        ShutdownSocket(m_listenSocket);
+        CloseRespSocket(m_listenSocket);
+        m_acceptThread.join();
+        {
+            std::lock_guard<std::mutex> lock(m_connectionsMutex);
+            for (RespSocket s : m_connections)
+            {
+                ShutdownSocket(s);
+            }
+        }
+        for (auto& thread : m_connectionThreads)
+        {
+            thread.join();
+        }
+        m_connectionThreads.clear();
+        m_connections.clear();
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+private:
+    static void ShutdownSocket(RespSocket s)
+    {
+#ifdef _WIN32
+        shutdown(s, SD_BOTH);
+#else
+        shutdown(s, SHUT_RDWR);
+#endif
+    }
+
+    void AcceptLoop()
+    {
+        while (m_running)
+        {
+            RespSocket client = accept(m_listenSocket, nullptr, nullptr);
+            if (client == InvalidRespSocket)
+            {
+                continue;
+            }
+
+            int noDelay = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+
+            std::lock_guard<std::mutex> lock(m_connectionsMutex);
+            m_connections.push_back(client);
+            m_connectionThreads.emplace_back(&RespServer::Serve, this, client);
+        }
+    }
+
+    void Serve(RespSocket client)
+    {
+        std::string input;
+        std::string output;
+        std::vector<std::string> args;
+        bool inTransaction = false;
+        std::vector<std::vector<std::string>> queued;
+        std::string subscription;
+        char chunk[65536];
+        while (true)
+        {
+            auto received = recv(client, chunk, static_cast<int>(sizeof(chunk)), 0);
+            if (received <= 0)
+            {
+                break;
+            }
+            input.append(chunk, static_cast<size_t>(received));
+
+            const long long roundTripDelayUsec = m_roundTripDelayUsec;
+            if (roundTripDelayUsec > 0)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(roundTripDelayUsec));
+            }
+
+            size_t consumed = 0;
+            while (ParseCommand(input, consumed, args))
+            {
+                const std::string& command = args.empty() ? std::string() : args[0];
+                if (command == "MULTI")
+                {
+                    inTransaction = true;
+                    queued.clear();
+                    output += "+OK\r\n";
+                }
+                else if (command == "EXEC" && inTransaction)
+                {
+                    // Queued commands run under one lock, so other connections never see a part of them
+                    inTransaction = false;
+                    output += '*' + std::to_string(queued.size()) + "\r\n";
+                    std::lock_guard<std::mutex> lock(m_storeMutex);
+                    for (const auto& queuedArgs : queued)
+                    {
+                        ExecuteLocked(queuedArgs, output);
+                    }
+                }
+                else if (command == "PSUBSCRIBE" && args.size() == 2)
+                {
+                    subscription = args[1];
+                    output += "*3\r\n$10\r\npsubscribe\r\n";
+                    AppendBulkString(output, subscription);
+                    output += ":1\r\n";
+                }
+                else if (inTransaction)
+                {
+                    queued.push_back(args);
+                    output += "+QUEUED\r\n";
+                }
+                else
+                {
+                    std::lock_guard<std::mutex> lock(m_storeMutex);
+                    ExecuteLocked(args, output);
+                }
+            }
+            input.erase(0, consumed);
+
+            if (!output.empty() && !SendReplies(client, output))
+            {
+                break;
+            }
+            output.clear();
+
+            // Notifications are sent by the connections writing keys, after the PSUBSCRIBE reply
+            if (!subscription.empty())
+            {
+                std::lock_guard<std::mutex> lock(m_storeMutex);
+                m_subscribers.emplace_back(client, subscription);
+                subscription.clear();
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_storeMutex);
+            for (size_t i = 0; i < m_subscribers.size(); i++)
+            {
+                if (m_subscribers[i].first == client)
+                {
+                    m_subscribers.erase(m_subscribers.begin() + i);
+                    break;
+                }
+            }
+        }
+        CloseRespSocket(client);
+    }
+
+    static bool SendAll(RespSocket client, const std::string& data)
+    {
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            auto n = send(client, data.data() + sent, static_cast<int>(data.size() - sent), RespSendFlags);
+            if (n <= 0)
+            {
+                return false;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool SendReplies(RespSocket client, const std::string& data) const
+    {
+        const size_t fragmentSize = m_fragmentSize;
+        if (fragmentSize == 0)
+        {
+            return SendAll(client, data);
+        }
+
+        for (size_t pos = 0; pos < data.size(); pos += fragmentSize)
+        {
+            if (pos > 0)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(m_fragmentGapUsec.load()));
+            }
+            if (!SendAll(client, data.substr(pos, fragmentSize)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Parses one "*<n>\r\n$<len>\r\n<arg>\r\n..." command at pos. Returns false if incomplete.
+    static bool ParseCommand(const std::string& input, size_t& pos, std::vector<std::string>& args)
+    {
+        size_t p = pos;
+        long long count;
+        if (!ParseLine(input, p, '*', count))
+        {
+            return false;
+        }
+
+        args.resize(static_cast<size_t>(count));
+        for (auto& arg : args)
+        {
+            long long length;
+            if (!ParseLine(input, p, '$', length) || input.size() < p + static_cast<size_t>(length) + 2)
+            {
+                return false;
+            }
+            arg.assign(input, p, static_cast<size_t>(length));
+            p += static_cast<size_t>(length) + 2;
+        }
+        pos = p;
+        return true;
+    }
+
+    static bool ParseLine(const std::string& input, size_t& p, char type, long long& value)
+    {
+        size_t end = input.find("\r\n", p);
+        if (end == std::string::npos)
+        {
+            return false;
+        }
+        if (input[p] != type)
+        {
+            throw std::runtime_error("RespServer: Only RESP arrays of bulk strings are supported.");
+        }
+        value = std::atoll(input.c_str() + p + 1);
+        p = end + 2;
+        return true;
+    }
+
+    static void AppendBulkString(std::string& output, const std::string& value)
+    {
+        output += '$';
+        output += std::to_string(value.size());
+        output += "\r\n";
+        output += value;
+        output += "\r\n";
+    }
+
+    // Glob match of a PSUBSCRIBE pattern, supporting * and ?
+    static bool MatchPattern(const char* pattern, const char* text)
+    {
+        if (*pattern == '\0')
+        {
+            return *text == '\0';
+        }
+        if (*pattern == '*')
+        {
+            return MatchPattern(pattern + 1, text) || (*text != '\0' && MatchPattern(pattern, text + 1));
+        }
+        return *text != '\0' && (*pattern == '?' || *pattern == *text) && MatchPattern(pattern + 1, text + 1);
+    }
+
+    // Sends the keyspace notification of a write to every matching subscriber
+    void NotifyLocked(const std::string& key, const char* event)
+    {
+        if (m_subscribers.empty() || m_notifyKeyspaceEvents.find('K') == std::string::npos)
+        {
+            return;
+        }
+        const std::string channel = "__keyspace@0__:" + key;
+        for (const auto& subscriber : m_subscribers)
+        {
+            if (MatchPattern(subscriber.second.c_str(), channel.c_str()))
+            {
+                std::string message = "*4\r\n$8\r\npmessage\r\n";
+                AppendBulkString(message, subscriber.second);
+                AppendBulkString(message, channel);
+                AppendBulkString(message, event);
+                SendAll(subscriber.first, message);
+            }
+        }
+    }
+
+    void ExecuteLocked(const std::vector<std::string>& args, std::string& output)
+    {
+        const std::string& command = args.empty() ? std::string() : args[0];
+        if (command == "GET" && args.size() == 2)
+        {
+            auto it = m_store.find(args[1]);
+            if (it == m_store.end())
+            {
+                output += "$-1\r\n";
+            }
+            else
+            {
+                AppendBulkString(output, it->second);
+            }
+        }
+        else if (command == "SET" && args.size() >= 3)
+        {
+            m_store[args[1]] = args[2];
+            output += "+OK\r\n";
+            NotifyLocked(args[1], "set");
+        }
+        else if (command == "MGET" && args.size() >= 2)
+        {
+            output += '*' + std::to_string(args.size() - 1) + "\r\n";
+            for (size_t i = 1; i < args.size(); i++)
+            {
+                auto it = m_store.find(args[i]);
+                if (it == m_store.end())
+                {
+                    output += "$-1\r\n";
+                }
+                else
+                {
+                    AppendBulkString(output, it->second);
+                }
+            }
+        }
+        else if (command == "MSET" && args.size() % 2 == 1)
+        {
+            for (size_t i = 1; i + 1 < args.size(); i += 2)
+            {
+                m_store[args[i]] = args[i + 1];
+                NotifyLocked(args[i], "set");
+            }
+            output += "+OK\r\n";
+        }
+        else if (command == "DEL")
+        {
+            size_t removed = 0;
+            for (size_t i = 1; i < args.size(); i++)
+            {
+                if (m_store.erase(args[i]) > 0)
+                {
+                    removed++;
+                    NotifyLocked(args[i], "del");
+                }
+            }
+            output += ':' + std::to_string(removed) + "\r\n";
+        }
+        else if (command == "EXISTS")
+        {
+            size_t found = 0;
+            for (size_t i = 1; i < args.size(); i++)
+            {
+                found += m_store.count(args[i]);
+            }
+            output += ':' + std::to_string(found) + "\r\n";
+        }
+        else if (command == "INCR" && args.size() == 2)
+        {
+            std::string& value = m_store[args[1]];
+            char* end = nullptr;
+            const long long number = std::strtoll(value.c_str(), &end, 10);
+            if (*end != '\0')
+            {
+                output += "-ERR value is not an integer or out of range\r\n";
+            }
+            else
+            {
+                value = std::to_string(number + 1);
+                output += ':' + value + "\r\n";
+            }
+        }
+        else if (command == "PUBLISH" && args.size() == 3)
+        {
+            output += ":0\r\n";
+        }
+        else if (command == "CONFIG" && args.size() == 3 && args[1] == "GET" && args[2] == "notify-keyspace-events")
+        {
+            output += "*2\r\n";
+            AppendBulkString(output, args[2]);
+            AppendBulkString(output, m_notifyKeyspaceEvents);
+        }
+        else if (command == "CONFIG" && args.size() == 4 && args[1] == "SET" && args[2] == "notify-keyspace-events")
+        {
+            m_notifyKeyspaceEvents = args[3];
+            output += "+OK\r\n";
+        }
+        else if (command == "PING")
+        {
+            output += "+PONG\r\n";
+        }
+        else
+        {
+            output += "-ERR unsupported command '" + command + "'\r\n";
+        }
+    }
+
+    RespSocket m_listenSocket = InvalidRespSocket;
+    std::atomic<bool> m_running{ false };
+    std::thread m_acceptThread;
+
+    std::atomic<size_t> m_fragmentSize{ 0 };
+    std::atomic<long long> m_fragmentGapUsec{ 0 };
+    std::atomic<long long> m_roundTripDelayUsec{ 0 };
+
+    std::mutex m_connectionsMutex;
+    std::vector<RespSocket> m_connections;
+    std::vector<std::thread> m_connectionThreads;
+
+    std::mutex m_storeMutex;
+    std::unordered_map<std::string, std::string> m_store;
+    std::string m_notifyKeyspaceEvents;
+    std::vector<std::pair<RespSocket, std::string>> m_subscribers;  // socket and pattern
+};
@@ -0,0 +1,483 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <RedisClient.h>
+#include <RedisClientPool.h>
+#include <SharedMemoryClient.h>
+
+#include "RespServer.h"
+
+// Measures RedisClient throughput and latency: Eigen JSON encoding and decoding of typical
+// skeleton values, and the bulk commands used to publish and read skeletons, end to end against
+// a local redis-server or the bundled in-process RespServer. Heap allocations of the measured
+// calls are counted too; write and read callbacks must not allocate once warmed up.
+
+// Heap allocations made by the benchmark thread while counting is enabled
+static std::atomic<uint64_t> s_allocations{ 0 };
+static thread_local bool t_countAllocations = false;
+
+void* operator new(size_t size)
+{
+    if (t_countAllocations)
+    {
+        s_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void PrintUsage()
+{
+    printf("\nUSAGE: redis_benchmark [-host IP] [-port N] [-iterations N]\n");
+    printf("  - -host IP / -port N: benchmark against this redis-server instead of the in-process RESP server\n");
+    printf("  - -iterations N: measured calls per benchmark, after N/10 warm-up calls (default 10000)\n");
+    printf("e.g.   redis_benchmark\n");
+    printf("e.g.   redis_benchmark -host 127.0.0.1 -port 6379 -iterations 100000\n");
+}
+
+struct BenchmarkSettings
+{
+    std::string Host;
+    int Port = 6379;
+    size_t Iterations = 10000;
+};
+
+bool ParseBenchmarkSettingsFromArg(int argc, char** argv, BenchmarkSettings& settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string inputArg(argv[i]);
+        if (inputArg == std::string("-host") && i + 1 < argc)
+        {
+            settings.Host = argv[++i];
+        }
+        else if (inputArg == std::string("-port") && i + 1 < argc)
+        {
+            settings.Port = std::atoi(argv[++i]);
+        }
+        else if (inputArg == std::string("-iterations") && i + 1 < argc)
+        {
+            settings.Iterations = std::strtoul(argv[++i], nullptr, 10);
+            if (settings.Iterations == 0)
+            {
+                printf("Error: -iterations must be positive\n");
+                return false;
+            }
+        }
+        else
+        {
+            printf("Error: command not understood: %s\n", inputArg.c_str());
+            return false;
+        }
+    }
+    if (!settings.Host.empty() && settings.Port <= 0)
+    {
+        printf("Error: invalid -port\n");
+        return false;
+    }
+    return true;
+}
+
+struct BenchmarkResult
+{
+    double opsPerSecond = 0;
+    double p50Usec = 0;
+    double p99Usec = 0;
+    double allocationsPerOp = 0;
+};
+
+class Benchmark
+{
+public:
+    explicit Benchmark(size_t iterations)
+        : m_iterations(iterations)
+    {
+        m_latencies.reserve(iterations);
+        printf("%-50s %12s %10s %10s %10s\n", "benchmark", "ops/s", "p50 [us]", "p99 [us]", "allocs/op");
+    }
+
+    // Runs function iterations/10 times to warm up, then measures it iterations times
+    template<typename Function>
+    BenchmarkResult Run(const char* name, Function function)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        for (size_t i = 0; i < m_iterations / 10 + 1; i++)
+        {
+            function();
+        }
+
+        m_latencies.clear();
+        uint64_t allocations = 0;
+        const auto start = Clock::now();
+        for (size_t i = 0; i < m_iterations; i++)
+        {
+            const uint64_t allocationsBefore = s_allocations.load(std::memory_order_relaxed);
+            const auto begin = Clock::now();
+            t_countAllocations = true;
+            function();
+            t_countAllocations = false;
+            const auto end = Clock::now();
+            allocations += s_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+            m_latencies.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::sort(m_latencies.begin(), m_latencies.end());
+        BenchmarkResult result;
+        result.opsPerSecond = m_iterations / seconds;
+        result.p50Usec = Percentile(0.50);
+        result.p99Usec = Percentile(0.99);
+        result.allocationsPerOp = static_cast<double>(allocations) / m_iterations;
+        printf("%-50s %12.0f %10.2f %10.2f %10.2f\n", name, result.opsPerSecond, result.p50Usec, result.p99Usec, result.allocationsPerOp);
+        return result;
+    }
+
+private:
+    double Percentile(double fraction) const
+    {
+        size_t index = static_cast<size_t>(fraction * (m_latencies.size() - 1) + 0.5);
+        return m_latencies[index];
+    }
+
+    const size_t m_iterations;
+    std::vector<double> m_latencies;
+};
+
+// Runs function iterations times on each of threads threads at once and returns the total ops/s
+template<typename Function>
+double RunParallel(size_t threads, size_t iterations, Function function)
+{
+    std::vector<std::thread> workers;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&]()
+        {
+            for (size_t i = 0; i < iterations; i++)
+            {
+                function();
+            }
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return threads * iterations / seconds;
+}
+
+// Joint count of a k4abt skeleton
+const int JointCount = 32;
+const std::string KeyPrefix = "redis_benchmark::";
+
+int main(int argc, char** argv)
+{
+    BenchmarkSettings settings;
+    if (!ParseBenchmarkSettingsFromArg(argc, argv, settings))
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    RespServer server;
+    RedisClient redisClient;
+    const bool localServer = settings.Host.empty();
+    if (localServer)
+    {
+        settings.Host = "127.0.0.1";
+        settings.Port = server.Start();
+        printf("Server: in-process RESP server on 127.0.0.1:%d\n", settings.Port);
+    }
+    else
+    {
+        printf("Server: redis-server on %s:%d\n", settings.Host.c_str(), settings.Port);
+    }
+    redisClient.connect(settings.Host, settings.Port);
+    printf("Iterations: %zu\n\n", settings.Iterations);
+
+    Benchmark benchmark(settings.Iterations);
+
+    // Typical values: one joint position, one joint orientation and the positions of a whole skeleton
+    Eigen::Vector3d position(123.456789, -987.654321, 2345.678901);
+    Eigen::Matrix3d orientation;
+    orientation << 0.36, 0.48, -0.8, -0.8, 0.6, 0.0, 0.48, 0.64, 0.6;
+    Eigen::Matrix<double, JointCount, 3> joints;
+    for (int i = 0; i < JointCount; i++)
+    {
+        joints.row(i) = position.transpose() * (1.0 + 0.01 * i);
+    }
+
+    const std::string positionJSON = RedisClient::encodeEigenMatrixJSON(position);
+    const std::string orientationJSON = RedisClient::encodeEigenMatrixJSON(orientation);
+    const std::string jointsJSON = RedisClient::encodeEigenMatrixJSON(joints);
+
+    std::string encoded;
+    benchmark.Run("encodeEigenMatrixJSON Vector3d", [&]() { encoded = RedisClient::encodeEigenMatrixJSON(position); });
+    benchmark.Run("encodeEigenMatrixJSON Matrix3d", [&]() { encoded = RedisClient::encodeEigenMatrixJSON(orientation); });
+    benchmark.Run("encodeEigenMatrixJSON 32x3 joints", [&]() { encoded = RedisClient::encodeEigenMatrixJSON(joints); });
+    benchmark.Run("encodeEigenMatrixJSON 32x3, 1 decimal", [&]() { encoded = RedisClient::encodeEigenMatrixJSON(joints, 1); });
+    benchmark.Run("encodeEigenMatrixString 32x3 joints", [&]() { encoded = RedisClient::encodeEigenMatrixString(joints); });
+
+    Eigen::MatrixXd decoded;
+    benchmark.Run("decodeEigenMatrixJSON Vector3d", [&]() { decoded = RedisClient::decodeEigenMatrixJSON(positionJSON); });
+    benchmark.Run("decodeEigenMatrixJSON Matrix3d", [&]() { decoded = RedisClient::decodeEigenMatrixJSON(orientationJSON); });
+    benchmark.Run("decodeEigenMatrixJSON 32x3 joints", [&]() { decoded = RedisClient::decodeEigenMatrixJSON(jointsJSON); });
+
+    // One skeleton in the KEYS layout of simple_3d_viewer_redis: a position and an orientation per joint
+    std::vector<Eigen::Vector3d> positions(JointCount, position);
+    std::vector<Eigen::Matrix3d> orientations(JointCount, orientation);
+    std::vector<std::pair<std::string, std::string>> keyValues;
+    std::vector<std::string> keys;
+    for (int i = 0; i < JointCount; i++)
+    {
+        keyValues.emplace_back(KeyPrefix + "pos::" + std::to_string(i), positionJSON);
+        keyValues.emplace_back(KeyPrefix + "ori::" + std::to_string(i), orientationJSON);
+    }
+    std::vector<std::pair<std::string_view, std::string_view>> keyValueViews;
+    for (const auto& keyValue : keyValues)
+    {
+        keys.push_back(keyValue.first);
+        keyValueViews.emplace_back(keyValue.first, keyValue.second);
+    }
+
+    std::vector<std::string> values;
+    benchmark.Run("pipeset 64 keys", [&]() { redisClient.pipeset(keyValues); });
+    benchmark.Run("pipesetBinary 64 keys", [&]() { redisClient.pipesetBinary(keyValueViews); });
+    benchmark.Run("pipeget 64 keys", [&]() { values = redisClient.pipeget(keys); });
+    benchmark.Run("mset 64 keys", [&]() { redisClient.mset(keyValues); });
+
+    redisClient.createWriteCallback(0);
+    redisClient.createReadCallback(0);
+    for (int i = 0; i < JointCount; i++)
+    {
+        redisClient.addEigenToWriteCallback(0, keys[2 * i], positions[i]);
+        redisClient.addEigenToWriteCallback(0, keys[2 * i + 1], orientations[i]);
+        redisClient.addEigenToReadCallback(0, keys[2 * i], positions[i]);
+        redisClient.addEigenToReadCallback(0, keys[2 * i + 1], orientations[i]);
+    }
+
+    double frame = 0;
+    BenchmarkResult writeResult = benchmark.Run("executeWriteCallback 64 keys", [&]()
+    {
+        positions[0](0) = ++frame;
+        redisClient.executeWriteCallback(0);
+    });
+    BenchmarkResult readResult = benchmark.Run("executeReadCallback 64 keys", [&]() { redisClient.executeReadCallback(0); });
+
+    // The same write and read with every reply split into fragments, so the client keeps receiving
+    // partial replies; its reply buffer must still not grow after warm-up
+    BenchmarkResult fragmentedWriteResult;
+    BenchmarkResult fragmentedReadResult;
+    if (localServer)
+    {
+        server.SetReplyFragments(256, std::chrono::microseconds(20));
+        fragmentedWriteResult = benchmark.Run("executeWriteCallback 64 keys, fragmented", [&]()
+        {
+            positions[0](0) = ++frame;
+            redisClient.executeWriteCallback(0);
+        });
+        server.SetReplyFragments(1024, std::chrono::microseconds(20));
+        fragmentedReadResult = benchmark.Run("executeReadCallback 64 keys, fragmented", [&]() { redisClient.executeReadCallback(0); });
+        server.SetReplyFragments(0, std::chrono::microseconds(0));
+    }
+
+    // The same write without waiting for Redis to acknowledge it
+    redisClient.setDeferredReplies(true);
+    BenchmarkResult deferredWriteResult = benchmark.Run("executeWriteCallback 64 keys, deferred", [&]()
+    {
+        positions[0](0) = ++frame;
+        redisClient.executeWriteCallback(0);
+    });
+    redisClient.setDeferredReplies(false);
+
+    // The same writes with and without deferred replies against a server 200 us away, where the
+    // round trip rather than the client dominates the cost of a frame
+    BenchmarkResult delayedWriteResult;
+    BenchmarkResult delayedDeferredWriteResult;
+    if (localServer)
+    {
+        server.SetRoundTripDelay(std::chrono::microseconds(200));
+        benchmark.Run("pipeset 64 keys, 200 us RTT", [&]() { redisClient.pipeset(keyValues); });
+        delayedWriteResult = benchmark.Run("executeWriteCallback 64 keys, 200 us RTT", [&]()
+        {
+            positions[0](0) = ++frame;
+            redisClient.executeWriteCallback(0);
+        });
+        redisClient.setDeferredReplies(true);
+        benchmark.Run("pipeset 64 keys, deferred, 200 us RTT", [&]() { redisClient.pipeset(keyValues); });
+        delayedDeferredWriteResult = benchmark.Run("executeWriteCallback 64 keys, deferred, 200 us RTT", [&]()
+        {
+            positions[0](0) = ++frame;
+            redisClient.executeWriteCallback(0);
+        });
+        redisClient.setDeferredReplies(false);
+        server.SetRoundTripDelay(std::chrono::microseconds(0));
+    }
+
+    // The same keys as one versioned MULTI/EXEC frame, and read back as one consistent frame
+    const std::vector<int> callbacks = { 0 };
+    const std::string seqKey = KeyPrefix + "frame_seq";
+    const std::string timestampKey = KeyPrefix + "frame_timestamp";
+    BenchmarkResult atomicWriteResult = benchmark.Run("executeWriteCallbacksAtomic 64 keys", [&]()
+    {
+        positions[0](0) = ++frame;
+        redisClient.executeWriteCallbacksAtomic(callbacks, seqKey, timestampKey, static_cast<uint64_t>(frame));
+    });
+    BenchmarkResult consistentReadResult = benchmark.Run("executeReadCallbackConsistent 64 keys", [&]() { redisClient.executeReadCallbackConsistent(0, seqKey); });
+    keys.push_back(seqKey);
+    keys.push_back(timestampKey);
+
+    // The same keys through the same-host shared memory transport
+    const std::string regionName = "/redis_benchmark";
+    SharedMemoryClient sharedMemoryWriter;
+    SharedMemoryClient sharedMemoryReader;
+    sharedMemoryWriter.create(regionName, 2 * JointCount, 256);
+    sharedMemoryReader.open(regionName);
+    sharedMemoryWriter.createWriteCallback(0);
+    sharedMemoryReader.createReadCallback(0);
+    for (int i = 0; i < JointCount; i++)
+    {
+        sharedMemoryWriter.addEigenToWriteCallback(0, keys[2 * i], positions[i]);
+        sharedMemoryWriter.addEigenToWriteCallback(0, keys[2 * i + 1], orientations[i]);
+        sharedMemoryReader.addEigenToReadCallback(0, keys[2 * i], positions[i]);
+        sharedMemoryReader.addEigenToReadCallback(0, keys[2 * i + 1], orientations[i]);
+    }
+    BenchmarkResult sharedMemoryWriteResult = benchmark.Run("SharedMemoryClient write 64 keys", [&]()
+    {
+        positions[0](0) = ++frame;
+        sharedMemoryWriter.executeWriteCallback(0);
+    });
+    BenchmarkResult sharedMemoryReadResult = benchmark.Run("SharedMemoryClient read 64 keys", [&]() { sharedMemoryReader.executeReadCallback(0); });
+    sharedMemoryReader.close();
+    sharedMemoryWriter.close();
+    SharedMemoryClient::remove(regionName);
+
+    // The same keys read on keyspace notifications by a second client, which only GETs the keys
+    // written since its last read
+    RedisClient notifiedReader;
+    notifiedReader.connect(settings.Host, settings.Port);
+    notifiedReader.createReadCallback(0);
+    for (int i = 0; i < JointCount; i++)
+    {
+        notifiedReader.addEigenToReadCallback(0, keys[2 * i], positions[i]);
+        notifiedReader.addEigenToReadCallback(0, keys[2 * i + 1], orientations[i]);
+    }
+    // Only the in-process server is configured; a real server keeps its notify-keyspace-events
+    if (!notifiedReader.enableKeyspaceNotifications(KeyPrefix + "*", 0, localServer))
+    {
+        printf("Keyspace notifications are not enabled on the server, the next two benchmarks read every key\n");
+    }
+    redisClient.createWriteCallback(1);
+    redisClient.addEigenToWriteCallback(1, keys[0], positions[0]);
+    BenchmarkResult unchangedReadResult = benchmark.Run("executeReadCallback 64 keys, 0 changed", [&]() { notifiedReader.executeReadCallback(0); });
+    BenchmarkResult changedReadResult = benchmark.Run("write 1 key + read 64 keys, 1 changed", [&]()
+    {
+        positions[0](0) = ++frame;
+        redisClient.executeWriteCallback(1);
+        notifiedReader.executeReadCallback(0);
+    });
+    notifiedReader.disableKeyspaceNotifications();
+
+    // Producer threads sharing the same write callback through a connection pool, one
+    // connection per thread
+    const size_t maxThreads = 4;
+    RedisClientPool pool;
+    pool.registerCallbacks([&](RedisClient& client)
+    {
+        client.createWriteCallback(0);
+        for (int i = 0; i < JointCount; i++)
+        {
+            client.addEigenToWriteCallback(0, keys[2 * i], positions[i]);
+            client.addEigenToWriteCallback(0, keys[2 * i + 1], orientations[i]);
+        }
+    });
+    pool.connect(settings.Host, settings.Port, maxThreads);
+    printf("\n%-50s %12s\n", "parallel benchmark", "total ops/s");
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        const double opsPerSecond = RunParallel(threads, settings.Iterations, [&]() { pool.acquireLocal()->executeWriteCallback(0); });
+        char name[64];
+        snprintf(name, sizeof(name), "executeWriteCallback 64 keys, %zu thread%s", threads, threads > 1 ? "s" : "");
+        printf("%-50s %12.0f\n", name, opsPerSecond);
+    }
+
+    // The same calls as seen by the instrumentation of RedisClient itself
+    printf("\n%-50s %12s %10s %10s %10s\n", "RedisClient timing", "calls", "p50 [us]", "p99 [us]", "bytes/call");
+    auto printTiming = [](const char* name, const LatencyHistogram& histogram, const RedisTimingStats& stats, uint64_t bytes)
+    {
+        printf("%-50s %12llu %10.2f %10.2f %10.0f\n", name, static_cast<unsigned long long>(histogram.count()),
+               histogram.percentile(0.50) / 1000.0, histogram.percentile(0.99) / 1000.0,
+               stats.calls > 0 ? static_cast<double>(bytes) / stats.calls : 0.0);
+    };
+    const RedisTimingStats& writeTiming = redisClient.writeCallbackTiming(0);
+    const RedisTimingStats& readTiming = redisClient.readCallbackTiming(0);
+    printTiming("write callback 0 encode", writeTiming.encode, writeTiming, writeTiming.bytes_sent);
+    printTiming("write callback 0 round trip", writeTiming.round_trip, writeTiming, writeTiming.bytes_received);
+    printTiming("read callback 0 round trip", readTiming.round_trip, readTiming, readTiming.bytes_received);
+    printTiming("pipeset round trip", redisClient.pipesetTiming().round_trip, redisClient.pipesetTiming(), redisClient.pipesetTiming().bytes_sent);
+    printTiming("pipeget round trip", redisClient.pipegetTiming().round_trip, redisClient.pipegetTiming(), redisClient.pipegetTiming().bytes_received);
+
+    for (const auto& key : keys)
+    {
+        redisClient.del(key);
+    }
+
+    // Callbacks are compiled once, so they must not touch the heap after warm-up
+    int exitCode = 0;
+    if (writeResult.allocationsPerOp != 0 || readResult.allocationsPerOp != 0 || deferredWriteResult.allocationsPerOp != 0 ||
+        fragmentedWriteResult.allocationsPerOp != 0 || fragmentedReadResult.allocationsPerOp != 0 ||
+        delayedWriteResult.allocationsPerOp != 0 || delayedDeferredWriteResult.allocationsPerOp != 0 ||
+        atomicWriteResult.allocationsPerOp != 0 || consistentReadResult.allocationsPerOp != 0 ||
+        sharedMemoryWriteResult.allocationsPerOp != 0 || sharedMemoryReadResult.allocationsPerOp != 0 ||
+        unchangedReadResult.allocationsPerOp != 0 || changedReadResult.allocationsPerOp != 0)
+    {
+        printf("\nFAILED: write or read callbacks allocated after warm-up\n");
+        exitCode = 1;
+    }
+
+    server.Stop();
+    return exitCode;
+}
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include <algorithm>
 #include <array>
 #include <thread>
@@ -75,11 +76,15 @@ void PointCloudRenderer::Create(GLFWwindow* window)
     glGenVertexArrays(1, &m_vertexArrayObject);
     glBindVertexArray(m_vertexArrayObject);
     glGenBuffers(1, &m_vertexBufferObject);
+    glGenVertexArrays(1, &m_depthOnlyVertexArrayObject);
     m_viewIndex = glGetUniformLocation(m_shaderProgram, "view");
     m_projectionIndex = glGetUniformLocation(m_shaderProgram, "projection");
     m_enableShadingIndex = glGetUniformLocation(m_shaderProgram, "enableShading");
+    m_depthOnlyIndex = glGetUniformLocation(m_shaderProgram, "depthOnly");
     m_xyTableSamplerIndex = glGetUniformLocation(m_shaderProgram, "xyTable");
     m_depthSamplerIndex = glGetUniformLocation(m_shaderProgram, "depth");
+    m_enableBodyIndexColorsIndex = glGetUniformLocation(m_shaderProgram, "enableBodyIndexColors");
+    m_bodyIndexColorsIndex = glGetUniformLocation(m_shaderProgram, "bodyIndexColors");
 }
 
 void PointCloudRenderer::Delete()
@@ -91,6 +96,17 @@ void PointCloudRenderer::Delete()
 
     m_initialized = false;
     glDeleteBuffers(1, &m_vertexBufferObject);
+    for (uint32_t i = 0; i < NumDepthUploadBuffers; i++)
+    {
+        if (m_depthUploadFences[i] != nullptr)
+        {
+            glDeleteSync(m_depthUploadFences[i]);
+            m_depthUploadFences[i] = nullptr;
+        }
+    }
+    glDeleteBuffers(NumDepthUploadBuffers, m_depthUploadBuffers.data());
+    m_depthUploadBuffers.fill(0);
+    glDeleteVertexArrays(1, &m_depthOnlyVertexArrayObject);
 
     glDeleteShader(m_vertexShader);
     glDeleteShader(m_fragmentShader);
@@ -107,9 +123,24 @@ void PointCloudRenderer::InitializeDepthXYTable(const float* xyTableInterleaved,
     glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32F, m_width, m_height);
     glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RG, GL_FLOAT, xyTableInterleaved);
 
+    // Storage of the textures is allocated once, the frames only update their contents
     glGenTextures(1, &m_depthTextureObject);
+    glBindTexture(GL_TEXTURE_2D, m_depthTextureObject);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R16UI, m_width, m_height);
+
+    glGenTextures(1, &m_bodyIndexTextureObject);
+    glBindTexture(GL_TEXTURE_2D, m_bodyIndexTextureObject);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8UI, m_width, m_height);
 
     glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenBuffers(NumDepthUploadBuffers, m_depthUploadBuffers.data());
+    for (GLuint buffer : m_depthUploadBuffers)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, m_width * m_height * sizeof(uint16_t), nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
 void PointCloudRenderer::UpdatePointClouds(
@@ -120,22 +151,7 @@ void PointCloudRenderer::UpdatePointClouds(
     uint32_t width, uint32_t height,
     bool useTestPointClouds)
 {
-    if (window != m_window)
-    {
-        Create(window);
-    }
-
-    if (m_width != width && m_height != height)
-    {
-        Fail("Width and Height (%u, %u) does not match the DepthXYTable settings: (%u, %u) are expected!", width, height, m_width, m_height);
-    }
-
-    glBindImageTexture(0, m_xyTableTextureObject, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
-
-    glBindTexture(GL_TEXTURE_2D, m_depthTextureObject);
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R16UI, m_width, m_height);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RED_INTEGER, GL_UNSIGNED_SHORT, depthFrame);
-    glBindImageTexture(1, m_depthTextureObject, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R16UI);
+    UploadDepthFrame(window, depthFrame, width, height);
 
     glBindVertexArray(m_vertexArrayObject);
     // Create buffers and bind the geometry
@@ -165,6 +181,112 @@ void PointCloudRenderer::UpdatePointClouds(
     glBindVertexArray(0);
 
     m_drawArraySize = useTestPointClouds ? 8 : GLsizei(numPoints);
+    m_depthOnly = false;
+}
+
+void PointCloudRenderer::UpdateDepthFrame(
+    GLFWwindow* window,
+    const uint16_t* depthFrame,
+    uint32_t width, uint32_t height)
+{
+    if (m_xyTableTextureObject == 0)
+    {
+        Fail("The DepthXYTable must be initialized to render the depth frame!");
+    }
+
+    UploadDepthFrame(window, depthFrame, width, height);
+
+    m_drawArraySize = GLsizei(m_width * m_height);
+    m_depthOnly = true;
+}
+
+void PointCloudRenderer::UploadDepthFrame(GLFWwindow* window, const uint16_t* depthFrame, uint32_t width, uint32_t height)
+{
+    if (window != m_window)
+    {
+        Create(window);
+    }
+
+    if (m_width != width && m_height != height)
+    {
+        Fail("Width and Height (%u, %u) does not match the DepthXYTable settings: (%u, %u) are expected!", width, height, m_width, m_height);
+    }
+
+    glBindImageTexture(0, m_xyTableTextureObject, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+
+    glBindTexture(GL_TEXTURE_2D, m_depthTextureObject);
+    if (depthFrame != nullptr)
+    {
+        // Wait until the GPU finished the upload that last used this buffer, three frames ago, so it can be overwritten
+        // without synchronizing with the rendering of the frames in between
+        GLsync& fence = m_depthUploadFences[m_depthUploadIndex];
+        if (fence != nullptr)
+        {
+            const GLuint64 timeoutNanoseconds = 1000000000;
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeoutNanoseconds);
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+
+        const GLsizeiptr depthFrameSize = m_width * m_height * sizeof(uint16_t);
+        const GLuint buffer = m_depthUploadBuffers[m_depthUploadIndex];
+        void* mappedBuffer = nullptr;
+        if (buffer != 0)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+            mappedBuffer = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, depthFrameSize,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        }
+
+        if (mappedBuffer != nullptr)
+        {
+            memcpy(mappedBuffer, depthFrame, depthFrameSize);
+        }
+
+        // If the buffer could not be mapped, or its contents were lost while mapped, upload from the frame directly
+        if (mappedBuffer != nullptr && glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RED_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            m_depthUploadIndex = (m_depthUploadIndex + 1) % NumDepthUploadBuffers;
+        }
+        else
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RED_INTEGER, GL_UNSIGNED_SHORT, depthFrame);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindImageTexture(1, m_depthTextureObject, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R16UI);
+}
+
+void PointCloudRenderer::UpdateBodyIndexMap(
+    const uint8_t* bodyIndexMap,
+    const linmath::vec4* bodyColors,
+    uint32_t numBodyColors)
+{
+    // The body index texture is created with the DepthXYTable
+    m_enableBodyIndexColors = bodyIndexMap != nullptr && m_bodyIndexTextureObject != 0;
+    if (!m_enableBodyIndexColors)
+    {
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, m_bodyIndexTextureObject);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RED_INTEGER, GL_UNSIGNED_BYTE, bodyIndexMap);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindImageTexture(2, m_bodyIndexTextureObject, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R8UI);
+
+    // Bodies without a color are blended with white, like the background
+    const linmath::vec4 white = { 1.f, 1.f, 1.f, 1.f };
+    numBodyColors = std::min(numBodyColors, MaxBodyIndexColors);
+    for (uint32_t i = 0; i < MaxBodyIndexColors; i++)
+    {
+        linmath::vec4_copy(m_bodyIndexColors[i], i < numBodyColors ? bodyColors[i] : white);
+    }
 }
 
 void PointCloudRenderer::SetShading(bool enableShading)
@@ -210,9 +332,12 @@ void PointCloudRenderer::Render(int width, int height)
 
     // Update render settings in shader
     glUniform1i(m_enableShadingIndex, (GLint)m_enableShading);
+    glUniform1i(m_depthOnlyIndex, (GLint)m_depthOnly);
+    glUniform1i(m_enableBodyIndexColorsIndex, (GLint)m_enableBodyIndexColors);
+    glUniform4fv(m_bodyIndexColorsIndex, MaxBodyIndexColors, (const GLfloat*)m_bodyIndexColors.data());
 
     // Render point cloud
-    glBindVertexArray(m_vertexArrayObject);
+    glBindVertexArray(m_depthOnly ? m_depthOnlyVertexArrayObject : m_vertexArrayObject);
     glDrawArrays(GL_POINTS, 0, m_drawArraySize);
     glBindVertexArray(0);
 }
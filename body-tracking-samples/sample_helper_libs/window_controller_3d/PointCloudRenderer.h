@@ -11,6 +11,7 @@
 #include "linmath.h"
 #include "WindowController3dTypes.h"
 #include "RendererBase.h"
+#include <array>
 #include <optional>
 
 namespace Visualization
@@ -18,6 +19,11 @@ namespace Visualization
     class PointCloudRenderer : public RendererBase
     {
     public:
+        // Body indices with a color in the body index map, see UpdateBodyIndexMap
+        static constexpr uint32_t MaxBodyIndexColors = 32;
+
+        // Pixel buffers the depth frames are uploaded through, see UploadDepthFrame
+        static constexpr uint32_t NumDepthUploadBuffers = 3;
 
         PointCloudRenderer();
         ~PointCloudRenderer();
@@ -34,6 +40,22 @@ namespace Visualization
             uint32_t width, uint32_t height,
             bool useTestPointClouds = false);
 
+        // Depth only mode: draws one point per pixel of the depth frame and computes its position in the shader from the
+        // DepthXYTable, so only the depth frame is uploaded instead of a vertex per point. Requires InitializeDepthXYTable.
+        // UpdatePointClouds switches back to the vertices it is given.
+        void UpdateDepthFrame(
+            GLFWwindow* window,
+            const uint16_t* depthFrame,
+            uint32_t width, uint32_t height);
+
+        // Colors the points of bodies in the shader: the body index map of the depth frame (one byte per pixel, 255 for
+        // the background) is uploaded as a texture, and bodyColors[i] is blended into the points of body index i, white
+        // into all others. Pass nullptr to stop coloring bodies.
+        void UpdateBodyIndexMap(
+            const uint8_t* bodyIndexMap,
+            const linmath::vec4* bodyColors,
+            uint32_t numBodyColors);
+
         void SetShading(bool enableShading);
 
         void Render() override;
@@ -42,10 +64,15 @@ namespace Visualization
         void ChangePointCloudSize(float pointCloudSize);
 
     private:
+        void UploadDepthFrame(GLFWwindow* window, const uint16_t* depthFrame, uint32_t width, uint32_t height);
+
         // Render settings
         const GLfloat m_defaultPointCloudSize = 0.5f;
         std::optional<GLfloat> m_pointCloudSize;
         bool m_enableShading = false;
+        bool m_depthOnly = false;
+        bool m_enableBodyIndexColors = false;
+        std::array<linmath::vec4, MaxBodyIndexColors> m_bodyIndexColors = {};
 
         // Point Array Size
         GLsizei m_drawArraySize = 0;
@@ -57,15 +84,26 @@ namespace Visualization
         // OpenGL resources
         GLuint m_vertexArrayObject = 0;
         GLuint m_vertexBufferObject = 0;
+        GLuint m_depthOnlyVertexArrayObject = 0;    // Without vertex attributes
 
         GLuint m_xyTableTextureObject = 0;
         GLuint m_depthTextureObject = 0;
+        GLuint m_bodyIndexTextureObject = 0;
+
+        // The depth frame is copied into the next pixel buffer of the ring, from which the GPU updates the depth texture
+        // while the previous frames may still be rendered. A fence per buffer tells when its upload was completed.
+        std::array<GLuint, NumDepthUploadBuffers> m_depthUploadBuffers = {};
+        std::array<GLsync, NumDepthUploadBuffers> m_depthUploadFences = {};
+        uint32_t m_depthUploadIndex = 0;
 
         GLuint m_viewIndex = 0;
         GLuint m_projectionIndex = 0;
         GLuint m_enableShadingIndex = 0;
+        GLuint m_depthOnlyIndex = 0;
         GLuint m_xyTableSamplerIndex = 0;
         GLuint m_depthSamplerIndex = 0;
+        GLuint m_enableBodyIndexColorsIndex = 0;
+        GLuint m_bodyIndexColorsIndex = 0;
 
         // Lock
         std::mutex m_mutex;
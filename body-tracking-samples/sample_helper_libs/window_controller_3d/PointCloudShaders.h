@@ -18,8 +18,18 @@ static const char* const glslPointCloudVertexShader = GLSL_STRING(
     uniform mat4 projection;
     uniform bool enableShading;
 
+    // In depth only mode there are no vertex attributes: one point is drawn per depth pixel, and its position is
+    // computed from the xyTable and depth images
+    uniform bool depthOnly;
+
+    // Colors of the bodies in the body index map, indexed by body index.
+    // The size must match PointCloudRenderer::MaxBodyIndexColors.
+    uniform bool enableBodyIndexColors;
+    uniform vec4 bodyIndexColors[32];
+
     layout(rg32f, binding = 0) restrict readonly uniform image2D xyTable;
     layout(r16ui, binding = 1) restrict readonly uniform uimage2D depth;
+    layout(r8ui, binding = 2) restrict readonly uniform uimage2D bodyIndex;
 
     vec3 ComputePoint3d(ivec2 pixelId)
     {
@@ -40,17 +50,24 @@ static const char* const glslPointCloudVertexShader = GLSL_STRING(
         return vec3(point3d.x, -point3d.y, -point3d.z);
     }
 
-    vec3 ComputeNormal(ivec2 pixelId)
+    // Position of a depth pixel in the Kinect camera coordinate in meters, like the vertex positions of the point cloud
+    vec3 ComputeVertexPosition(ivec2 pixelId)
+    {
+        vec3 point3d = ComputePoint3d(pixelId);
+        return vec3(point3d.x, -point3d.y, -point3d.z);
+    }
+
+    vec3 ComputeNormal(ivec2 pixelId, vec3 position)
     {
         vec3 pointLeft = ComputePoint3d(ivec2(pixelId.x - 1, pixelId.y));
         vec3 pointRight = ComputePoint3d(ivec2(pixelId.x + 1, pixelId.y));
         vec3 pointUp = ComputePoint3d(ivec2(pixelId.x, pixelId.y - 1));
         vec3 pointDown = ComputePoint3d(ivec2(pixelId.x, pixelId.y + 1));
 
-        pointLeft = pointLeft.z == 0 ? vertexPosition : pointLeft;
-        pointRight = pointRight.z == 0 ? vertexPosition : pointRight;
-        pointUp = pointUp.z == 0 ? vertexPosition : pointUp;
-        pointDown = pointDown.z == 0 ? vertexPosition : pointDown;
+        pointLeft = pointLeft.z == 0 ? position : pointLeft;
+        pointRight = pointRight.z == 0 ? position : pointRight;
+        pointUp = pointUp.z == 0 ? position : pointUp;
+        pointDown = pointDown.z == 0 ? position : pointDown;
 
         vec3 xDirection = pointRight - pointLeft;
         vec3 yDirection = pointUp - pointDown;
@@ -60,33 +77,71 @@ static const char* const glslPointCloudVertexShader = GLSL_STRING(
         return normal;
     }
 
+    vec4 ComputeColor(ivec2 pixelId, vec4 baseColor)
+    {
+        if (!enableBodyIndexColors)
+        {
+            return baseColor;
+        }
+
+        // Background pixels are K4ABT_BODY_INDEX_MAP_BACKGROUND (255) and blend with white
+        uint index = imageLoad(bodyIndex, pixelId).x;
+        vec3 bodyColor = index < 32u ? bodyIndexColors[index].rgb : vec3(1, 1, 1);
+
+        // Same blending as Window3dWrapper::BlendBodyColor
+        const float darkenRatio = 0.8f;
+        const float instanceAlpha = 0.8f;
+        return vec4(bodyColor * instanceAlpha + baseColor.rgb * darkenRatio, baseColor.a);
+    }
+
     void main()
     {
-        gl_Position = projection * view * vec4(vertexPosition, 1);
+        ivec2 pixelId = pixelLocation;
+        vec3 position = vertexPosition;
+        vec4 baseColor = vertexColor;
+        if (depthOnly)
+        {
+            int width = imageSize(depth).x;
+            pixelId = ivec2(gl_VertexID % width, gl_VertexID / width);
+            position = ComputeVertexPosition(pixelId);
+            // Same color as Window3dWrapper gives the points of the point cloud
+            baseColor = vec4(0.8f, 0.8f, 0.8f, 0.6f);
+
+            // Pixels without a valid depth are moved outside of the clip volume so they are not drawn
+            if (position.z == 0)
+            {
+                gl_Position = vec4(2, 2, 2, 1);
+                fragmentColor = baseColor;
+                return;
+            }
+        }
+
+        gl_Position = projection * view * vec4(position, 1);
+        vec4 color = ComputeColor(pixelId, baseColor);
 
         if (enableShading)
         {
             const vec3 lightPosition = vec3(0, 0, 0);
-            vec3 vertexNormal = ComputeNormal(pixelLocation);
+            vec3 vertexNormal = ComputeNormal(pixelId, position);
             float diffuse = 0.f;
             if (dot(vertexNormal, vertexNormal) != 0.f)
             {
-                vec3 lightDirection = normalize(lightPosition - vertexPosition);
+                vec3 lightDirection = normalize(lightPosition - position);
                 // Use mix function to reduce the strength of the diffuse effect
                 float defuseRatio = 0.7f;
                 diffuse = mix(1.0f, abs(dot(normalize(vertexNormal), lightDirection)), defuseRatio);
             }
 
-            float distance = length(lightPosition - vertexPosition);
+            float distance = length(lightPosition - position);
             // Attenuation term for light source that covers distance up to 50 meters
             // http://wiki.ogre3d.org/tiki-index.php?page=-Point+Light+Attenuation
             float attenuation = 1.0 / (1.0 + 0.09 * distance + 0.032 * distance * distance);
 
-            fragmentColor = vec4(attenuation * diffuse * vertexColor.rgb, vertexColor.a);
+            fragmentColor = vec4(attenuation * diffuse * color.rgb, color.a);
         }
         else
         {
-            fragmentColor = vertexColor;
+            fragmentColor = color;
         }
     }
 
@@ -3,6 +3,7 @@
 
 #include "Window3dWrapper.h"
 
+#include <algorithm>
 #include <array>
 #include <k4a/k4a.h>
 #include <k4abt.h>
@@ -71,6 +72,7 @@ void Window3dWrapper::SetKeyCallback(
 void Window3dWrapper::Delete()
 {
     m_window3d.Delete();
+    ReleaseFrameImages();
 
     if (m_transformationHandle != nullptr)
     {
@@ -85,9 +87,19 @@ void Window3dWrapper::Delete()
     }
 }
 
-void Window3dWrapper::UpdatePointClouds(k4a_image_t depthImage, std::vector<Color> pointCloudColors)
+void Window3dWrapper::UpdatePointClouds(k4a_image_t depthImage, const std::vector<Color>& pointCloudColors)
 {
+    ReleaseFrameImages();
     m_pointCloudUpdated = true;
+    k4a_image_reference(depthImage);
+    m_depthImage = depthImage;
+
+    m_depthOnly = pointCloudColors.empty();
+    if (m_depthOnly)
+    {
+        return;
+    }
+
     VERIFY(k4a_transformation_depth_image_to_point_cloud(m_transformationHandle,
         depthImage,
         K4A_CALIBRATION_TYPE_DEPTH,
@@ -117,10 +129,7 @@ void Window3dWrapper::UpdatePointClouds(k4a_image_t depthImage, std::vector<Colo
             linmath::vec4 color = { 0.8f, 0.8f, 0.8f, 0.6f };
             linmath::ivec2 pixelLocation = { w, h };
 
-            if (pointCloudColors.size() > 0)
-            {
-                BlendBodyColor(color, pointCloudColors[pixelIndex]);
-            }
+            BlendBodyColor(color, pointCloudColors[pixelIndex]);
 
             linmath::vec3 positionInMeter;
             ConvertMillimeterToMeter(position, positionInMeter);
@@ -133,8 +142,21 @@ void Window3dWrapper::UpdatePointClouds(k4a_image_t depthImage, std::vector<Colo
             m_pointClouds.push_back(pointCloud);
         }
     }
+}
 
-    UpdateDepthBuffer(depthImage);
+void Window3dWrapper::UpdatePointClouds(k4a_image_t depthImage, k4abt_frame_t bodyFrame)
+{
+    UpdatePointClouds(depthImage);
+
+    // The colors of the body index map are looked up once per body
+    m_bodyIndexMap = k4abt_frame_get_body_index_map(bodyFrame);
+    m_numBodyIndexColors = std::min(k4abt_frame_get_num_bodies(bodyFrame), Visualization::PointCloudRenderer::MaxBodyIndexColors);
+    for (uint32_t i = 0; i < m_numBodyIndexColors; i++)
+    {
+        uint32_t bodyId = k4abt_frame_get_body_id(bodyFrame, i);
+        const Color& color = g_bodyColors[bodyId % g_bodyColors.size()];
+        linmath::vec4_set(m_bodyIndexColors[i], color.r, color.g, color.b, color.a);
+    }
 }
 
 void Window3dWrapper::CleanJointsAndBones()
@@ -210,7 +232,20 @@ void Window3dWrapper::Render()
 {
     if (m_pointCloudUpdated || m_pointClouds.size() != 0)
     {
-        m_window3d.UpdatePointClouds(m_pointClouds.data(), (uint32_t)m_pointClouds.size(), m_depthBuffer.data(), m_depthWidth, m_depthHeight);
+        const uint16_t* depthFrame = m_depthImage != nullptr ? (const uint16_t*)k4a_image_get_buffer(m_depthImage) : nullptr;
+        if (m_depthOnly)
+        {
+            m_window3d.UpdateDepthFrame(depthFrame, m_depthWidth, m_depthHeight);
+        }
+        else
+        {
+            m_window3d.UpdatePointClouds(m_pointClouds.data(), (uint32_t)m_pointClouds.size(), depthFrame, m_depthWidth, m_depthHeight);
+        }
+        m_window3d.UpdateBodyIndexMap(
+            m_bodyIndexMap != nullptr ? k4a_image_get_buffer(m_bodyIndexMap) : nullptr,
+            m_bodyIndexColors.data(),
+            m_numBodyIndexColors);
+        ReleaseFrameImages();
         m_pointClouds.clear();
         m_pointCloudUpdated = false;
     }
@@ -300,12 +335,19 @@ void Window3dWrapper::BlendBodyColor(linmath::vec4 color, Color bodyColor)
     color[2] = bodyColor.b * instanceAlpha + color[2] * darkenRatio;
 }
 
-void Window3dWrapper::UpdateDepthBuffer(k4a_image_t depthFrame)
+void Window3dWrapper::ReleaseFrameImages()
 {
-    int width = k4a_image_get_width_pixels(depthFrame);
-    int height = k4a_image_get_height_pixels(depthFrame);
-    uint16_t* depthFrameBuffer = (uint16_t*)k4a_image_get_buffer(depthFrame);
-    m_depthBuffer.assign(depthFrameBuffer, depthFrameBuffer + width * height);
+    if (m_depthImage != nullptr)
+    {
+        k4a_image_release(m_depthImage);
+        m_depthImage = nullptr;
+    }
+
+    if (m_bodyIndexMap != nullptr)
+    {
+        k4a_image_release(m_bodyIndexMap);
+        m_bodyIndexMap = nullptr;
+    }
 }
 
 bool Window3dWrapper::CreateXYDepthTable(const k4a_calibration_t & sensorCalibration)
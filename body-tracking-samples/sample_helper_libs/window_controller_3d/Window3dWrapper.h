@@ -37,7 +37,13 @@ public:
 
     void Delete();
 
-    void UpdatePointClouds(k4a_image_t depthImage, std::vector<Color> pointCloudColors = std::vector<Color>());
+    // Update the point clouds with a depth image. Without pointCloudColors only the depth image is uploaded, and the
+    // points are computed by the shader; with a color per depth pixel the points are built on the CPU.
+    void UpdatePointClouds(k4a_image_t depthImage, const std::vector<Color>& pointCloudColors = std::vector<Color>());
+
+    // Update the point clouds with the depth image of the capture of bodyFrame, and color the points of its bodies by
+    // their id. The body index map is colored by the shader, so there is no per pixel work on the CPU.
+    void UpdatePointClouds(k4a_image_t depthImage, k4abt_frame_t bodyFrame);
 
     void CleanJointsAndBones();
 
@@ -65,7 +71,7 @@ private:
 
     void BlendBodyColor(linmath::vec4 color, Color bodyColor);
 
-    void UpdateDepthBuffer(k4a_image_t depthImage);
+    void ReleaseFrameImages();
 
     bool CreateXYDepthTable(const k4a_calibration_t& sensorCalibration);
 
@@ -73,9 +79,15 @@ private:
     Visualization::WindowController3d m_window3d;
 
     bool m_pointCloudUpdated = false;
-    std::vector<uint16_t> m_depthBuffer;
+    bool m_depthOnly = false;
     std::vector<Visualization::PointCloudVertex> m_pointClouds;
 
+    // Depth image and body index map of the last update, referenced until Render() uploads them from their buffers
+    k4a_image_t m_depthImage = nullptr;
+    k4a_image_t m_bodyIndexMap = nullptr;
+    std::array<linmath::vec4, Visualization::PointCloudRenderer::MaxBodyIndexColors> m_bodyIndexColors = {};
+    uint32_t m_numBodyIndexColors = 0;
+
     struct XY
     {
         float x;
@@ -235,6 +235,21 @@ void WindowController3d::UpdatePointClouds(
     m_pointCloudRenderer.UpdatePointClouds(m_window, point3d, numPoints, depthFrame, width, height, useTestPointClouds);
 }
 
+void WindowController3d::UpdateDepthFrame(
+    const uint16_t* depthFrame,
+    uint32_t width, uint32_t height)
+{
+    m_pointCloudRenderer.UpdateDepthFrame(m_window, depthFrame, width, height);
+}
+
+void WindowController3d::UpdateBodyIndexMap(
+    const uint8_t* bodyIndexMap,
+    const linmath::vec4* bodyColors,
+    uint32_t numBodyColors)
+{
+    m_pointCloudRenderer.UpdateBodyIndexMap(bodyIndexMap, bodyColors, numBodyColors);
+}
+
 void WindowController3d::CleanJointsAndBones()
 {
     m_skeletonRenderer.CleanJointsAndBones();
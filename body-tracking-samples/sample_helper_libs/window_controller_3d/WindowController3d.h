@@ -66,6 +66,17 @@ namespace Visualization
             uint32_t width, uint32_t height,
             bool useTestPointClouds = false);
 
+        // See PointCloudRenderer::UpdateDepthFrame
+        void UpdateDepthFrame(
+            const uint16_t* depthFrame,
+            uint32_t width, uint32_t height);
+
+        // See PointCloudRenderer::UpdateBodyIndexMap
+        void UpdateBodyIndexMap(
+            const uint8_t* bodyIndexMap,
+            const linmath::vec4* bodyColors,
+            uint32_t numBodyColors);
+
         void CleanJointsAndBones();
 
         void AddJoint(const Visualization::Joint& joint);
@@ -2,14 +2,21 @@
 // Licensed under the MIT License.
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <k4arecord/playback.h>
 #include <k4a/k4a.h>
 #include <k4abt.h>
 
 #include <BodyTrackingHelpers.h>
+#include <DropOldestQueue.h>
+#include <LatencyHistogram.h>
 #include <Utilities.h>
 #include <Window3dWrapper.h>
 
@@ -55,7 +62,7 @@ void PrintAppUsage()
 }
 
 // Global State and Key Process Function
-bool s_isRunning = true;
+std::atomic<bool> s_isRunning{ true };
 Visualization::Layout3d s_layoutMode = Visualization::Layout3d::OnlyMainView;
 bool s_visualizeJointFrame = false;
 
@@ -163,40 +170,59 @@ bool ParseInputSettingsFromArg(int argc, char** argv, InputSettings& inputSettin
     return true;
 }
 
-void VisualizeResult(k4abt_frame_t bodyFrame, Window3dWrapper& window3d, int depthWidth, int depthHeight) {
-
-    // Obtain original capture that generates the body tracking result
-    k4a_capture_t originalCapture = k4abt_frame_get_capture(bodyFrame);
-    k4a_image_t depthImage = k4a_capture_get_depth_image(originalCapture);
+// Body tracking result of one frame with everything the window needs to visualize it, so the render loop does not
+// have to query the tracker
+struct RenderFrame
+{
+    k4abt_frame_t bodyFrame = nullptr;  // Holds the body index map
+    k4a_image_t depthImage = nullptr;
+    std::vector<k4abt_body_t> bodies;
+};
 
-    std::vector<Color> pointCloudColors(depthWidth * depthHeight, { 1.f, 1.f, 1.f, 1.f });
+void ReleaseRenderFrame(RenderFrame& frame)
+{
+    if (frame.depthImage != nullptr)
+    {
+        k4a_image_release(frame.depthImage);
+        frame.depthImage = nullptr;
+    }
 
-    // Read body index map and assign colors
-    k4a_image_t bodyIndexMap = k4abt_frame_get_body_index_map(bodyFrame);
-    const uint8_t* bodyIndexMapBuffer = k4a_image_get_buffer(bodyIndexMap);
-    for (int i = 0; i < depthWidth * depthHeight; i++)
+    if (frame.bodyFrame != nullptr)
     {
-        uint8_t bodyIndex = bodyIndexMapBuffer[i];
-        if (bodyIndex != K4ABT_BODY_INDEX_MAP_BACKGROUND)
-        {
-            uint32_t bodyId = k4abt_frame_get_body_id(bodyFrame, bodyIndex);
-            pointCloudColors[i] = g_bodyColors[bodyId % g_bodyColors.size()];
-        }
+        k4abt_frame_release(frame.bodyFrame);
+        frame.bodyFrame = nullptr;
     }
-    k4a_image_release(bodyIndexMap);
+}
 
-    // Visualize point cloud
-    window3d.UpdatePointClouds(depthImage, pointCloudColors);
+// Takes over bodyFrame, which is released with the render frame
+void PrepareRenderFrame(k4abt_frame_t bodyFrame, RenderFrame& frame)
+{
+    frame.bodyFrame = bodyFrame;
+
+    // Obtain original capture that generates the body tracking result
+    k4a_capture_t originalCapture = k4abt_frame_get_capture(bodyFrame);
+    frame.depthImage = k4a_capture_get_depth_image(originalCapture);
+    k4a_capture_release(originalCapture);
 
-    // Visualize the skeleton data
-    window3d.CleanJointsAndBones();
     uint32_t numBodies = k4abt_frame_get_num_bodies(bodyFrame);
+    frame.bodies.resize(numBodies);
     for (uint32_t i = 0; i < numBodies; i++)
     {
-        k4abt_body_t body;
+        k4abt_body_t& body = frame.bodies[i];
         VERIFY(k4abt_frame_get_body_skeleton(bodyFrame, i, &body.skeleton), "Get skeleton from body frame failed!");
         body.id = k4abt_frame_get_body_id(bodyFrame, i);
+    }
+}
+
+void VisualizeResult(const RenderFrame& frame, Window3dWrapper& window3d) {
 
+    // Visualize point cloud, with the bodies colored from the body index map by the shader
+    window3d.UpdatePointClouds(frame.depthImage, frame.bodyFrame);
+
+    // Visualize the skeleton data
+    window3d.CleanJointsAndBones();
+    for (const k4abt_body_t& body : frame.bodies)
+    {
         // Assign the correct color based on the body id
         Color color = g_bodyColors[body.id % g_bodyColors.size()];
         color.a = 0.4f;
@@ -236,10 +262,30 @@ void VisualizeResult(k4abt_frame_t bodyFrame, Window3dWrapper& window3d, int dep
             }
         }
     }
+}
 
-    k4a_capture_release(originalCapture);
-    k4a_image_release(depthImage);
+// Time a pipeline stage spent per frame
+struct StageTiming
+{
+    LatencyHistogram time;
+    uint64_t frames = 0;
+
+    void Record(std::chrono::steady_clock::time_point start)
+    {
+        time.record(std::chrono::steady_clock::now() - start);
+        frames++;
+    }
+};
 
+void PrintStageTiming(const char* name, const StageTiming& timing, uint64_t dropped)
+{
+    printf("%-8s %8llu frames, %6llu dropped, per frame: p50 %6.2f ms, p99 %6.2f ms, max %6.2f ms\n",
+        name,
+        (unsigned long long)timing.frames,
+        (unsigned long long)dropped,
+        timing.time.percentile(0.50) / 1e6,
+        timing.time.percentile(0.99) / 1e6,
+        timing.time.max() / 1e6);
 }
 
 void PlayFile(InputSettings inputSettings)
@@ -273,9 +319,6 @@ void PlayFile(InputSettings inputSettings)
     trackerConfig.model_path = inputSettings.ModelPath.c_str();
     VERIFY(k4abt_tracker_create(&sensorCalibration, trackerConfig, &tracker), "Body tracker initialization failed!");
 
-    int depthWidth = sensorCalibration.depth_camera_calibration.resolution_width;
-    int depthHeight = sensorCalibration.depth_camera_calibration.resolution_height;
-
     window3d.Create("3D Visualization", sensorCalibration);
     window3d.SetCloseCallback(CloseCallback);
     window3d.SetKeyCallback(ProcessKey);
@@ -319,9 +362,11 @@ void PlayFile(InputSettings inputSettings)
             if (popFrameResult == K4A_WAIT_RESULT_SUCCEEDED)
             {
                 /************* Successfully get a body tracking result, process the result here ***************/
-                VisualizeResult(bodyFrame, window3d, depthWidth, depthHeight); 
+                RenderFrame frame;
+                PrepareRenderFrame(bodyFrame, frame);
+                VisualizeResult(frame, window3d);
                 //Release the bodyFrame
-                k4abt_frame_release(bodyFrame);
+                ReleaseRenderFrame(frame);
             }
             else
             {
@@ -357,8 +402,6 @@ void PlayFromDevice(InputSettings inputSettings)
     k4a_calibration_t sensorCalibration;
     VERIFY(k4a_device_get_calibration(device, deviceConfig.depth_mode, deviceConfig.color_resolution, &sensorCalibration),
         "Get depth camera calibration failed!");
-    int depthWidth = sensorCalibration.depth_camera_calibration.resolution_width;
-    int depthHeight = sensorCalibration.depth_camera_calibration.resolution_height;
 
     // Create Body Tracker
     k4abt_tracker_t tracker = nullptr;
@@ -373,50 +416,147 @@ void PlayFromDevice(InputSettings inputSettings)
     window3d.SetCloseCallback(CloseCallback);
     window3d.SetKeyCallback(ProcessKey);
 
-    while (s_isRunning)
+    // Capture, tracking and rendering run on their own threads. The tracker queues a few captures itself and works
+    // on them while the next ones arrive; when its queue is full, the newest capture waits and replaces the older
+    // one, so a capture is never delayed by tracking. Results go to the window through a queue that drops its oldest
+    // entry, so the window always shows the newest body tracking result.
+    DropOldestQueue<RenderFrame, 2> renderQueue(ReleaseRenderFrame);
+    StageTiming captureTiming;
+    StageTiming trackTiming;
+    StageTiming prepareTiming;
+    StageTiming renderTiming;
+    uint64_t capturesDropped = 0;
+
+    // When each capture in the tracker was enqueued; the tracker returns their results in order
+    std::mutex enqueueTimesMutex;
+    std::deque<std::chrono::steady_clock::time_point> enqueueTimes;
+
+    // Capture stage: time between captures of the device
+    std::thread captureThread([&]()
     {
-        k4a_capture_t sensorCapture = nullptr;
-        k4a_wait_result_t getCaptureResult = k4a_device_get_capture(device, &sensorCapture, 0); // timeout_in_ms is set to 0
-
-        if (getCaptureResult == K4A_WAIT_RESULT_SUCCEEDED)
+        k4a_capture_t pendingCapture = nullptr;
+        auto start = std::chrono::steady_clock::now();
+        while (s_isRunning)
         {
-            // timeout_in_ms is set to 0. Return immediately no matter whether the sensorCapture is successfully added
-            // to the queue or not.
-            k4a_wait_result_t queueCaptureResult = k4abt_tracker_enqueue_capture(tracker, sensorCapture, 0);
+            // With a capture waiting for the tracker, wait only briefly so it is retried soon
+            k4a_capture_t sensorCapture = nullptr;
+            k4a_wait_result_t getCaptureResult = k4a_device_get_capture(device, &sensorCapture, pendingCapture != nullptr ? 5 : 1000);
 
-            // Release the sensor capture once it is no longer needed.
-            k4a_capture_release(sensorCapture);
+            if (getCaptureResult == K4A_WAIT_RESULT_SUCCEEDED)
+            {
+                captureTiming.Record(start);
+                start = std::chrono::steady_clock::now();
+                if (pendingCapture != nullptr)
+                {
+                    k4a_capture_release(pendingCapture);
+                    capturesDropped++;
+                }
+                pendingCapture = sensorCapture;
+            }
+            else if (getCaptureResult != K4A_WAIT_RESULT_TIMEOUT)
+            {
+                std::cout << "Get depth capture returned error: " << getCaptureResult << std::endl;
+                s_isRunning = false;
+                break;
+            }
 
-            if (queueCaptureResult == K4A_WAIT_RESULT_FAILED)
+            if (pendingCapture == nullptr)
+            {
+                continue;
+            }
+
+            const auto enqueueTime = std::chrono::steady_clock::now();
+            k4a_wait_result_t queueCaptureResult = k4abt_tracker_enqueue_capture(tracker, pendingCapture, 0);
+            if (queueCaptureResult == K4A_WAIT_RESULT_SUCCEEDED)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(enqueueTimesMutex);
+                    enqueueTimes.push_back(enqueueTime);
+                }
+
+                // Release the sensor capture once it is no longer needed.
+                k4a_capture_release(pendingCapture);
+                pendingCapture = nullptr;
+            }
+            else if (queueCaptureResult == K4A_WAIT_RESULT_FAILED)
             {
                 std::cout << "Error! Add capture to tracker process queue failed!" << std::endl;
+                s_isRunning = false;
                 break;
             }
         }
-        else if (getCaptureResult != K4A_WAIT_RESULT_TIMEOUT)
+
+        if (pendingCapture != nullptr)
         {
-            std::cout << "Get depth capture returned error: " << getCaptureResult << std::endl;
-            break;
+            k4a_capture_release(pendingCapture);
         }
+    });
 
-        // Pop Result from Body Tracker
-        k4abt_frame_t bodyFrame = nullptr;
-        k4a_wait_result_t popFrameResult = k4abt_tracker_pop_result(tracker, &bodyFrame, 0); // timeout_in_ms is set to 0
-        if (popFrameResult == K4A_WAIT_RESULT_SUCCEEDED)
+    // Tracking stage: time from enqueueing a capture to popping its result, which is then prepared for the window
+    std::thread trackThread([&]()
+    {
+        while (s_isRunning)
         {
+            // Pop Result from Body Tracker
+            k4abt_frame_t bodyFrame = nullptr;
+            k4a_wait_result_t popFrameResult = k4abt_tracker_pop_result(tracker, &bodyFrame, 100);
+            if (popFrameResult == K4A_WAIT_RESULT_TIMEOUT)
+            {
+                continue;
+            }
+            if (popFrameResult != K4A_WAIT_RESULT_SUCCEEDED)
+            {
+                std::cout << "Pop body frame result failed!" << std::endl;
+                s_isRunning = false;
+                break;
+            }
+            {
+                std::lock_guard<std::mutex> lock(enqueueTimesMutex);
+                if (!enqueueTimes.empty())
+                {
+                    trackTiming.Record(enqueueTimes.front());
+                    enqueueTimes.pop_front();
+                }
+            }
+
             /************* Successfully get a body tracking result, process the result here ***************/
-            VisualizeResult(bodyFrame, window3d, depthWidth, depthHeight);
-            //Release the bodyFrame
-            k4abt_frame_release(bodyFrame);
+            auto start = std::chrono::steady_clock::now();
+            RenderFrame frame;
+            PrepareRenderFrame(bodyFrame, frame);
+            renderQueue.Push(std::move(frame));
+            prepareTiming.Record(start);
         }
-       
+    });
+
+    // Render stage, on the main thread that owns the window. Render() waits for the vertical sync, so the loop runs
+    // at the display refresh rate whether or not a new frame arrived.
+    while (s_isRunning)
+    {
+        auto start = std::chrono::steady_clock::now();
+        RenderFrame frame;
+        if (renderQueue.Pop(frame, std::chrono::milliseconds(0)))
+        {
+            VisualizeResult(frame, window3d);
+            ReleaseRenderFrame(frame);
+        }
+
         window3d.SetLayout3d(s_layoutMode);
         window3d.SetJointFrameVisualization(s_visualizeJointFrame);
         window3d.Render();
+        renderTiming.Record(start);
     }
 
+    s_isRunning = false;
+    captureThread.join();
+    trackThread.join();
+
     std::cout << "Finished body tracking processing!" << std::endl;
+    PrintStageTiming("Capture", captureTiming, capturesDropped);
+    PrintStageTiming("Track", trackTiming, 0);
+    PrintStageTiming("Prepare", prepareTiming, renderQueue.Dropped());
+    PrintStageTiming("Render", renderTiming, 0);
 
+    renderQueue.Clear();
     window3d.Delete();
     k4abt_tracker_shutdown(tracker);
     k4abt_tracker_destroy(tracker);
@@ -0,0 +1,50 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+// Sleeps until a frame is due. Pacing follows the device timestamps of the recording and
+// restarts whenever they jump backwards, e.g. at a device restart. A speed of 2 replays twice as
+// fast as recorded, 0 as fast as possible.
+class ReplayClock
+{
+public:
+    explicit ReplayClock(double speed)
+        : m_speed(speed)
+    {
+    }
+
+    void WaitFor(uint64_t deviceTimestampUsec)
+    {
+        if (m_speed <= 0)
+        {
+            return;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (!m_started || deviceTimestampUsec < m_firstTimestampUsec)
+        {
+            m_started = true;
+            m_firstTimestampUsec = deviceTimestampUsec;
+            m_replayStart = now;
+            return;
+        }
+
+        auto offset = std::chrono::duration<double, std::micro>((deviceTimestampUsec - m_firstTimestampUsec) / m_speed);
+        auto due = m_replayStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset);
+        if (due > now)
+        {
+            std::this_thread::sleep_until(due);
+        }
+    }
+
+private:
+    const double m_speed;
+    bool m_started = false;
+    uint64_t m_firstTimestampUsec = 0;
+    std::chrono::steady_clock::time_point m_replayStart;
+};
@@ -0,0 +1,259 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include <PackedSkeleton.h>
+
+#include "SkeletonPublisher.h"
+
+// Sidecar file holding the body tracking results of a recording, so repeated OFFLINE runs can
+// publish them without running the tracker again.
+//
+// Layout (little-endian):
+//   header, 32 bytes:    magic "K4SC", format version (uint16), reserved (uint16),
+//                        size of the recording in bytes (uint64), hash of the recording (uint64),
+//                        tracker processing mode (uint32), model path length (uint32),
+//                        followed by the model path
+//   per frame, 24 bytes: frame id (uint64), device timestamp [usec] (uint64), body count (uint32),
+//                        reserved (uint32), followed by one PackedSkeleton per body
+//
+// A cache only matches the recording, processing mode and model path it was written for (see
+// Source), so a cache is never replayed for an edited recording or another tracker setup.
+namespace SkeletonCache
+{
+    const char Magic[4] = { 'K', '4', 'S', 'C' };
+    const uint16_t Version = 2;
+    const size_t HeaderSize = 32;
+    const size_t FrameHeaderSize = 24;
+    const size_t MaxModelPathLength = 4096;
+
+    // Bytes at the start and at the end of the recording that are hashed
+    const uint64_t HashedBytes = 1 << 20;
+
+    // What the tracking results depend on
+    struct Source
+    {
+        uint64_t recordingSize = 0;
+        uint64_t recordingHash = 0;
+        uint32_t processingMode = 0;
+        std::string modelPath;  // empty for the default model
+
+        bool operator==(const Source& other) const
+        {
+            return recordingSize == other.recordingSize && recordingHash == other.recordingHash &&
+                processingMode == other.processingMode && modelPath == other.modelPath;
+        }
+    };
+
+    // Sidecar path of a recording
+    inline std::string PathFor(const std::string& recording)
+    {
+        return recording + ".skeletons";
+    }
+
+    // Source of a recording tracked with processingMode and modelPath. The recording is identified
+    // by its size and an FNV-1a hash of its first and last MB, so an edited recording does not match
+    // without reading all of it. The size is 0 if the recording cannot be read.
+    inline Source SourceFor(const std::string& recording, uint32_t processingMode, const std::string& modelPath)
+    {
+        Source source;
+        source.processingMode = processingMode;
+        source.modelPath = modelPath;
+
+        std::ifstream file(recording, std::ios::binary | std::ios::ate);
+        if (!file)
+        {
+            return source;
+        }
+        const uint64_t size = static_cast<uint64_t>(file.tellg());
+        const uint64_t headEnd = std::min(size, HashedBytes);
+        const uint64_t tailBegin = std::max(headEnd, size > HashedBytes ? size - HashedBytes : 0);
+
+        uint64_t hash = 14695981039346656037ull;
+        std::vector<char> buffer(static_cast<size_t>(headEnd));
+        for (const uint64_t begin : { uint64_t(0), tailBegin })
+        {
+            const uint64_t end = begin == 0 ? headEnd : size;
+            buffer.resize(static_cast<size_t>(end - begin));
+            file.seekg(static_cast<std::streamoff>(begin));
+            if (!file.read(buffer.data(), static_cast<std::streamsize>(buffer.size())))
+            {
+                return source;
+            }
+            for (const char byte : buffer)
+            {
+                hash = (hash ^ static_cast<uint8_t>(byte)) * 1099511628211ull;
+            }
+        }
+        source.recordingSize = size;
+        source.recordingHash = hash;
+        return source;
+    }
+
+    // Writes the frames of one tracking run to a temporary file, which becomes the cache only
+    // when Commit() is called after the last frame, so an interrupted run leaves no partial cache
+    class Writer
+    {
+    public:
+        ~Writer()
+        {
+            if (m_file.is_open())
+            {
+                m_file.close();
+                std::remove(m_tempPath.c_str());
+            }
+        }
+
+        bool Open(const std::string& path, const Source& source)
+        {
+            using RedisEigenBinary::storeLittleEndian;
+
+            if (source.recordingSize == 0 || source.modelPath.size() > MaxModelPathLength)
+            {
+                return false;
+            }
+            m_path = path;
+            m_tempPath = path + ".tmp";
+            m_file.open(m_tempPath, std::ios::binary | std::ios::trunc);
+
+            char header[HeaderSize] = {};
+            std::memcpy(header, Magic, sizeof(Magic));
+            storeLittleEndian<uint16_t>(header + 4, Version);
+            storeLittleEndian<uint64_t>(header + 8, source.recordingSize);
+            storeLittleEndian<uint64_t>(header + 16, source.recordingHash);
+            storeLittleEndian<uint32_t>(header + 24, source.processingMode);
+            storeLittleEndian<uint32_t>(header + 28, static_cast<uint32_t>(source.modelPath.size()));
+            m_file.write(header, sizeof(header));
+            m_file.write(source.modelPath.data(), static_cast<std::streamsize>(source.modelPath.size()));
+            return m_file.good();
+        }
+
+        bool IsOpen() const { return m_file.is_open(); }
+
+        void Write(const SkeletonSnapshot& snapshot)
+        {
+            using RedisEigenBinary::storeLittleEndian;
+
+            const uint32_t numBodies = std::min(snapshot.numBodies, SkeletonSnapshot::MaxBodies);
+            char frameHeader[FrameHeaderSize] = {};
+            storeLittleEndian<uint64_t>(frameHeader, snapshot.frameId);
+            storeLittleEndian<uint64_t>(frameHeader + 8, snapshot.deviceTimestampUsec);
+            storeLittleEndian<uint32_t>(frameHeader + 16, numBodies);
+            m_file.write(frameHeader, sizeof(frameHeader));
+
+            char packed[PackedSkeleton::Size];
+            for (uint32_t i = 0; i < numBodies; ++i)
+            {
+                PackedSkeleton::FrameInfo info;
+                info.frameId = snapshot.frameId;
+                info.deviceTimestampUsec = snapshot.deviceTimestampUsec;
+                info.bodyId = snapshot.bodyIds[i];
+                PackedSkeleton::Encode(info, snapshot.skeletons[i], packed);
+                m_file.write(packed, sizeof(packed));
+            }
+        }
+
+        // Completes the cache. Returns false if a write failed, in which case there is no cache.
+        bool Commit()
+        {
+            m_file.close();
+            if (m_file.fail())
+            {
+                std::remove(m_tempPath.c_str());
+                return false;
+            }
+            // rename() does not replace an existing file on Windows
+            std::remove(m_path.c_str());
+            return std::rename(m_tempPath.c_str(), m_path.c_str()) == 0;
+        }
+
+    private:
+        std::string m_path;
+        std::string m_tempPath;
+        std::ofstream m_file;
+    };
+
+    class Reader
+    {
+    public:
+        // Returns false if there is no cache at path written for source
+        bool Open(const std::string& path, const Source& source)
+        {
+            using RedisEigenBinary::loadLittleEndian;
+
+            m_file.open(path, std::ios::binary);
+            char header[HeaderSize];
+            if (source.recordingSize == 0 || !m_file.read(header, sizeof(header)) ||
+                std::memcmp(header, Magic, sizeof(Magic)) != 0 || loadLittleEndian<uint16_t>(header + 4) != Version)
+            {
+                m_file.close();
+                return false;
+            }
+
+            Source cached;
+            cached.recordingSize = loadLittleEndian<uint64_t>(header + 8);
+            cached.recordingHash = loadLittleEndian<uint64_t>(header + 16);
+            cached.processingMode = loadLittleEndian<uint32_t>(header + 24);
+            const uint32_t modelPathLength = loadLittleEndian<uint32_t>(header + 28);
+            if (modelPathLength > MaxModelPathLength)
+            {
+                m_file.close();
+                return false;
+            }
+            cached.modelPath.resize(modelPathLength);
+            if (!m_file.read(&cached.modelPath[0], modelPathLength) || !(cached == source))
+            {
+                m_file.close();
+                return false;
+            }
+            return true;
+        }
+
+        // Returns false at the end of the cache, or if a frame is malformed
+        bool Read(SkeletonSnapshot& snapshot)
+        {
+            using RedisEigenBinary::loadLittleEndian;
+
+            char frameHeader[FrameHeaderSize];
+            if (!m_file.read(frameHeader, sizeof(frameHeader)))
+            {
+                return false;
+            }
+            snapshot.frameId = loadLittleEndian<uint64_t>(frameHeader);
+            snapshot.deviceTimestampUsec = loadLittleEndian<uint64_t>(frameHeader + 8);
+            snapshot.numBodies = loadLittleEndian<uint32_t>(frameHeader + 16);
+            snapshot.systemTimestampNsec = 0;
+            snapshot.popTimestampNsec = 0;
+            if (snapshot.numBodies > SkeletonSnapshot::MaxBodies)
+            {
+                return false;
+            }
+
+            char packed[PackedSkeleton::Size];
+            for (uint32_t i = 0; i < snapshot.numBodies; ++i)
+            {
+                PackedSkeleton::FrameInfo info;
+                if (!m_file.read(packed, sizeof(packed)) ||
+                    !PackedSkeleton::Decode(packed, sizeof(packed), info, snapshot.skeletons[i]))
+                {
+                    return false;
+                }
+                snapshot.bodyIds[i] = info.bodyId;
+            }
+            return true;
+        }
+
+    private:
+        std::ifstream m_file;
+    };
+}
@@ -0,0 +1,705 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <k4abttypes.h>
+#include <Eigen/Dense>
+
+#include <LatencyHistogram.h>
+#include <LatestValueRing.h>
+#include <PackedSkeleton.h>
+#include <RedisAsyncClient.h>
+#include <RedisClient.h>
+#include <SharedMemoryClient.h>
+
+#include "redis_keys.h"
+
+// All bodies of one body tracking result, copied out of the k4abt frame by the tracker loop
+struct SkeletonSnapshot
+{
+    // Bodies beyond this are not published
+    static constexpr uint32_t MaxBodies = 8;
+
+    uint64_t frameId;
+    uint64_t deviceTimestampUsec;
+
+    // Host time the depth image was captured and the body frame was popped from the tracker, in
+    // nanoseconds of std::chrono::steady_clock (the host clock of k4a system timestamps); 0 if
+    // unknown
+    uint64_t systemTimestampNsec = 0;
+    uint64_t popTimestampNsec = 0;
+
+    uint32_t numBodies;
+    uint32_t bodyIds[MaxBodies];
+    k4abt_skeleton_t skeletons[MaxBodies];
+};
+
+// How skeletons are laid out in Redis
+enum class SkeletonPublishMode
+{
+    // One JSON key per joint position (kinect::pos::*) and rotation matrix (kinect::ori::*)
+    Keys,
+    // One PackedSkeleton value per body in SKELETON_KEY
+    Frame,
+    // Frame, and additionally every body of every frame appended to SKELETON_STREAM_KEY with XADD
+    Stream,
+};
+
+// How frames reach consumers
+enum class SkeletonTransport
+{
+    // SET the keys; consumers poll them
+    Set,
+    // PUBLISH the keys and values on SKELETON_CHANNEL; subscribers wake up on every frame
+    Publish,
+    SetAndPublish,
+};
+
+// Publishes skeleton snapshots to Redis from a dedicated thread.
+//
+// The tracker loop hands snapshots over through a LatestValueRing, so Publish() never waits
+// on Redis. When Redis falls behind, the publisher skips straight to the newest snapshot and
+// the skipped ones are reported by DroppedCount().
+//
+// Every body is written under its BodyKey() keys, the first body additionally under the plain
+// keys, and the ids of the tracked bodies under BODY_IDS_KEY and BODY_COUNT_KEY. All keys of a
+// frame go out in one pipelined batch, together with the frame time keys (FRAME_DEVICE_TIME_KEY
+// etc.), the PUBLISH message and the XADD of every body in Stream mode. Every LATENCY_WINDOW_MS,
+// the latency percentiles of the frames since are added to it. Once the buffers have grown, a
+// frame is written without heap allocations, except when keys are registered for a new body id.
+class SkeletonPublisher
+{
+public:
+    static constexpr size_t QueueCapacity = 4;
+
+    // Registers write callbacks writeCallbackNumber to writeCallbackNumber + MaxBodies + 2 for
+    // the selected mode. The registered objects are only touched by the publisher thread between
+    // Start() and Stop(). streamMaxLength is the approximate number of entries kept in Stream
+    // mode (0 for unbounded).
+    SkeletonPublisher(
+        RedisClient& redisClient,
+        SkeletonPublishMode mode,
+        SkeletonTransport transport = SkeletonTransport::Set,
+        int writeCallbackNumber = 0,
+        size_t streamMaxLength = SKELETON_STREAM_MAXLEN)
+        : m_redisClient(redisClient)
+        , m_mode(mode)
+        , m_transport(transport)
+        , m_streamMaxLength(streamMaxLength)
+        , m_firstBodyCallback(writeCallbackNumber)
+        , m_bodyListCallback(writeCallbackNumber + 1)
+        , m_latencyCallback(writeCallbackNumber + 2 + static_cast<int>(SkeletonSnapshot::MaxBodies))
+    {
+        // The MAXLEN argument of every XADD
+        FormatUnsigned(m_streamMaxLengthText, m_streamMaxLength);
+
+        m_redisClient.createWriteCallback(m_firstBodyCallback);
+        RegisterBody(m_firstBodyCallback, m_firstBody, [](const std::string& key) { return key; });
+
+        m_redisClient.createWriteCallback(m_bodyListCallback);
+        m_redisClient.setWriteCallbackExpiry(m_bodyListCallback, BODY_KEY_EXPIRY_MS);
+        m_redisClient.addStringToWriteCallback(m_bodyListCallback, BODY_IDS_KEY, m_bodyIds);
+        m_redisClient.addIntToWriteCallback(m_bodyListCallback, BODY_COUNT_KEY, m_bodyCount);
+        m_redisClient.addStringToWriteCallback(m_bodyListCallback, FRAME_DEVICE_TIME_KEY, m_deviceTime);
+        m_redisClient.addStringToWriteCallback(m_bodyListCallback, FRAME_SYSTEM_TIME_KEY, m_systemTime);
+        m_redisClient.addStringToWriteCallback(m_bodyListCallback, FRAME_PUBLISH_TIME_KEY, m_publishTime);
+
+        m_redisClient.createWriteCallback(m_latencyCallback);
+        m_redisClient.addStringToWriteCallback(m_latencyCallback, LATENCY_CAPTURE_TO_POP_KEY, m_captureToPopJson);
+        m_redisClient.addStringToWriteCallback(m_latencyCallback, LATENCY_POP_TO_PUBLISH_KEY, m_popToPublishJson);
+
+        for (uint32_t i = 0; i < SkeletonSnapshot::MaxBodies; ++i)
+        {
+            m_bodies[i].callbackNumber = writeCallbackNumber + 2 + static_cast<int>(i);
+        }
+        m_batch.reserve(SkeletonSnapshot::MaxBodies + 3);
+    }
+
+    ~SkeletonPublisher()
+    {
+        Stop();
+    }
+
+    void Start()
+    {
+        if (m_thread.joinable())
+        {
+            return;
+        }
+        m_running = true;
+        m_thread = std::thread(&SkeletonPublisher::Run, this);
+    }
+
+    // Publishes the newest snapshot still queued, dropping older ones, and joins the publisher
+    // thread
+    void Stop()
+    {
+        if (!m_thread.joinable())
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_wakeupMutex);
+            m_running = false;
+        }
+        m_wakeup.notify_one();
+        m_thread.join();
+    }
+
+    // Sends all frames through asyncClient, which survives Redis outages, instead of the
+    // blocking connection of redisClient. redisClient then only holds the write callbacks and
+    // needs no connection. Must be called before Start().
+    void SetAsyncClient(RedisAsyncClient* asyncClient)
+    {
+        m_asyncClient = asyncClient;
+    }
+
+    // Writes all keys of a frame as one MULTI/EXEC transaction that also increments
+    // FRAME_SEQ_KEY and sets FRAME_TIMESTAMP_KEY, so readers never see keys of two frames.
+    // Streams and Pub/Sub messages are not affected. Must be called before Start().
+    void SetAtomic(bool atomic)
+    {
+        m_atomic = atomic;
+    }
+
+    // Additionally writes the plain keys of the first body, BODY_IDS_KEY, BODY_COUNT_KEY and the
+    // frame time keys into a shared memory region created by sharedMemory, for consumers on the
+    // same host. They are written before Redis and independent of its state. Must be called
+    // before Start().
+    void SetSharedMemory(SharedMemoryClient* sharedMemory)
+    {
+        m_sharedMemory = sharedMemory;
+        m_sharedMemory->createWriteCallback(m_firstBodyCallback);
+        if (m_mode != SkeletonPublishMode::Keys)
+        {
+            m_sharedMemory->addStringToWriteCallback(m_firstBodyCallback, SKELETON_KEY, m_firstBody.packed);
+        }
+        else
+        {
+            for (size_t i = 0; i < m_firstBody.pos.size(); ++i)
+            {
+                m_sharedMemory->addEigenToWriteCallback(m_firstBodyCallback, kinect_pos_keys[i], m_firstBody.pos[i]);
+                m_sharedMemory->addEigenToWriteCallback(m_firstBodyCallback, kinect_ori_keys[i], m_firstBody.ori[i]);
+            }
+        }
+        m_sharedMemory->createWriteCallback(m_bodyListCallback);
+        m_sharedMemory->addStringToWriteCallback(m_bodyListCallback, BODY_IDS_KEY, m_bodyIds);
+        m_sharedMemory->addIntToWriteCallback(m_bodyListCallback, BODY_COUNT_KEY, m_bodyCount);
+        m_sharedMemory->addStringToWriteCallback(m_bodyListCallback, FRAME_DEVICE_TIME_KEY, m_deviceTime);
+        m_sharedMemory->addStringToWriteCallback(m_bodyListCallback, FRAME_SYSTEM_TIME_KEY, m_systemTime);
+        m_sharedMemory->addStringToWriteCallback(m_bodyListCallback, FRAME_PUBLISH_TIME_KEY, m_publishTime);
+    }
+
+    // Only rewrites joints whose position moved more than positionMm or whose rotation matrix
+    // changed by more than orientation (about the angle in radians) since they were last
+    // written; every joint is still rewritten every DEADBAND_REFRESH_MS. KEYS mode only, since
+    // FRAME values change with every frame. Must be called before Start().
+    void SetDeadband(double positionMm, double orientation)
+    {
+        m_positionDeadband = positionMm;
+        m_orientationDeadband = orientation;
+        m_redisClient.setWriteCallbackDeadband(m_firstBodyCallback, positionMm, orientation, DEADBAND_REFRESH_MS);
+        for (BodyObjects& body : m_bodies)
+        {
+            if (body.assigned)
+            {
+                m_redisClient.setWriteCallbackDeadband(body.callbackNumber, positionMm, orientation, DEADBAND_REFRESH_MS);
+            }
+        }
+    }
+
+    // Writes joint positions with a fixed number of decimals (millimetres) instead of the
+    // shortest lossless text, e.g. 1 for 0.1 mm, which shortens the JSON values. Rotation
+    // matrices stay lossless. KEYS mode only. Must be called before Start().
+    void SetPositionPrecision(int decimals)
+    {
+        m_positionPrecision = decimals;
+        m_redisClient.setWriteCallbackPrecision(m_firstBodyCallback, decimals);
+        for (BodyObjects& body : m_bodies)
+        {
+            if (body.assigned)
+            {
+                m_redisClient.setWriteCallbackPrecision(body.callbackNumber, decimals);
+            }
+        }
+    }
+
+    // Called from the tracker loop. Never blocks on Redis. The frame id is assigned here.
+    void Publish(SkeletonSnapshot& snapshot)
+    {
+        snapshot.frameId = m_nextFrameId++;
+        m_queue.Push(snapshot);
+        {
+            // Taking the mutex orders the push against the publisher thread checking the queue
+            // before it sleeps, so the wakeup cannot be lost. It is only contended for that check.
+            std::lock_guard<std::mutex> lock(m_wakeupMutex);
+        }
+        m_wakeup.notify_one();
+    }
+
+    // Writes a snapshot on the calling thread, e.g. when replaying a recording where no frame
+    // may be skipped. Only valid while the publisher thread is not running.
+    void PublishNow(const SkeletonSnapshot& snapshot)
+    {
+        WriteSnapshot(snapshot);
+    }
+
+    // Snapshots skipped because a newer one arrived before they were sent
+    uint64_t DroppedCount() const { return m_queue.Dropped(); }
+
+    // Snapshots waiting for the publisher thread
+    size_t QueueDepth() const { return m_queue.Depth(); }
+
+    // Snapshots written to Redis / failed to write
+    uint64_t PublishedCount() const { return m_published.load(std::memory_order_relaxed); }
+    uint64_t ErrorCount() const { return m_errors.load(std::memory_order_relaxed); }
+
+    // Keys SET so far, and keys skipped by the deadband. Only valid while the publisher thread
+    // is not running.
+    RedisClient::WriteCallbackStats KeyWriteStats()
+    {
+        RedisClient::WriteCallbackStats stats = m_removedBodyStats;
+        AddKeyWriteStats(stats, m_firstBodyCallback);
+        AddKeyWriteStats(stats, m_bodyListCallback);
+        AddKeyWriteStats(stats, m_latencyCallback);
+        for (const BodyObjects& body : m_bodies)
+        {
+            if (body.assigned)
+            {
+                AddKeyWriteStats(stats, body.callbackNumber);
+            }
+        }
+        return stats;
+    }
+
+    // Encoding, round trip and traffic of all key writes, see RedisClient::writeCallbackTiming().
+    // Only valid while the publisher thread is not running.
+    RedisTimingStats KeyWriteTiming()
+    {
+        RedisTimingStats timing = m_removedBodyTiming;
+        timing.merge(m_redisClient.writeCallbackTiming(m_firstBodyCallback));
+        timing.merge(m_redisClient.writeCallbackTiming(m_bodyListCallback));
+        timing.merge(m_redisClient.writeCallbackTiming(m_latencyCallback));
+        for (const BodyObjects& body : m_bodies)
+        {
+            if (body.assigned)
+            {
+                timing.merge(m_redisClient.writeCallbackTiming(body.callbackNumber));
+            }
+        }
+        return timing;
+    }
+
+    // Latency of all published frames from the depth image capture to popping the body frame,
+    // and from popping to sending it. Only valid while the publisher thread is not running.
+    LatencyHistogram CaptureToPopLatency() const
+    {
+        LatencyHistogram latency = m_captureToPop;
+        latency.merge(m_captureToPopWindow);
+        return latency;
+    }
+
+    LatencyHistogram PopToPublishLatency() const
+    {
+        LatencyHistogram latency = m_popToPublish;
+        latency.merge(m_popToPublishWindow);
+        return latency;
+    }
+
+private:
+    // Objects registered with the write callback of one body
+    struct BodyObjects
+    {
+        int callbackNumber = -1;
+        bool assigned = false;
+        uint32_t bodyId = 0;
+        std::vector<Eigen::Vector3d> pos;
+        std::vector<Eigen::Matrix3d> ori;
+        std::string packed;
+    };
+
+    template<typename KeyFunction>
+    void RegisterBody(int callbackNumber, BodyObjects& body, KeyFunction key)
+    {
+        if (m_mode != SkeletonPublishMode::Keys)
+        {
+            body.packed.assign(PackedSkeleton::Size, '\0');
+            m_redisClient.addStringToWriteCallback(callbackNumber, key(SKELETON_KEY), body.packed);
+            return;
+        }
+
+        body.pos.assign(kinect_pos_keys.size(), Eigen::Vector3d::Zero());
+        body.ori.assign(kinect_ori_keys.size(), Eigen::Matrix3d::Identity());
+        for (size_t i = 0; i < kinect_pos_keys.size(); ++i)
+        {
+            m_redisClient.addEigenToWriteCallback(callbackNumber, key(kinect_pos_keys[i]), body.pos[i]);
+            m_redisClient.addEigenToWriteCallback(callbackNumber, key(kinect_ori_keys[i]), body.ori[i]);
+        }
+    }
+
+    // Returns the per-body objects of bodyId, registering its keys if the id is new. Ids are
+    // stable while a person stays in view, so keys are only registered when someone enters.
+    BodyObjects& AssignBody(uint32_t bodyId, const SkeletonSnapshot& snapshot)
+    {
+        for (BodyObjects& body : m_bodies)
+        {
+            if (body.assigned && body.bodyId == bodyId)
+            {
+                return body;
+            }
+        }
+
+        // Reuse a slot whose body is not in this frame. There is always one, since a frame
+        // never holds more than MaxBodies bodies.
+        BodyObjects* slot = &m_bodies[0];
+        for (BodyObjects& body : m_bodies)
+        {
+            bool inFrame = false;
+            for (uint32_t i = 0; i < snapshot.numBodies && body.assigned; ++i)
+            {
+                inFrame = inFrame || snapshot.bodyIds[i] == body.bodyId;
+            }
+            if (!inFrame)
+            {
+                slot = &body;
+                break;
+            }
+        }
+
+        if (slot->assigned)
+        {
+            AddKeyWriteStats(m_removedBodyStats, slot->callbackNumber);
+            m_removedBodyTiming.merge(m_redisClient.writeCallbackTiming(slot->callbackNumber));
+            m_redisClient.removeWriteCallback(slot->callbackNumber);
+        }
+        slot->assigned = true;
+        slot->bodyId = bodyId;
+        m_redisClient.createWriteCallback(slot->callbackNumber);
+        m_redisClient.setWriteCallbackExpiry(slot->callbackNumber, BODY_KEY_EXPIRY_MS);
+        m_redisClient.setWriteCallbackDeadband(slot->callbackNumber, m_positionDeadband, m_orientationDeadband, DEADBAND_REFRESH_MS);
+        m_redisClient.setWriteCallbackPrecision(slot->callbackNumber, m_positionPrecision);
+        RegisterBody(slot->callbackNumber, *slot, [bodyId](const std::string& key) { return BodyKey(bodyId, key); });
+        return *slot;
+    }
+
+    static uint64_t SteadyClockNsec()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // Decimal text of value, without allocating once the string has grown to its length
+    static void FormatUnsigned(std::string& out, uint64_t value)
+    {
+        char buffer[24];
+        const std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out.assign(buffer, result.ptr);
+    }
+
+    // Records the latency of a frame and, once a window is over, adds its percentiles to the batch
+    void RecordLatency(const SkeletonSnapshot& snapshot, uint64_t publishNsec)
+    {
+        if (snapshot.popTimestampNsec != 0)
+        {
+            if (snapshot.systemTimestampNsec != 0 && snapshot.popTimestampNsec >= snapshot.systemTimestampNsec)
+            {
+                m_captureToPopWindow.record(snapshot.popTimestampNsec - snapshot.systemTimestampNsec);
+            }
+            m_popToPublishWindow.record(publishNsec - std::min(publishNsec, snapshot.popTimestampNsec));
+        }
+
+        if (m_latencyWindowEnd == 0)
+        {
+            m_latencyWindowEnd = publishNsec + LATENCY_WINDOW_MS * 1000000ull;
+        }
+        if (publishNsec < m_latencyWindowEnd)
+        {
+            return;
+        }
+        m_latencyWindowEnd = publishNsec + LATENCY_WINDOW_MS * 1000000ull;
+        if (m_captureToPopWindow.count() == 0 && m_popToPublishWindow.count() == 0)
+        {
+            return;
+        }
+        FormatLatencyJson(m_captureToPopJson, m_captureToPopWindow);
+        FormatLatencyJson(m_popToPublishJson, m_popToPublishWindow);
+        m_captureToPop.merge(m_captureToPopWindow);
+        m_popToPublish.merge(m_popToPublishWindow);
+        m_captureToPopWindow.reset();
+        m_popToPublishWindow.reset();
+        m_batch.push_back(m_latencyCallback);
+    }
+
+    // {"p50":..,"p90":..,"p99":..,"max":..,"count":..} in microseconds, reusing the string
+    static void FormatLatencyJson(std::string& out, const LatencyHistogram& histogram)
+    {
+        const std::pair<const char*, uint64_t> fields[] = {
+            { "{\"p50\":", histogram.percentile(0.50) / 1000 },
+            { ",\"p90\":", histogram.percentile(0.90) / 1000 },
+            { ",\"p99\":", histogram.percentile(0.99) / 1000 },
+            { ",\"max\":", histogram.max() / 1000 },
+            { ",\"count\":", histogram.count() },
+        };
+        out.clear();
+        for (const auto& field : fields)
+        {
+            char buffer[24];
+            out.append(field.first).append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), field.second).ptr);
+        }
+        out.append("}");
+    }
+
+    void AddKeyWriteStats(RedisClient::WriteCallbackStats& stats, int callbackNumber)
+    {
+        RedisClient::WriteCallbackStats callbackStats = m_redisClient.writeCallbackStats(callbackNumber);
+        stats.written += callbackStats.written;
+        stats.suppressed += callbackStats.suppressed;
+    }
+
+    void FillBody(BodyObjects& body, const SkeletonSnapshot& snapshot, uint32_t index)
+    {
+        const k4abt_skeleton_t& skeleton = snapshot.skeletons[index];
+        if (m_mode != SkeletonPublishMode::Keys)
+        {
+            PackedSkeleton::FrameInfo info;
+            info.frameId = snapshot.frameId;
+            info.deviceTimestampUsec = snapshot.deviceTimestampUsec;
+            info.bodyId = snapshot.bodyIds[index];
+            PackedSkeleton::Encode(info, skeleton, &body.packed[0]);
+            return;
+        }
+
+        for (size_t i = 0; i < body.pos.size(); ++i)
+        {
+            body.pos[i] = Eigen::Vector3d(skeleton.joints[i].position.v[0], skeleton.joints[i].position.v[1], skeleton.joints[i].position.v[2]);
+            body.ori[i] = Eigen::Quaterniond(skeleton.joints[i].orientation.v[0], skeleton.joints[i].orientation.v[1], skeleton.joints[i].orientation.v[2], skeleton.joints[i].orientation.v[3]).toRotationMatrix();
+        }
+    }
+
+    void Run()
+    {
+        SkeletonSnapshot snapshot;
+        while (true)
+        {
+            if (!m_queue.PopLatest(snapshot))
+            {
+                if (!m_running)
+                {
+                    break;
+                }
+                std::unique_lock<std::mutex> lock(m_wakeupMutex);
+                m_wakeup.wait(lock, [this] { return m_queue.Depth() > 0 || !m_running; });
+                continue;
+            }
+
+            WriteSnapshot(snapshot);
+        }
+    }
+
+    void WriteSnapshot(const SkeletonSnapshot& snapshot)
+    {
+        try
+        {
+            const uint32_t numBodies = std::min(snapshot.numBodies, SkeletonSnapshot::MaxBodies);
+
+            m_batch.clear();
+            m_bodyIds.assign("[");
+            for (uint32_t i = 0; i < numBodies; ++i)
+            {
+                BodyObjects& body = AssignBody(snapshot.bodyIds[i], snapshot);
+                FillBody(body, snapshot, i);
+                m_batch.push_back(body.callbackNumber);
+
+                char buffer[16];
+                m_bodyIds.append(i > 0 ? "," : "").append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), snapshot.bodyIds[i]).ptr);
+            }
+            m_bodyIds.append("]");
+            m_bodyCount = static_cast<int>(numBodies);
+            m_batch.push_back(m_bodyListCallback);
+
+            // Stamped after the frame is encoded, right before it is sent
+            const uint64_t publishNsec = SteadyClockNsec();
+            FormatUnsigned(m_deviceTime, snapshot.deviceTimestampUsec);
+            FormatUnsigned(m_systemTime, snapshot.systemTimestampNsec);
+            FormatUnsigned(m_publishTime, publishNsec);
+            RecordLatency(snapshot, publishNsec);
+
+            // The plain keys keep the first body, and its last skeleton while nobody is tracked
+            if (numBodies > 0)
+            {
+                FillBody(m_firstBody, snapshot, 0);
+                m_batch.push_back(m_firstBodyCallback);
+            }
+
+            if (m_sharedMemory != nullptr)
+            {
+                m_sharedMemoryBatch.assign(1, m_bodyListCallback);
+                if (numBodies > 0)
+                {
+                    m_sharedMemoryBatch.push_back(m_firstBodyCallback);
+                }
+                m_sharedMemory->executeWriteCallbacks(m_sharedMemoryBatch);
+            }
+
+            if (m_asyncClient != nullptr)
+            {
+                SendAsync(snapshot, numBodies);
+                m_published.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            // The PUBLISH message and the XADDs follow the SETs in the same batch
+            m_commands.clear();
+            size_t numCommands = 0;
+            if (m_transport != SkeletonTransport::Set)
+            {
+                numCommands += m_redisClient.formatPublishWriteCallbacks(m_batch, SKELETON_CHANNEL, m_commands);
+            }
+            numCommands += AppendStreamCommands(snapshot, numBodies, m_commands);
+
+            if (m_transport == SkeletonTransport::Publish)
+            {
+                m_redisClient.executeWriteCallbacks(m_noCallbacks, m_commands, numCommands);
+            }
+            else if (m_atomic)
+            {
+                m_redisClient.executeWriteCallbacksAtomic(m_batch, FRAME_SEQ_KEY, FRAME_TIMESTAMP_KEY, snapshot.deviceTimestampUsec,
+                                                          m_commands, numCommands);
+            }
+            else
+            {
+                m_redisClient.executeWriteCallbacks(m_batch, m_commands, numCommands);
+            }
+            m_published.fetch_add(1, std::memory_order_relaxed);
+        }
+        catch (const std::runtime_error& e)
+        {
+            // Keep tracking through Redis failures; report only the first one
+            if (m_errors.fetch_add(1, std::memory_order_relaxed) == 0)
+            {
+                std::cout << "Skeleton publisher: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    // Queues all commands of a frame as one batch on the async client
+    void SendAsync(const SkeletonSnapshot& snapshot, uint32_t numBodies)
+    {
+        m_asyncBatch.clear();
+        if (m_transport != SkeletonTransport::Publish && m_atomic)
+        {
+            m_redisClient.formatWriteCallbacksAtomic(m_batch, FRAME_SEQ_KEY, FRAME_TIMESTAMP_KEY, snapshot.deviceTimestampUsec, m_asyncBatch);
+        }
+        else if (m_transport != SkeletonTransport::Publish)
+        {
+            m_redisClient.formatWriteCallbacks(m_batch, m_asyncBatch);
+        }
+        if (m_transport != SkeletonTransport::Set)
+        {
+            m_redisClient.formatPublishWriteCallbacks(m_batch, SKELETON_CHANNEL, m_asyncBatch);
+        }
+        AppendStreamCommands(snapshot, numBodies, m_asyncBatch);
+        m_asyncClient->send(m_asyncBatch);
+    }
+
+    // Appends the XADD of every body in Stream mode to out and returns their number
+    size_t AppendStreamCommands(const SkeletonSnapshot& snapshot, uint32_t numBodies, std::string& out)
+    {
+        if (m_mode != SkeletonPublishMode::Stream)
+        {
+            return 0;
+        }
+
+        for (uint32_t i = 0; i < numBodies; ++i)
+        {
+            const std::string& packed = AssignBody(snapshot.bodyIds[i], snapshot).packed;
+            const char* argv[] = { "XADD", SKELETON_STREAM_KEY.data(), "MAXLEN", "~", m_streamMaxLengthText.data(), "*", SKELETON_STREAM_FIELD.data(), packed.data() };
+            const size_t argvlen[] = { 4, SKELETON_STREAM_KEY.size(), 6, 1, m_streamMaxLengthText.size(), 1, SKELETON_STREAM_FIELD.size(), packed.size() };
+            if (m_streamMaxLength > 0)
+            {
+                RedisAsyncClient::appendCommandArgv(out, 8, argv, argvlen);
+            }
+            else
+            {
+                // Without the MAXLEN ~ <n> arguments
+                const char* unboundedArgv[] = { argv[0], argv[1], argv[5], argv[6], argv[7] };
+                const size_t unboundedArgvlen[] = { argvlen[0], argvlen[1], argvlen[5], argvlen[6], argvlen[7] };
+                RedisAsyncClient::appendCommandArgv(out, 5, unboundedArgv, unboundedArgvlen);
+            }
+        }
+        return numBodies;
+    }
+
+    RedisClient& m_redisClient;
+    RedisAsyncClient* m_asyncClient = nullptr;
+    SharedMemoryClient* m_sharedMemory = nullptr;
+    const SkeletonPublishMode m_mode;
+    const SkeletonTransport m_transport;
+    const size_t m_streamMaxLength;
+    std::string m_streamMaxLengthText;
+    bool m_atomic = false;
+
+    // Objects registered with the write callbacks
+    const int m_firstBodyCallback;
+    const int m_bodyListCallback;
+    const int m_latencyCallback;
+    BodyObjects m_firstBody;
+    std::array<BodyObjects, SkeletonSnapshot::MaxBodies> m_bodies;
+    std::string m_bodyIds;
+    int m_bodyCount = 0;
+    std::string m_deviceTime;
+    std::string m_systemTime;
+    std::string m_publishTime;
+    std::string m_captureToPopJson;
+    std::string m_popToPublishJson;
+
+    // Latency of the current window, and of all windows before it
+    LatencyHistogram m_captureToPopWindow;
+    LatencyHistogram m_popToPublishWindow;
+    LatencyHistogram m_captureToPop;
+    LatencyHistogram m_popToPublish;
+    uint64_t m_latencyWindowEnd = 0;
+
+    // Deadband of the joint keys, and statistics of body callbacks already removed
+    double m_positionDeadband = 0;
+    double m_orientationDeadband = 0;
+    RedisClient::WriteCallbackStats m_removedBodyStats;
+    RedisTimingStats m_removedBodyTiming;
+
+    // Decimals of the joint positions, -1 for lossless
+    int m_positionPrecision = -1;
+
+    // Write callbacks of the current frame, the commands sent after their SETs, and all commands
+    // for the async client
+    std::vector<int> m_batch;
+    const std::vector<int> m_noCallbacks;
+    std::string m_commands;
+    std::string m_asyncBatch;
+    std::vector<int> m_sharedMemoryBatch;
+
+    LatestValueRing<SkeletonSnapshot, QueueCapacity> m_queue;
+    uint64_t m_nextFrameId = 0;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running{ false };
+    std::mutex m_wakeupMutex;
+    std::condition_variable m_wakeup;
+
+    std::atomic<uint64_t> m_published{ 0 };
+    std::atomic<uint64_t> m_errors{ 0 };
+};
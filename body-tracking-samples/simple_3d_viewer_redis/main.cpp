@@ -1,7 +1,10 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // Licensed under the MIT License.
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
 #include <map>
 #include <vector>
@@ -16,6 +19,10 @@
 #include <RedisClient.h>
 #include <Eigen/Dense>
 
+#include "ReplayClock.h"
+#include "SkeletonCache.h"
+#include "SkeletonPublisher.h"
+
 void PrintUsage()
 {
 #ifdef _WIN32
@@ -34,10 +41,48 @@ void PrintUsage()
 #endif
     printf("      TENSORRT - Use the TensorRT processing mode.\n");
     printf("      OFFLINE - Play a specified file. Does not require Kinect device\n");
+    printf("  - PublishMode: -publish KEYS|FRAME|STREAM (optional)\n");
+    printf("      KEYS (default) - One Redis key per joint position and orientation (kinect::pos::*, kinect::ori::*)\n");
+    printf("      FRAME - One packed binary skeleton per frame in kinect::skeleton\n");
+    printf("      STREAM - FRAME, and every frame appended to the kinect::skeleton::stream stream\n");
+    printf("  - Transport: -transport SET|PUBLISH|BOTH (optional)\n");
+    printf("      SET (default) - SET the keys, consumers poll them\n");
+    printf("      PUBLISH - PUBLISH the keys and values of every frame on the kinect::frames channel instead\n");
+    printf("      BOTH - SET the keys and PUBLISH them\n");
+    printf("  - Connection: -async (optional) Send through a non-blocking connection that reconnects automatically\n");
+    printf("      and buffers the latest frames while Redis is unreachable\n");
+    printf("  - Deferred: -deferred (optional) Do not wait for Redis to acknowledge the SETs of a frame; failed writes are\n");
+    printf("      counted when their replies arrive. Has no effect with -async and -atomic\n");
+    printf("  - Atomic: -atomic (optional) Write the keys of every frame as one MULTI/EXEC transaction, versioned by\n");
+    printf("      kinect::frame_seq and kinect::frame_timestamp, so readers never see a mix of two frames\n");
+    printf("  - SharedMemory: -shm NAME (optional) Also write the plain keys of the first body and the body list into\n");
+    printf("      the shared memory region NAME (e.g. /kinect) for SharedMemoryClient readers on the same host\n");
+    printf("  - Stats: -stats MS (optional) Every MS milliseconds, write the encode and round trip times and the traffic\n");
+    printf("      of the Redis connection to kinect::stats::* as JSON\n");
+    printf("  - StreamLength: -maxlen N (optional) Approximate number of frames kept in STREAM mode, 0 for unbounded\n");
+    printf("  - Deadband: -deadband POS_MM ORI (optional) In KEYS mode, only rewrite joints whose position moved more than\n");
+    printf("      POS_MM millimeters or whose rotation matrix changed by more than ORI (about radians); every joint is still\n");
+    printf("      rewritten twice per second\n");
+    printf("  - Precision: -precision N (optional) In KEYS mode, write joint positions with N decimals of a millimeter\n");
+    printf("      instead of the shortest lossless text\n");
+    printf("  - Speed: -speed X (optional) In OFFLINE mode, publish frames X times as fast as recorded, 0 for as fast as\n");
+    printf("      possible (default 1)\n");
+    printf("  - Cache: -cache (optional) In OFFLINE mode, store the skeletons in FILE.skeletons once the whole recording is\n");
+    printf("      tracked, and publish them from there without tracking in later runs\n");
     printf("e.g.   (k4abt_)simple_3d_viewer.exe WFOV_BINNED CPU\n");
     printf("e.g.   (k4abt_)simple_3d_viewer.exe CPU\n");
     printf("e.g.   (k4abt_)simple_3d_viewer.exe WFOV_BINNED\n");
     printf("e.g.   (k4abt_)simple_3d_viewer.exe OFFLINE MyFile.mkv\n");
+    printf("e.g.   (k4abt_)simple_3d_viewer.exe OFFLINE MyFile.mkv -cache -speed 10\n");
+    printf("e.g.   (k4abt_)simple_3d_viewer.exe CUDA -publish FRAME\n");
+    printf("e.g.   (k4abt_)simple_3d_viewer.exe CUDA -publish STREAM -maxlen 3600\n");
+    printf("e.g.   (k4abt_)simple_3d_viewer.exe CUDA -publish FRAME -transport BOTH\n");
+    printf("e.g.   (k4abt_)simple_3d_viewer.exe CUDA -deadband 2 0.01\n");
+    printf("e.g.   (k4abt_)simple_3d_viewer.exe CUDA -precision 1\n");
+    printf("e.g.   (k4abt_)simple_3d_viewer.exe CUDA -atomic\n");
+    printf("e.g.   (k4abt_)simple_3d_viewer.exe CUDA -deferred\n");
+    printf("e.g.   (k4abt_)simple_3d_viewer.exe CUDA -shm /kinect\n");
+    printf("e.g.   (k4abt_)simple_3d_viewer.exe CUDA -stats 1000\n");
 }
 
 void PrintAppUsage()
@@ -63,10 +108,22 @@ Visualization::Layout3d s_layoutMode = Visualization::Layout3d::OnlyMainView;
 bool s_visualizeJointFrame = false;
 
 // Setup redis 
-#include "redis_keys.h"
 RedisClient redis_client;
-std::vector<Eigen::Vector3d> body_pos (kinect_pos_keys.size(), Eigen::Vector3d::Zero());
-std::vector<Eigen::Matrix3d> body_ori (kinect_ori_keys.size(), Eigen::Matrix3d::Identity());
+RedisAsyncClient redis_async_client;
+SharedMemoryClient shared_memory_client;
+
+const char* AsyncStateName(RedisAsyncClient::ConnectionState state)
+{
+    switch (state)
+    {
+    case RedisAsyncClient::CONNECTED:
+        return "connected";
+    case RedisAsyncClient::CONNECTING:
+        return "connecting";
+    default:
+        return "disconnected";
+    }
+}
 
 int64_t ProcessKey(void* /*context*/, int key)
 {
@@ -107,6 +164,19 @@ struct InputSettings
     bool Offline = false;
     std::string FileName;
     std::string ModelPath;
+    SkeletonPublishMode PublishMode = SkeletonPublishMode::Keys;
+    SkeletonTransport Transport = SkeletonTransport::Set;
+    size_t StreamMaxLength = SKELETON_STREAM_MAXLEN;
+    bool AsyncConnection = false;
+    bool DeferredReplies = false;
+    bool AtomicFrames = false;
+    std::string SharedMemoryName;
+    int StatsIntervalMs = 0;
+    double PositionDeadband = 0;
+    double OrientationDeadband = 0;
+    int PositionPrecision = -1;
+    double Speed = 1.0;
+    bool UseCache = false;
 };
 
 bool ParseInputSettingsFromArg(int argc, char** argv, InputSettings& inputSettings)
@@ -152,6 +222,131 @@ bool ParseInputSettingsFromArg(int argc, char** argv, InputSettings& inputSettin
                 return false;
             }
         }
+        else if (inputArg == std::string("-publish"))
+        {
+            std::string mode = (i < argc - 1) ? argv[++i] : "";
+            if (mode == "KEYS")
+            {
+                inputSettings.PublishMode = SkeletonPublishMode::Keys;
+            }
+            else if (mode == "FRAME")
+            {
+                inputSettings.PublishMode = SkeletonPublishMode::Frame;
+            }
+            else if (mode == "STREAM")
+            {
+                inputSettings.PublishMode = SkeletonPublishMode::Stream;
+            }
+            else
+            {
+                printf("Error: publish mode missing or not understood: %s\n", mode.c_str());
+                return false;
+            }
+        }
+        else if (inputArg == std::string("-transport"))
+        {
+            std::string transport = (i < argc - 1) ? argv[++i] : "";
+            if (transport == "SET")
+            {
+                inputSettings.Transport = SkeletonTransport::Set;
+            }
+            else if (transport == "PUBLISH")
+            {
+                inputSettings.Transport = SkeletonTransport::Publish;
+            }
+            else if (transport == "BOTH")
+            {
+                inputSettings.Transport = SkeletonTransport::SetAndPublish;
+            }
+            else
+            {
+                printf("Error: transport missing or not understood: %s\n", transport.c_str());
+                return false;
+            }
+        }
+        else if (inputArg == std::string("-async"))
+        {
+            inputSettings.AsyncConnection = true;
+        }
+        else if (inputArg == std::string("-deferred"))
+        {
+            inputSettings.DeferredReplies = true;
+        }
+        else if (inputArg == std::string("-atomic"))
+        {
+            inputSettings.AtomicFrames = true;
+        }
+        else if (inputArg == std::string("-shm"))
+        {
+            if (i < argc - 1)
+                inputSettings.SharedMemoryName = argv[++i];
+            else
+            {
+                printf("Error: shared memory region name missing\n");
+                return false;
+            }
+        }
+        else if (inputArg == std::string("-stats"))
+        {
+            if (i < argc - 1)
+                inputSettings.StatsIntervalMs = std::atoi(argv[++i]);
+            else
+            {
+                printf("Error: stats interval missing\n");
+                return false;
+            }
+        }
+        else if (inputArg == std::string("-maxlen"))
+        {
+            if (i < argc - 1)
+                inputSettings.StreamMaxLength = std::strtoull(argv[++i], nullptr, 10);
+            else
+            {
+                printf("Error: stream length missing\n");
+                return false;
+            }
+        }
+        else if (inputArg == std::string("-deadband"))
+        {
+            if (i < argc - 2)
+            {
+                inputSettings.PositionDeadband = std::strtod(argv[++i], nullptr);
+                inputSettings.OrientationDeadband = std::strtod(argv[++i], nullptr);
+            }
+            else
+            {
+                printf("Error: deadband thresholds missing\n");
+                return false;
+            }
+        }
+        else if (inputArg == std::string("-precision"))
+        {
+            if (i < argc - 1)
+            {
+                inputSettings.PositionPrecision = std::atoi(argv[++i]);
+            }
+            else
+            {
+                printf("Error: precision missing\n");
+                return false;
+            }
+        }
+        else if (inputArg == std::string("-speed"))
+        {
+            if (i < argc - 1 && std::strtod(argv[i + 1], nullptr) >= 0)
+            {
+                inputSettings.Speed = std::strtod(argv[++i], nullptr);
+            }
+            else
+            {
+                printf("Error: speed missing or negative\n");
+                return false;
+            }
+        }
+        else if (inputArg == std::string("-cache"))
+        {
+            inputSettings.UseCache = true;
+        }
         else if (inputArg == std::string("-model"))
         {
             if (i < argc - 1)
@@ -171,30 +366,14 @@ bool ParseInputSettingsFromArg(int argc, char** argv, InputSettings& inputSettin
     return true;
 }
 
-void VisualizeResult(k4abt_frame_t bodyFrame, Window3dWrapper& window3d, int depthWidth, int depthHeight) {
+void VisualizeResult(k4abt_frame_t bodyFrame, Window3dWrapper& window3d) {
 
     // Obtain original capture that generates the body tracking result
     k4a_capture_t originalCapture = k4abt_frame_get_capture(bodyFrame);
     k4a_image_t depthImage = k4a_capture_get_depth_image(originalCapture);
 
-    std::vector<Color> pointCloudColors(depthWidth * depthHeight, { 1.f, 1.f, 1.f, 1.f });
-
-    // Read body index map and assign colors
-    k4a_image_t bodyIndexMap = k4abt_frame_get_body_index_map(bodyFrame);
-    const uint8_t* bodyIndexMapBuffer = k4a_image_get_buffer(bodyIndexMap);
-    for (int i = 0; i < depthWidth * depthHeight; i++)
-    {
-        uint8_t bodyIndex = bodyIndexMapBuffer[i];
-        if (bodyIndex != K4ABT_BODY_INDEX_MAP_BACKGROUND)
-        {
-            uint32_t bodyId = k4abt_frame_get_body_id(bodyFrame, bodyIndex);
-            pointCloudColors[i] = g_bodyColors[bodyId % g_bodyColors.size()];
-        }
-    }
-    k4a_image_release(bodyIndexMap);
-
-    // Visualize point cloud
-    window3d.UpdatePointClouds(depthImage, pointCloudColors);
+    // Visualize point cloud, with the bodies colored from the body index map by the shader
+    window3d.UpdatePointClouds(depthImage, bodyFrame);
 
     // Visualize the skeleton data
     window3d.CleanJointsAndBones();
@@ -250,8 +429,184 @@ void VisualizeResult(k4abt_frame_t bodyFrame, Window3dWrapper& window3d, int dep
 
 }
 
+// Same clock as the k4a system timestamps, see SkeletonSnapshot
+uint64_t SteadyClockNsec()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Host time the depth image of a body frame was captured, 0 if the frame has no depth image
+uint64_t GetDepthSystemTimestampNsec(k4abt_frame_t bodyFrame)
+{
+    uint64_t timestampNsec = 0;
+    k4a_capture_t capture = k4abt_frame_get_capture(bodyFrame);
+    if (capture != nullptr)
+    {
+        k4a_image_t depthImage = k4a_capture_get_depth_image(capture);
+        if (depthImage != nullptr)
+        {
+            timestampNsec = k4a_image_get_system_timestamp_nsec(depthImage);
+            k4a_image_release(depthImage);
+        }
+        k4a_capture_release(capture);
+    }
+    return timestampNsec;
+}
+
+void PrintLatency(const char* name, const LatencyHistogram& latency)
+{
+    if (latency.count() > 0)
+    {
+        std::cout << name << " latency: p50 " << latency.percentile(0.50) / 1000.0 << " us, p90 "
+                  << latency.percentile(0.90) / 1000.0 << " us, p99 " << latency.percentile(0.99) / 1000.0
+                  << " us, max " << latency.max() / 1000.0 << " us" << std::endl;
+    }
+}
+
+// Applies the publishing options shared by live and OFFLINE mode. Must be called before frames
+// are published.
+void ConfigurePublisher(SkeletonPublisher& skeletonPublisher, const InputSettings& inputSettings)
+{
+    if (inputSettings.AsyncConnection)
+    {
+        skeletonPublisher.SetAsyncClient(&redis_async_client);
+    }
+    skeletonPublisher.SetAtomic(inputSettings.AtomicFrames);
+    if (!inputSettings.SharedMemoryName.empty())
+    {
+        shared_memory_client.create(inputSettings.SharedMemoryName);
+        skeletonPublisher.SetSharedMemory(&shared_memory_client);
+    }
+    if (inputSettings.PositionDeadband > 0 || inputSettings.OrientationDeadband > 0)
+    {
+        skeletonPublisher.SetDeadband(inputSettings.PositionDeadband, inputSettings.OrientationDeadband);
+    }
+    if (inputSettings.PositionPrecision >= 0)
+    {
+        skeletonPublisher.SetPositionPrecision(inputSettings.PositionPrecision);
+    }
+    if (inputSettings.DeferredReplies && !inputSettings.AsyncConnection)
+    {
+        redis_client.setDeferredReplies(true);
+    }
+    if (inputSettings.StatsIntervalMs > 0 && inputSettings.AsyncConnection)
+    {
+        std::cout << "Timing stats are only published on the blocking connection, ignoring -stats" << std::endl;
+    }
+    else if (inputSettings.StatsIntervalMs > 0)
+    {
+        redis_client.setTimingStatsPublishing(STATS_KEY_PREFIX, inputSettings.StatsIntervalMs);
+    }
+}
+
+// Stops the publisher and prints what it sent
+void PrintPublisherSummary(SkeletonPublisher& skeletonPublisher, const InputSettings& inputSettings)
+{
+    skeletonPublisher.Stop();
+    std::cout << "Skeleton publisher: " << skeletonPublisher.PublishedCount() << " published, "
+              << skeletonPublisher.DroppedCount() << " dropped, "
+              << skeletonPublisher.ErrorCount() << " failed" << std::endl;
+    RedisClient::WriteCallbackStats keyStats = skeletonPublisher.KeyWriteStats();
+    if (keyStats.suppressed > 0)
+    {
+        std::cout << "Deadband: " << keyStats.suppressed << " of " << keyStats.written + keyStats.suppressed
+                  << " key writes suppressed (" << 100.0 * keyStats.suppressed / (keyStats.written + keyStats.suppressed)
+                  << "%)" << std::endl;
+    }
+    RedisTimingStats keyTiming = skeletonPublisher.KeyWriteTiming();
+    if (skeletonPublisher.PublishedCount() > 0)
+    {
+        std::cout << "Redis writes: encode p50 " << keyTiming.encode.percentile(0.50) / 1000.0 << " us per callback, ";
+        if (keyTiming.round_trip.count() > 0)
+        {
+            std::cout << "round trip p50 " << keyTiming.round_trip.percentile(0.50) / 1000.0 << " us, p99 "
+                      << keyTiming.round_trip.percentile(0.99) / 1000.0 << " us, ";
+        }
+        std::cout << keyTiming.bytes_sent / skeletonPublisher.PublishedCount() << " bytes per frame" << std::endl;
+    }
+    if (redis_client.deferredReplies())
+    {
+        try
+        {
+            redis_client.waitForDeferredReplies();
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "Waiting for Redis replies failed: " << e.what() << std::endl;
+        }
+        std::cout << "Deferred replies: " << redis_client.deferredErrorCount() << " writes failed";
+        if (redis_client.deferredErrorCount() > 0)
+        {
+            std::cout << ", last error: " << redis_client.lastDeferredError();
+        }
+        std::cout << std::endl;
+    }
+    PrintLatency("Capture to pop", skeletonPublisher.CaptureToPopLatency());
+    PrintLatency("Pop to publish", skeletonPublisher.PopToPublishLatency());
+    if (inputSettings.AsyncConnection)
+    {
+        redis_async_client.disconnect();
+        std::cout << "Redis connection: " << redis_async_client.sentCount() << " commands sent, "
+                  << redis_async_client.droppedCount() << " batches dropped, "
+                  << redis_async_client.failedCount() << " failed, "
+                  << redis_async_client.lostCount() << " lost, "
+                  << redis_async_client.reconnectCount() << " reconnects" << std::endl;
+    }
+}
+
+// Copies the device timestamp and the bodies of a body frame
+void CopyBodyFrame(k4abt_frame_t bodyFrame, SkeletonSnapshot& snapshot)
+{
+    snapshot.deviceTimestampUsec = k4abt_frame_get_device_timestamp_usec(bodyFrame);
+    snapshot.numBodies = std::min(k4abt_frame_get_num_bodies(bodyFrame), SkeletonSnapshot::MaxBodies);
+    for (uint32_t i = 0; i < snapshot.numBodies; i++)
+    {
+        VERIFY(k4abt_frame_get_body_skeleton(bodyFrame, i, &snapshot.skeletons[i]), "Get skeleton from body frame failed!");
+        snapshot.bodyIds[i] = k4abt_frame_get_body_id(bodyFrame, i);
+    }
+}
+
+// What the skeletons of the recording depend on, to match them with a sidecar cache
+SkeletonCache::Source CacheSourceFor(const InputSettings& inputSettings)
+{
+    return SkeletonCache::SourceFor(inputSettings.FileName, static_cast<uint32_t>(inputSettings.processingMode), inputSettings.ModelPath);
+}
+
+// Publishes the skeletons of a sidecar cache without the tracker and the 3d window. Returns false
+// if there is no cache for the recording, processing mode and model.
+bool PlayCache(const InputSettings& inputSettings, SkeletonPublisher& skeletonPublisher, ReplayClock& clock)
+{
+    const std::string cachePath = SkeletonCache::PathFor(inputSettings.FileName);
+    SkeletonCache::Reader cacheReader;
+    if (!cacheReader.Open(cachePath, CacheSourceFor(inputSettings)))
+    {
+        return false;
+    }
+
+    std::cout << "Publishing the skeletons cached in " << cachePath << std::endl;
+    SkeletonSnapshot snapshot;
+    while (s_isRunning && cacheReader.Read(snapshot))
+    {
+        clock.WaitFor(snapshot.deviceTimestampUsec);
+        snapshot.popTimestampNsec = SteadyClockNsec();
+        skeletonPublisher.PublishNow(snapshot);
+    }
+    return true;
+}
+
 void PlayFile(InputSettings inputSettings)
 {
+    // Frames are published on this thread, so none is skipped however fast they are replayed
+    SkeletonPublisher skeletonPublisher(redis_client, inputSettings.PublishMode, inputSettings.Transport, 0, inputSettings.StreamMaxLength);
+    ConfigurePublisher(skeletonPublisher, inputSettings);
+    ReplayClock clock(inputSettings.Speed);
+    if (inputSettings.UseCache && PlayCache(inputSettings, skeletonPublisher, clock))
+    {
+        PrintPublisherSummary(skeletonPublisher, inputSettings);
+        return;
+    }
+
     // Initialize the 3d window controller
     Window3dWrapper window3d;
 
@@ -281,13 +636,19 @@ void PlayFile(InputSettings inputSettings)
     trackerConfig.model_path = inputSettings.ModelPath.c_str();
     VERIFY(k4abt_tracker_create(&sensorCalibration, trackerConfig, &tracker), "Body tracker initialization failed!");
 
-    int depthWidth = sensorCalibration.depth_camera_calibration.resolution_width;
-    int depthHeight = sensorCalibration.depth_camera_calibration.resolution_height;
-
     window3d.Create("3D Visualization", sensorCalibration);
     window3d.SetCloseCallback(CloseCallback);
     window3d.SetKeyCallback(ProcessKey);
 
+    // Tracking results are cached for the next run once the whole recording was tracked
+    const std::string cachePath = SkeletonCache::PathFor(inputSettings.FileName);
+    SkeletonCache::Writer cacheWriter;
+    if (inputSettings.UseCache && !cacheWriter.Open(cachePath, CacheSourceFor(inputSettings)))
+    {
+        std::cout << "Warning: Could not write the skeleton cache " << cachePath << std::endl;
+    }
+    uint64_t frameId = 0;
+
     while (playbackResult == K4A_STREAM_RESULT_SUCCEEDED && s_isRunning)
     {
         playbackResult = k4a_playback_get_next_capture(playbackHandle, &capture);
@@ -327,7 +688,22 @@ void PlayFile(InputSettings inputSettings)
             if (popFrameResult == K4A_WAIT_RESULT_SUCCEEDED)
             {
                 /************* Successfully get a body tracking result, process the result here ***************/
-                VisualizeResult(bodyFrame, window3d, depthWidth, depthHeight); 
+                VisualizeResult(bodyFrame, window3d); 
+
+                SkeletonSnapshot snapshot;
+                CopyBodyFrame(bodyFrame, snapshot);
+                snapshot.frameId = frameId++;
+                if (cacheWriter.IsOpen())
+                {
+                    cacheWriter.Write(snapshot);
+                }
+
+                // A frame counts as popped when it is due. The system timestamps of a recording are
+                // from the recording host, so capture to pop latency is not measured.
+                clock.WaitFor(snapshot.deviceTimestampUsec);
+                snapshot.popTimestampNsec = SteadyClockNsec();
+                skeletonPublisher.PublishNow(snapshot);
+
                 //Release the bodyFrame
                 k4abt_frame_release(bodyFrame);
             }
@@ -343,6 +719,19 @@ void PlayFile(InputSettings inputSettings)
         window3d.Render();
     }
 
+    if (cacheWriter.IsOpen() && playbackResult == K4A_STREAM_RESULT_EOF)
+    {
+        if (cacheWriter.Commit())
+        {
+            std::cout << "Cached " << frameId << " frames of skeletons in " << cachePath << std::endl;
+        }
+        else
+        {
+            std::cout << "Warning: Could not write the skeleton cache " << cachePath << std::endl;
+        }
+    }
+    PrintPublisherSummary(skeletonPublisher, inputSettings);
+
     k4abt_tracker_shutdown(tracker);
     k4abt_tracker_destroy(tracker);
     window3d.Delete();
@@ -365,8 +754,6 @@ void PlayFromDevice(InputSettings inputSettings)
     k4a_calibration_t sensorCalibration;
     VERIFY(k4a_device_get_calibration(device, deviceConfig.depth_mode, deviceConfig.color_resolution, &sensorCalibration),
         "Get depth camera calibration failed!");
-    int depthWidth = sensorCalibration.depth_camera_calibration.resolution_width;
-    int depthHeight = sensorCalibration.depth_camera_calibration.resolution_height;
 
     // Create Body Tracker
     k4abt_tracker_t tracker = nullptr;
@@ -381,6 +768,12 @@ void PlayFromDevice(InputSettings inputSettings)
     window3d.SetCloseCallback(CloseCallback);
     window3d.SetKeyCallback(ProcessKey);
 
+    // Redis writes happen on the publisher thread so a slow server never stalls tracking
+    SkeletonPublisher skeletonPublisher(redis_client, inputSettings.PublishMode, inputSettings.Transport, 0, inputSettings.StreamMaxLength);
+    ConfigurePublisher(skeletonPublisher, inputSettings);
+    RedisAsyncClient::ConnectionState asyncState = RedisAsyncClient::DISCONNECTED;
+    skeletonPublisher.Start();
+
     while (s_isRunning)
     {
         k4a_capture_t sensorCapture = nullptr;
@@ -412,23 +805,28 @@ void PlayFromDevice(InputSettings inputSettings)
         k4a_wait_result_t popFrameResult = k4abt_tracker_pop_result(tracker, &bodyFrame, 0); // timeout_in_ms is set to 0
         if (popFrameResult == K4A_WAIT_RESULT_SUCCEEDED)
         {
-            /************* Successfully get a body tracking result, process the result here ***************/
-            VisualizeResult(bodyFrame, window3d, depthWidth, depthHeight);
+            const uint64_t popTimestampNsec = SteadyClockNsec();
 
-            // Collect and send information to redis 
-            k4abt_skeleton_t skeleton;
-            k4abt_frame_get_body_skeleton(bodyFrame, 0, &skeleton);  // only 1 body, thus index 0
+            /************* Successfully get a body tracking result, process the result here ***************/
+            VisualizeResult(bodyFrame, window3d);
 
+            // Collect and send information of all bodies to redis 
             // Joint reference: https://microsoft.github.io/Azure-Kinect-Body-Tracking/release/1.x.x/k4abttypes_8h_source.html
             // Joint labeling: https://learn.microsoft.com/en-us/azure/kinect-dk/body-joints
             // Joint information (pos [mm]/ori): https://microsoft.github.io/Azure-Kinect-Body-Tracking/release/1.x.x/structk4abt__joint__t.html
             // Coordinate system reference: https://learn.microsoft.com/en-us/azure/kinect-dk/coordinate-systems
-
-            for (int i = 0; i < kinect_pos_keys.size(); ++i) {
-                body_pos[i] = Eigen::Vector3d(skeleton.joints[i].position.v[0], skeleton.joints[i].position.v[1], skeleton.joints[i].position.v[2]);
-                body_ori[i] = Eigen::Quaterniond(skeleton.joints[i].orientation.v[0], skeleton.joints[i].orientation.v[1], skeleton.joints[i].orientation.v[2], skeleton.joints[i].orientation.v[3]).toRotationMatrix();
+            SkeletonSnapshot snapshot;
+            CopyBodyFrame(bodyFrame, snapshot);
+            snapshot.systemTimestampNsec = GetDepthSystemTimestampNsec(bodyFrame);
+            snapshot.popTimestampNsec = popTimestampNsec;
+            skeletonPublisher.Publish(snapshot);
+
+            // Report connection changes of the async connection
+            if (inputSettings.AsyncConnection && redis_async_client.state() != asyncState)
+            {
+                asyncState = redis_async_client.state();
+                std::cout << "Redis connection: " << AsyncStateName(asyncState) << std::endl;
             }
-            redis_client.executeWriteCallback(0);
 
             // Release the bodyFrame
             k4abt_frame_release(bodyFrame);
@@ -439,6 +837,8 @@ void PlayFromDevice(InputSettings inputSettings)
         window3d.Render();
     }
 
+    PrintPublisherSummary(skeletonPublisher, inputSettings);
+
     std::cout << "Finished body tracking processing!" << std::endl;
 
     window3d.Delete();
@@ -460,11 +860,15 @@ int main(int argc, char** argv)
         return -1;
     }
 
-    // Connect to redis server
-    redis_client.connect();
-    for (int i = 0; i < kinect_pos_keys.size(); ++i) {
-        redis_client.addEigenToWriteCallback(0, kinect_pos_keys[i], body_pos[i]);
-        redis_client.addEigenToWriteCallback(0, kinect_ori_keys[i], body_ori[i]);
+    // Connect to redis server. The async connection keeps retrying in the background, so the
+    // viewer also starts while Redis is down.
+    if (inputSettings.AsyncConnection)
+    {
+        redis_async_client.connect();
+    }
+    else
+    {
+        redis_client.connect();
     }
 
     // Either play the offline file or play from the device
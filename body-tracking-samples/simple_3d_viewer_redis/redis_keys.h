@@ -9,6 +9,72 @@
  * 
  */
 
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Kinect packed skeleton key (frame mode, see PackedSkeleton.h)
+const std::string SKELETON_KEY = "kinect::skeleton";
+
+// Kinect packed skeleton history (stream mode). Each entry holds one packed skeleton in the
+// SKELETON_STREAM_FIELD field; the default retention is about 10 minutes at 30 fps.
+const std::string SKELETON_STREAM_KEY = "kinect::skeleton::stream";
+const std::string SKELETON_STREAM_FIELD = "skeleton";
+const size_t SKELETON_STREAM_MAXLEN = 18000;
+
+// Kinect skeleton Pub/Sub channel. Each message holds the keys and values of one frame in the
+// selected layout, see RedisClient::publishWriteCallback().
+const std::string SKELETON_CHANNEL = "kinect::frames";
+
+// Frame version keys. With atomic frames, every frame is written as one MULTI/EXEC transaction
+// that increments FRAME_SEQ_KEY and sets FRAME_TIMESTAMP_KEY to the device timestamp of the frame
+// in microseconds, see RedisClient::executeReadCallbackConsistent() for reading whole frames.
+const std::string FRAME_SEQ_KEY = "kinect::frame_seq";
+const std::string FRAME_TIMESTAMP_KEY = "kinect::frame_timestamp";
+
+// Frame time keys, written with every frame as decimal integers. FRAME_DEVICE_TIME_KEY is the
+// device timestamp of the body frame in microseconds; FRAME_SYSTEM_TIME_KEY the host time the
+// depth image was captured and FRAME_PUBLISH_TIME_KEY the host time the frame was sent, both in
+// nanoseconds of the host monotonic clock (std::chrono::steady_clock on Linux and Windows).
+// FRAME_SYSTEM_TIME_KEY is 0 if unknown, e.g. for replayed frames.
+const std::string FRAME_DEVICE_TIME_KEY = "kinect::time::device_usec";
+const std::string FRAME_SYSTEM_TIME_KEY = "kinect::time::system_nsec";
+const std::string FRAME_PUBLISH_TIME_KEY = "kinect::time::publish_nsec";
+
+// Latency percentiles of the frames of the last LATENCY_WINDOW_MS, from the depth image capture
+// to popping the body frame from the tracker and from popping to sending it. JSON in
+// microseconds, e.g. {"p50":41250,"p90":43500,"p99":45750,"max":46012,"count":150}
+const std::string LATENCY_CAPTURE_TO_POP_KEY = "kinect::latency::capture_to_pop";
+const std::string LATENCY_POP_TO_PUBLISH_KEY = "kinect::latency::pop_to_publish";
+const int LATENCY_WINDOW_MS = 5000;
+
+// Timing of the RedisClient of the publisher, published with -stats: kinect::stats::write::<n>,
+// kinect::stats::read::<n>, kinect::stats::pipeset and kinect::stats::pipeget, see
+// RedisClient::publishTimingStats()
+const std::string STATS_KEY_PREFIX = "kinect::stats::";
+
+// Kinect multi-body keys. Every tracked body is written under kinect::body::<id>::, e.g.
+// kinect::body::3::pos::pelvis or kinect::body::3::skeleton, while the keys above and below hold
+// the first body of the frame. Body keys expire when a body has not been seen for
+// BODY_KEY_EXPIRY_MS, so ids of people who left the scene disappear by themselves.
+const std::string BODY_KEY_PREFIX = "kinect::body::";
+const std::string BODY_IDS_KEY = "kinect::body::ids";       // JSON list of tracked body ids, e.g. [1,3]
+const std::string BODY_COUNT_KEY = "kinect::body::count";   // number of tracked bodies
+const int BODY_KEY_EXPIRY_MS = 1000;
+
+// With a deadband, joints that stand still are skipped but still rewritten at least this often,
+// well within BODY_KEY_EXPIRY_MS
+const int DEADBAND_REFRESH_MS = 500;
+
+// Per-body variant of a key, e.g. kinect::pos::pelvis -> kinect::body::3::pos::pelvis
+inline std::string BodyKey(uint32_t bodyId, const std::string& key)
+{
+    const std::string prefix = "kinect::";
+    return BODY_KEY_PREFIX + std::to_string(bodyId) + "::" + key.substr(prefix.size());
+}
+
 // Kinect position keys 
 const std::string PELVIS_POS_KEY = "kinect::pos::pelvis";
 const std::string SPINE_NAVAL_POS_KEY = "kinect::pos::spine_naval";
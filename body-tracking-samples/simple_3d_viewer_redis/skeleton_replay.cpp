@@ -0,0 +1,282 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <PackedSkeleton.h>
+#include <RedisClient.h>
+
+#include "ReplayClock.h"
+#include "SkeletonPublisher.h"
+
+// Replays a skeleton history recorded by simple_3d_viewer_redis in STREAM mode. Entries are
+// read from the stream in large XRANGE batches, consecutive entries of the same frame id are
+// grouped back into one multi-body frame, and frames are re-published like live skeletons,
+// paced by their device timestamps.
+
+void PrintUsage()
+{
+    printf("\nUSAGE: skeleton_replay [-stream KEY] [-start ID] [-end ID] [-speed X] [-batch N] [-publish KEYS|FRAME] [-transport SET|PUBLISH|BOTH] [-follow]\n");
+    printf("  - -stream KEY: stream to replay (default kinect::skeleton::stream)\n");
+    printf("  - -start ID / -end ID: first and last stream id to replay (default - and +, the whole stream)\n");
+    printf("  - -speed X: replay rate relative to the recording, 0 for as fast as possible (default 1)\n");
+    printf("  - -batch N: entries fetched per XRANGE/XREAD command (default 1000)\n");
+    printf("  - -publish KEYS|FRAME: key layout to publish, same as simple_3d_viewer_redis (default FRAME)\n");
+    printf("  - -transport SET|PUBLISH|BOTH: SET the keys and/or PUBLISH them on kinect::frames (default SET)\n");
+    printf("  - -follow: after the end of the stream, keep publishing new entries as they arrive (XREAD BLOCK)\n");
+    printf("e.g.   skeleton_replay -speed 4\n");
+    printf("e.g.   skeleton_replay -start 1684000000000 -end 1684000060000 -publish KEYS\n");
+}
+
+struct ReplaySettings
+{
+    std::string StreamKey = SKELETON_STREAM_KEY;
+    std::string Start = "-";
+    std::string End = "+";
+    double Speed = 1.0;
+    size_t BatchSize = 1000;
+    SkeletonPublishMode PublishMode = SkeletonPublishMode::Frame;
+    SkeletonTransport Transport = SkeletonTransport::Set;
+    bool Follow = false;
+};
+
+bool ParseReplaySettingsFromArg(int argc, char** argv, ReplaySettings& settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string inputArg(argv[i]);
+        if (i == argc - 1 && inputArg != "-follow")
+        {
+            printf("Error: value missing for %s\n", inputArg.c_str());
+            return false;
+        }
+
+        if (inputArg == "-stream")
+        {
+            settings.StreamKey = argv[++i];
+        }
+        else if (inputArg == "-start")
+        {
+            settings.Start = argv[++i];
+        }
+        else if (inputArg == "-end")
+        {
+            settings.End = argv[++i];
+        }
+        else if (inputArg == "-speed")
+        {
+            settings.Speed = std::atof(argv[++i]);
+            if (settings.Speed < 0)
+            {
+                printf("Error: speed must not be negative\n");
+                return false;
+            }
+        }
+        else if (inputArg == "-batch")
+        {
+            settings.BatchSize = std::strtoull(argv[++i], nullptr, 10);
+            if (settings.BatchSize == 0)
+            {
+                printf("Error: batch size must be positive\n");
+                return false;
+            }
+        }
+        else if (inputArg == "-publish")
+        {
+            std::string mode(argv[++i]);
+            if (mode == "KEYS")
+            {
+                settings.PublishMode = SkeletonPublishMode::Keys;
+            }
+            else if (mode == "FRAME")
+            {
+                settings.PublishMode = SkeletonPublishMode::Frame;
+            }
+            else
+            {
+                printf("Error: publish mode not understood: %s\n", mode.c_str());
+                return false;
+            }
+        }
+        else if (inputArg == "-transport")
+        {
+            std::string transport(argv[++i]);
+            if (transport == "SET")
+            {
+                settings.Transport = SkeletonTransport::Set;
+            }
+            else if (transport == "PUBLISH")
+            {
+                settings.Transport = SkeletonTransport::Publish;
+            }
+            else if (transport == "BOTH")
+            {
+                settings.Transport = SkeletonTransport::SetAndPublish;
+            }
+            else
+            {
+                printf("Error: transport not understood: %s\n", transport.c_str());
+                return false;
+            }
+        }
+        else if (inputArg == "-follow")
+        {
+            settings.Follow = true;
+        }
+        else
+        {
+            printf("Error: command not understood: %s\n", inputArg.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+std::atomic<bool> s_isRunning{ true };
+
+// Id of the last entry of a stream, "0-0" if the stream is empty or does not exist
+std::string StreamLastId(RedisClient& redisClient, const std::string& key)
+{
+    auto reply = redisClient.commandArgv({ "XREVRANGE", key, "+", "-", "COUNT", "1" });
+    if (!reply || reply->type != REDIS_REPLY_ARRAY)
+    {
+        throw std::runtime_error("skeleton_replay: XREVRANGE '" + key + "' failed.");
+    }
+    if (reply->elements == 0)
+    {
+        return "0-0";
+    }
+
+    // [[id, [field, value, ...]]]
+    const redisReply* entry = reply->element[0];
+    if (entry->type != REDIS_REPLY_ARRAY || entry->elements < 1 || entry->element[0]->type != REDIS_REPLY_STRING)
+    {
+        throw std::runtime_error("skeleton_replay: XREVRANGE '" + key + "' returned a malformed reply.");
+    }
+    return std::string(entry->element[0]->str, entry->element[0]->len);
+}
+
+void StopReplay(int)
+{
+    s_isRunning = false;
+}
+
+int main(int argc, char** argv)
+{
+    ReplaySettings settings;
+    if (!ParseReplaySettingsFromArg(argc, argv, settings))
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    RedisClient redisClient;
+    redisClient.connect();
+
+    SkeletonPublisher publisher(redisClient, settings.PublishMode, settings.Transport);
+    ReplayClock clock(settings.Speed);
+    std::signal(SIGINT, StopReplay);
+
+    uint64_t replayed = 0;
+    uint64_t malformed = 0;
+    std::string start = settings.Start;
+    std::string lastId;
+    bool following = false;
+
+    // Frame whose bodies are being collected
+    SkeletonSnapshot frame;
+    frame.numBodies = 0;
+    auto publishFrame = [&]()
+    {
+        if (frame.numBodies > 0 && s_isRunning)
+        {
+            clock.WaitFor(frame.deviceTimestampUsec);
+            publisher.PublishNow(frame);
+            replayed++;
+        }
+        frame.numBodies = 0;
+    };
+
+    while (s_isRunning)
+    {
+        std::vector<RedisClient::StreamEntry> entries;
+        if (!following)
+        {
+            entries = redisClient.xrange(settings.StreamKey, start, settings.End, settings.BatchSize);
+        }
+        else
+        {
+            // Wake up once a second to check for Ctrl-C. Reads continue from a fixed id rather than
+            // "$", so entries added between two reads are not skipped.
+            if (lastId.empty())
+            {
+                lastId = StreamLastId(redisClient, settings.StreamKey);
+            }
+            entries = redisClient.xread(settings.StreamKey, lastId, settings.BatchSize, 1000);
+        }
+
+        for (const auto& entry : entries)
+        {
+            if (!s_isRunning)
+            {
+                break;
+            }
+            lastId = entry.id;
+
+            PackedSkeleton::FrameInfo info;
+            k4abt_skeleton_t skeleton;
+            if (entry.fields.empty() || entry.fields[0].first != SKELETON_STREAM_FIELD ||
+                !PackedSkeleton::Decode(entry.fields[0].second, info, skeleton))
+            {
+                malformed++;
+                continue;
+            }
+
+            if (frame.numBodies > 0 && frame.frameId != info.frameId)
+            {
+                publishFrame();
+            }
+            if (frame.numBodies < SkeletonSnapshot::MaxBodies)
+            {
+                frame.frameId = info.frameId;
+                frame.deviceTimestampUsec = info.deviceTimestampUsec;
+                frame.bodyIds[frame.numBodies] = info.bodyId;
+                frame.skeletons[frame.numBodies] = skeleton;
+                frame.numBodies++;
+            }
+        }
+
+        // While following, publish without waiting for the next frame. The bodies of a frame
+        // are appended back to back, so they practically always arrive in the same read.
+        if (following)
+        {
+            publishFrame();
+        }
+
+        if (!following && entries.size() < settings.BatchSize)
+        {
+            // End of the requested range
+            publishFrame();
+            if (!settings.Follow || settings.End != "+")
+            {
+                break;
+            }
+            following = true;
+        }
+        else if (!following && !entries.empty())
+        {
+            start = RedisClient::nextStreamId(entries.back().id);
+        }
+    }
+
+    std::cout << "Skeleton replay: " << replayed << " frames replayed, "
+              << malformed << " malformed entries skipped, "
+              << publisher.ErrorCount() << " failed" << std::endl;
+    return 0;
+}